@@ -0,0 +1,522 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "elements.h"
+#include "basic.h"
+#include "bigint.h"
+#include "crt.h"
+#include "elimination.h"
+#include "math.h"
+#include "matrix.h"
+#include "modn.h"
+#include "perf.h"
+#include "rational.h"
+#include "threadpool.h"
+
+#pragma once
+
+/**
+ * Exact linear algebra over the integers and the rationals, for
+ * DenseMatrix's over BasicOps<T> and BasicOps<Rational<T> > with T a
+ * signed integer type. Elimination over Rational's would normalize (two
+ * gcds) after every operation while the numerators grow, so everything
+ * here works on integers instead: a rational matrix has each row (of the
+ * system, for solve) multiplied by the lcm of its denominators first.
+ *
+ * bareissDet and bareissSolve are fraction-free Gaussian elimination
+ * (Bareiss): every entry stays an integer, a minor of the matrix, and the
+ * divisions are exact. T has to hold those minors, or they throw.
+ *
+ * modularDet and modularSolve eliminate mod several primes below 2^31
+ * instead, in parallel, with Pluq (elimination.h), and put the results
+ * back together with CrtBasis, and rational reconstruction for solve. There
+ * are never more than four primes, enough for a 124-bit CRT result, which
+ * bounds what they can find: for det, the determinant of the integer
+ * matrix, so det(a) times the lcm's of a's rows; for solve, rational
+ * reconstruction needs the modulus past twice the square of the larger of
+ * numerator and denominator, so both have to stay below about 2^61. The
+ * solution is always checked exactly, with BigUnsigned's, before it is
+ * returned. Both throw if the result is too large, and solve if the
+ * system is singular.
+ */
+
+template <typename E>
+struct ExactElement {
+  typedef E integer;
+  static E numerator(const E& x) { return x; }
+  static E denominator(const E&) { return 1; }
+  static E quotient(const E& numerator, const E&) { return numerator; }
+};
+template <typename T>
+struct ExactElement<Rational<T> > {
+  typedef T integer;
+  static T numerator(const Rational<T>& x) { return x.numerator_; }
+  static T denominator(const Rational<T>& x) { return x.denominator_; }
+  static Rational<T> quotient(const T& numerator, const T& denominator) {
+    return Rational<T>(numerator, denominator);
+  }
+};
+
+// Products of two T's, for the steps of the fraction-free elimination whose
+// results fit in T, but whose products don't have to.
+template <typename T>
+struct ExactProduct {
+  typedef T type;
+};
+template <>
+struct ExactProduct<int> {
+  typedef long long type;
+};
+template <>
+struct ExactProduct<long> {
+  typedef __int128 type;
+};
+template <>
+struct ExactProduct<long long> {
+  typedef __int128 type;
+};
+
+// x * y, throwing if it doesn't fit in T.
+template <typename T>
+static T exactTimes(T x, T y) {
+  T ret;
+  if (__builtin_mul_overflow(x, y, &ret)) throw "Entries too large for the element type";
+  return ret;
+}
+
+/**
+ * [a | b] as integers, n x (n + k) row by row, each row multiplied by the
+ * lcm of its denominators, which go in *multipliers unless it's null.
+ */
+template <typename E>
+std::vector<typename ExactElement<E>::integer> exactRows(
+    const DenseMatrix<BasicOps<E> >& a, const DenseMatrix<BasicOps<E> >* b,
+    std::vector<typename ExactElement<E>::integer>* multipliers) {
+  typedef ExactElement<E> Exact;
+  typedef typename Exact::integer T;
+  int n = a.height_;
+  int k = b ? b->width_ : 0;
+  if (a.width_ != n) throw "Size mismatch";
+  if (b && b->height_ != n) throw "Size mismatch";
+  std::vector<T> ret;
+  ret.reserve(static_cast<size_t>(n) * (n + k));
+  for (int i = 0; i < n; i++) {
+    T multiplier = 1;
+    for (int j = 0; j < n + k; j++) {
+      T denominator = Exact::denominator((j < n ? a[i][j] : (*b)[i][j - n]).element_);
+      multiplier = exactTimes(multiplier / gcd(multiplier, denominator), denominator);
+    }
+    for (int j = 0; j < n + k; j++) {
+      const E& x = (j < n ? a[i][j] : (*b)[i][j - n]).element_;
+      ret.push_back(exactTimes(Exact::numerator(x), multiplier / Exact::denominator(x)));
+    }
+    if (multipliers) multipliers->push_back(multiplier);
+  }
+  return ret;
+}
+
+// det / (the product of multipliers), as an E. Neither det nor the product
+// has to fit in T, only the quotient, so the gcds come out one at a time.
+template <typename E>
+E exactQuotient(__int128 det,
+                const std::vector<typename ExactElement<E>::integer>& multipliers) {
+  typedef typename ExactElement<E>::integer T;
+  T denominator = 1;
+  for (size_t i = 0; i < multipliers.size(); i++) {
+    unsigned __int128 magnitude = det < 0 ? -static_cast<unsigned __int128>(det)
+        : static_cast<unsigned __int128>(det);
+    __int128 g = static_cast<__int128>(
+        gcd(magnitude, static_cast<unsigned __int128>(multipliers[i])));
+    det /= g;
+    T rest = static_cast<T>(multipliers[i] / g);
+    if (__builtin_mul_overflow(denominator, rest, &denominator)) {
+      throw "Determinant too large for the element type";
+    }
+  }
+  if (static_cast<__int128>(static_cast<T>(det)) != det) {
+    throw "Determinant too large for the element type";
+  }
+  return ExactElement<E>::quotient(static_cast<T>(det), denominator);
+}
+
+/**
+ * Fraction-free elimination of the n x (n + k) [a | b], in place: after
+ * step i, each entry below row i is the determinant of the (i + 1) x
+ * (i + 1) minor it closes, so dividing by the previous pivot is exact.
+ * Leaves an upper triangular a whose last pivot is det(P a), for the row
+ * swaps P, and returns whether a is nonsingular; *odd is set to whether P
+ * is an odd permutation. Throws if a minor doesn't fit in T.
+ */
+template <typename T>
+static bool bareissEliminate(int n, int k, std::vector<T>* values, bool* odd) {
+  typedef typename ExactProduct<T>::type W;
+  ALGEBRA_PERF_REGION("bareissEliminate");
+  int width = n + k;
+  T* a = values->data();
+  T previous = 1;
+  *odd = false;
+  for (int p = 0; p < n; p++) {
+    int pivot = p;
+    while (pivot < n && a[static_cast<size_t>(pivot) * width + p] == 0) pivot++;
+    if (pivot == n) return false;
+    if (pivot != p) {
+      std::swap_ranges(a + static_cast<size_t>(p) * width,
+                       a + static_cast<size_t>(p + 1) * width,
+                       a + static_cast<size_t>(pivot) * width);
+      *odd = !*odd;
+    }
+    const T* row = a + static_cast<size_t>(p) * width;
+    for (int i = p + 1; i < n; i++) {
+      T* target = a + static_cast<size_t>(i) * width;
+      W factor = target[p];
+      for (int j = p + 1; j < width; j++) {
+        W minor = (static_cast<W>(target[j]) * row[p] - factor * row[j]) / previous;
+        target[j] = static_cast<T>(minor);
+        if (target[j] != minor) throw "Minor too large for the element type";
+      }
+      target[p] = 0;
+    }
+    previous = row[p];
+  }
+  return true;
+}
+
+template <typename E>
+E bareissDet(const DenseMatrix<BasicOps<E> >& a) {
+  typedef typename ExactElement<E>::integer T;
+  std::vector<T> multipliers;
+  std::vector<T> values = exactRows<E>(a, nullptr, &multipliers);
+  int n = a.height_;
+  bool odd;
+  if (n == 0) return E(1);
+  if (!bareissEliminate(n, 0, &values, &odd)) return E(0);
+  T det = values.back();
+  return exactQuotient<E>(odd ? -det : det, multipliers);
+}
+
+/**
+ * The x with a * x = b for a nonsingular a, by bareissEliminate and then
+ * back substitution on det(a) * x, which is an integer matrix (adj(a) * b),
+ * so again every division is exact. Throws for a singular a.
+ */
+template <typename E>
+DenseMatrix<BasicOps<Rational<typename ExactElement<E>::integer> > > bareissSolve(
+    const DenseMatrix<BasicOps<E> >& a, const DenseMatrix<BasicOps<E> >& b) {
+  typedef typename ExactElement<E>::integer T;
+  typedef typename ExactProduct<T>::type W;
+  typedef BasicOps<Rational<T> > Ops;
+  std::vector<T> values = exactRows<E>(a, &b, nullptr);
+  int n = a.height_, k = b.width_, width = n + k;
+  bool odd;
+  if (!bareissEliminate(n, k, &values, &odd)) throw "Singular matrix";
+  std::vector<Rational<T> > x;
+  if (n == 0 || k == 0) return denseMatrix(Ops::instance, k, n, x);
+  T det = values[static_cast<size_t>(n - 1) * width + n - 1];
+  // scaled[i * k + c] = det * x[i][c]
+  std::vector<T> scaled(static_cast<size_t>(n) * k);
+  for (int i = n; i-- > 0; ) {
+    const T* row = &values[static_cast<size_t>(i) * width];
+    for (int c = 0; c < k; c++) {
+      W sum = static_cast<W>(det) * row[n + c];
+      for (int j = i + 1; j < n; j++) {
+        sum -= static_cast<W>(row[j]) * scaled[static_cast<size_t>(j) * k + c];
+      }
+      W entry = sum / row[i];
+      scaled[static_cast<size_t>(i) * k + c] = static_cast<T>(entry);
+      if (scaled[static_cast<size_t>(i) * k + c] != entry) {
+        throw "Solution too large for the element type";
+      }
+    }
+  }
+  x.reserve(scaled.size());
+  for (size_t i = 0; i < scaled.size(); i++) {
+    x.push_back(Rational<T>(scaled[i], det));
+  }
+  return denseMatrix(Ops::instance, k, n, x);
+}
+
+// The largest prime below n, by trial division.
+static inline uint32_t previousPrime(uint32_t n) {
+  for (uint32_t p = n - 1; p > 2; p--) {
+    if (p % 2 == 0) continue;
+    bool prime = true;
+    for (uint32_t d = 3; d * d <= p; d += 2) {
+      if (p % d == 0) {
+        prime = false;
+        break;
+      }
+    }
+    if (prime) return p;
+  }
+  return 2;
+}
+
+// The i'th largest prime below 2^31; they are found once and kept.
+static inline uint32_t modularPrime(size_t i) {
+  static std::mutex mutex;
+  static std::vector<uint32_t> primes;
+  std::lock_guard<std::mutex> lock(mutex);
+  while (primes.size() <= i) {
+    primes.push_back(previousPrime(primes.empty() ? 1U << 31 : primes.back()));
+  }
+  return primes[i];
+}
+
+// CrtBasis::fitsWide() holds for this many primes below 2^31.
+static const int kModularMaxPrimes = 4;
+
+// log2 of the Hadamard bound, the product of the norms of the rows of the
+// n x n a (row by row with the given width), each row extended by the
+// largest of the extra columns [n, width) if extra.
+template <typename T>
+static double hadamardBits(int n, int width, const std::vector<T>& a, bool extra) {
+  double bits = 0;
+  for (int i = 0; i < n; i++) {
+    const T* row = &a[static_cast<size_t>(i) * width];
+    double squares = 0, largest = 0;
+    for (int j = 0; j < n; j++) {
+      squares += static_cast<double>(row[j]) * static_cast<double>(row[j]);
+    }
+    for (int j = n; extra && j < width; j++) {
+      largest = std::max(largest, static_cast<double>(row[j]) * static_cast<double>(row[j]));
+    }
+    bits += 0.5 * log2(std::max(squares + largest, 1.0));
+  }
+  return bits;
+}
+
+// How many of the modularPrime()'s it takes for their product to pass
+// 2^bits.
+static inline int primesFor(double bits) {
+  int count = 0;
+  for (; bits >= 0; count++) {
+    bits -= log2(static_cast<double>(modularPrime(count)));
+  }
+  return count;
+}
+
+/**
+ * Eliminates the n x (n + k) [a | b] (row by row) mod each of the primes,
+ * in parallel: for each prime, sets unlucky[i] if a is singular mod it, and
+ * otherwise fills residues (n x k per prime, one after the other) with a
+ * solution of a * x = b mod it, or dets[i] with det(a) mod it if k < 0.
+ */
+template <typename T>
+static void eliminateModPrimes(int n, int k, const std::vector<T>& values,
+                               const std::vector<uint32_t>& primes,
+                               std::vector<uint32_t>* residues,
+                               std::vector<bool>* unlucky,
+                               const ParallelOptions& options) {
+  typedef IntegerModOps<int> Ops;
+  int columns = k < 0 ? 0 : k;
+  int width = n + columns;
+  residues->assign(primes.size() * std::max<size_t>(static_cast<size_t>(n) * columns, 1), 0);
+  std::vector<char> singular(primes.size(), 0);
+  uint64_t cost = static_cast<uint64_t>(n) * n * (n + columns) + 1;
+  parallelFor(primes.size(), cost, [&](size_t begin, size_t end) {
+    for (size_t t = begin; t < end; t++) {
+      Ops ops(static_cast<int>(primes[t]));
+      std::vector<int> a, b;
+      a.reserve(static_cast<size_t>(n) * n);
+      b.reserve(static_cast<size_t>(n) * columns);
+      for (int i = 0; i < n; i++) {
+        for (int j = 0; j < width; j++) {
+          int value = static_cast<int>(mod<T>(values[static_cast<size_t>(i) * width + j],
+                                              static_cast<T>(primes[t])));
+          (j < n ? a : b).push_back(value);
+        }
+      }
+      Pluq<Ops> factors(ops, n, n, std::move(a));
+      if (k < 0) {
+        (*residues)[t] = static_cast<uint32_t>(factors.det());
+        continue;
+      }
+      if (factors.rank() < n) {
+        singular[t] = 1;
+        continue;
+      }
+      std::vector<int> x = factors.solve(k, b);
+      std::copy(x.begin(), x.end(), residues->begin() + t * n * k);
+    }
+  }, options);
+  unlucky->assign(singular.begin(), singular.end());
+}
+
+template <typename E>
+E modularDet(const DenseMatrix<BasicOps<E> >& a,
+             const ParallelOptions& options = ParallelOptions::defaults()) {
+  typedef typename ExactElement<E>::integer T;
+  ALGEBRA_PERF_REGION("modularDet");
+  std::vector<T> multipliers;
+  std::vector<T> values = exactRows<E>(a, nullptr, &multipliers);
+  int n = a.height_;
+  // |det| of the integer matrix is below the Hadamard bound; twice that
+  // covers the sign. Nothing smaller will do: a det past the primes'
+  // product would come back as a small wrong one, not as an overflow.
+  double bits = hadamardBits(n, n, values, false) + 1;
+  int count = primesFor(bits);
+  if (count > kModularMaxPrimes) throw "Determinant too large for a 128-bit reconstruction";
+  std::vector<uint32_t> primes;
+  for (int i = 0; i < count; i++) {
+    primes.push_back(modularPrime(i));
+  }
+  std::vector<uint32_t> residues;
+  std::vector<bool> unlucky;
+  eliminateModPrimes(n, -1, values, primes, &residues, &unlucky, options);
+  CrtBasis basis(primes);
+  unsigned __int128 det = basis.reconstructWide(residues.data());
+  unsigned __int128 modulus = basis.product().toWide();
+  __int128 ret = det > modulus / 2 ? -static_cast<__int128>(modulus - det)
+      : static_cast<__int128>(det);
+  return exactQuotient<E>(ret, multipliers);
+}
+
+// Whether the n x (n + k) [a | b] (row by row) has a * x = b, for x n x k
+// given as numerators / denominators, checked exactly: each row of
+// D * (a * x - b) has to be zero, for D the product of the distinct
+// denominators in each column of x.
+template <typename T>
+static bool checkSolution(int n, int k, const std::vector<T>& values,
+                          const std::vector<T>& numerators,
+                          const std::vector<T>& denominators) {
+  int width = n + k;
+  for (int c = 0; c < k; c++) {
+    // D / d for each distinct denominator d of the column.
+    std::map<T, BigUnsigned> cofactors;
+    for (int j = 0; j < n; j++) {
+      cofactors[denominators[static_cast<size_t>(j) * k + c]] = BigUnsigned(1);
+    }
+    BigUnsigned product(1);
+    for (auto it = cofactors.begin(); it != cofactors.end(); ++it) {
+      it->second = product;
+      product = product * BigUnsigned(static_cast<uint64_t>(it->first));
+    }
+    BigUnsigned suffix(1);
+    for (auto it = cofactors.rbegin(); it != cofactors.rend(); ++it) {
+      it->second = it->second * suffix;
+      suffix = suffix * BigUnsigned(static_cast<uint64_t>(it->first));
+    }
+    for (int i = 0; i < n; i++) {
+      const T* row = &values[static_cast<size_t>(i) * width];
+      BigUnsigned positive, negative;
+      for (int j = 0; j <= n; j++) {
+        __int128 factor;
+        const BigUnsigned* cofactor = &product;
+        if (j < n) {
+          size_t index = static_cast<size_t>(j) * k + c;
+          factor = static_cast<__int128>(row[j]) * numerators[index];
+          cofactor = &cofactors[denominators[index]];
+        } else {
+          factor = -static_cast<__int128>(row[n + c]);
+        }
+        if (factor == 0) continue;
+        BigUnsigned term = BigUnsigned::fromWide(static_cast<unsigned __int128>(
+            factor < 0 ? -factor : factor)) * *cofactor;
+        (factor < 0 ? negative : positive) += term;
+      }
+      if (positive != negative) return false;
+    }
+  }
+  return true;
+}
+
+template <typename E>
+DenseMatrix<BasicOps<Rational<typename ExactElement<E>::integer> > > modularSolve(
+    const DenseMatrix<BasicOps<E> >& a, const DenseMatrix<BasicOps<E> >& b,
+    const ParallelOptions& options = ParallelOptions::defaults()) {
+  typedef typename ExactElement<E>::integer T;
+  typedef BasicOps<Rational<T> > Ops;
+  ALGEBRA_PERF_REGION("modularSolve");
+  std::vector<T> values = exactRows<E>(a, &b, nullptr);
+  int n = a.height_, k = b.width_, width = n + k;
+  // By Cramer's rule each entry of x is a quotient of determinants, of a
+  // with a column replaced by one of b, over det(a); reconstructing it
+  // takes a modulus past twice the square of the larger of the two.
+  double det_bits = hadamardBits(n, width, values, false);
+  double numerator_bits = hadamardBits(n, width, values, true);
+  int needed = primesFor(2 * std::max(det_bits, numerator_bits) + 1);
+  int count = std::min(needed, kModularMaxPrimes);
+
+  // Primes mod which a is singular don't count; once their product passes
+  // the bound on det(a), a is singular.
+  std::vector<uint32_t> primes;
+  std::vector<uint32_t> residues;
+  double unlucky_bits = 0;
+  size_t next = 0;
+  while (static_cast<int>(primes.size()) < count) {
+    std::vector<uint32_t> batch;
+    while (primes.size() + batch.size() < static_cast<size_t>(count)) {
+      batch.push_back(modularPrime(next++));
+    }
+    std::vector<uint32_t> batch_residues;
+    std::vector<bool> unlucky;
+    eliminateModPrimes(n, k, values, batch, &batch_residues, &unlucky, options);
+    for (size_t t = 0; t < batch.size(); t++) {
+      if (unlucky[t]) {
+        unlucky_bits += log2(static_cast<double>(batch[t]));
+        if (unlucky_bits > det_bits) throw "Singular matrix";
+        continue;
+      }
+      primes.push_back(batch[t]);
+      auto solution = batch_residues.begin() + t * n * k;
+      residues.insert(residues.end(), solution, solution + n * k);
+    }
+  }
+
+  std::vector<Rational<T> > x;
+  if (n == 0 || k == 0) return denseMatrix(Ops::instance, k, n, x);
+  CrtBasis basis(primes);
+  unsigned __int128 modulus = basis.product().toWide();
+  std::vector<uint32_t> tuple(primes.size());
+  std::vector<T> numerators, denominators;
+  for (size_t e = 0; e < static_cast<size_t>(n) * k; e++) {
+    for (size_t t = 0; t < primes.size(); t++) {
+      tuple[t] = residues[t * n * k + e];
+    }
+    __int128 numerator, denominator;
+    if (!rationalReconstruction(basis.reconstructWide(tuple.data()), modulus,
+                                &numerator, &denominator) ||
+        static_cast<__int128>(static_cast<T>(numerator)) != numerator ||
+        static_cast<__int128>(static_cast<T>(denominator)) != denominator) {
+      throw "Solution too large for a 128-bit reconstruction";
+    }
+    numerators.push_back(static_cast<T>(numerator));
+    denominators.push_back(static_cast<T>(denominator));
+  }
+  if (!checkSolution(n, k, values, numerators, denominators)) {
+    throw "Solution too large for a 128-bit reconstruction";
+  }
+  x.reserve(numerators.size());
+  for (size_t e = 0; e < numerators.size(); e++) {
+    x.push_back(Rational<T>(numerators[e], denominators[e]));
+  }
+  return denseMatrix(Ops::instance, k, n, x);
+}
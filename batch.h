@@ -0,0 +1,527 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ALGEBRA_BATCH_X86 1
+#endif
+
+#include "math.h"
+
+#pragma once
+
+// Whether T is stored as a single 32-bit residue, so that arrays of it
+// can go through the vector kernels directly.
+template <typename T>
+struct BatchWord : std::integral_constant<bool,
+    std::is_integral<T>::value && sizeof(T) == sizeof(uint32_t)> {};
+
+/**
+ * Bulk arithmetic over arrays of residues mod N, for N < 2^31, with every
+ * value in [0, N). For odd N the products are reduced with 32-bit
+ * Montgomery steps, which map directly onto vpmuludq, so AVX2 and AVX-512
+ * versions of each kernel are provided and the best one available on the
+ * running CPU is picked at construction. Even N (and CPUs without either
+ * extension) use the scalar loops.
+ */
+class ResidueBatch {
+ public:
+  enum Isa { kScalar, kAvx2, kAvx512 };
+
+  ResidueBatch(uint32_t n) : ResidueBatch(n, bestIsa()) {}
+  ResidueBatch(uint32_t n, Isa isa) : n_(n), reducer_(n), isa_(isa) {
+    if (n == 0 || n >> 31) {
+      throw "Batch modulus must be in [1, 2^31)";
+    }
+    if (n % 2 == 0) {
+      isa_ = kScalar;
+      ninv_ = r2_ = 0;
+      return;
+    }
+    uint32_t inv = n;
+    for (int i = 0; i < 4; i++) {
+      inv *= 2 - n * inv;
+    }
+    ninv_ = -inv;
+    r2_ = static_cast<uint32_t>(reducer_.reduce(
+        static_cast<uint64_t>(reducer_.reduce(static_cast<uint64_t>(1) << 32)) << 32));
+  }
+
+  static Isa bestIsa() {
+#ifdef ALGEBRA_BATCH_X86
+    static const Isa isa =
+        __builtin_cpu_supports("avx512f") ? kAvx512 :
+        __builtin_cpu_supports("avx2") ? kAvx2 : kScalar;
+    return isa;
+#else
+    return kScalar;
+#endif
+  }
+
+  Isa isa() const {
+    return isa_;
+  }
+
+  // out[i] = a[i] + b[i]
+  void plus(const uint32_t* a, const uint32_t* b, uint32_t* out, size_t count) const {
+    size_t i = 0;
+#ifdef ALGEBRA_BATCH_X86
+    if (isa_ == kAvx512) i = plusAvx512(a, b, out, count);
+    else if (isa_ == kAvx2) i = plusAvx2(a, b, out, count);
+#endif
+    for (; i < count; i++) {
+      uint32_t sum = a[i] + b[i];
+      out[i] = sum >= n_ ? sum - n_ : sum;
+    }
+  }
+
+  // out[i] = a[i] * b[i]
+  void times(const uint32_t* a, const uint32_t* b, uint32_t* out, size_t count) const {
+    size_t i = 0;
+#ifdef ALGEBRA_BATCH_X86
+    if (isa_ == kAvx512) i = timesAvx512(a, b, out, count);
+    else if (isa_ == kAvx2) i = timesAvx2(a, b, out, count);
+#endif
+    for (; i < count; i++) {
+      out[i] = mulmod(a[i], b[i]);
+    }
+  }
+
+  // acc[i] = acc[i] + a[i] * b[i]
+  void timesPlus(const uint32_t* a, const uint32_t* b, uint32_t* acc, size_t count) const {
+    size_t i = 0;
+#ifdef ALGEBRA_BATCH_X86
+    if (isa_ == kAvx512) i = timesPlusAvx512(a, b, acc, count);
+    else if (isa_ == kAvx2) i = timesPlusAvx2(a, b, acc, count);
+#endif
+    for (; i < count; i++) {
+      uint32_t sum = acc[i] + mulmod(a[i], b[i]);
+      acc[i] = sum >= n_ ? sum - n_ : sum;
+    }
+  }
+
+  // out[i] = s * a[i]
+  void scale(uint32_t s, const uint32_t* a, uint32_t* out, size_t count) const {
+    s = static_cast<uint32_t>(reducer_.reduce(static_cast<uint64_t>(s)));
+    size_t i = 0;
+#ifdef ALGEBRA_BATCH_X86
+    if (isa_ != kScalar) {
+      uint32_t s_mont = redc(static_cast<uint64_t>(s) * r2_);
+      if (isa_ == kAvx512) i = scaleAvx512(s_mont, a, out, count);
+      else i = scaleAvx2(s_mont, a, out, count);
+    }
+#endif
+    for (; i < count; i++) {
+      out[i] = mulmod(s, a[i]);
+    }
+  }
+
+  // Returns sum(a[i] * b[i]).
+  uint32_t dot(const uint32_t* a, const uint32_t* b, size_t count) const {
+    if (isa_ == kScalar) {
+      uint64_t sum = 0;
+      for (size_t i = 0; i < count; i++) {
+        sum += mulmod(a[i], b[i]);
+      }
+      return static_cast<uint32_t>(reducer_.reduce(sum));
+    }
+    // The vector kernels sum a[i] * b[i] * 2^-32 (one Montgomery step per
+    // product), so the total is scaled back by 2^32 at the end.
+    uint64_t sum = 0;
+    size_t i = 0;
+#ifdef ALGEBRA_BATCH_X86
+    if (isa_ == kAvx512) i = dotAvx512(a, b, count, &sum);
+    else i = dotAvx2(a, b, count, &sum);
+#endif
+    for (; i < count; i++) {
+      sum += redc(static_cast<uint64_t>(a[i]) * b[i]);
+    }
+    return redc(reducer_.reduce(sum) * r2_);
+  }
+
+  // The same operations over std::vector. Elements that are not 32-bit
+  // integers go through a plain loop.
+  template <typename T>
+  void plus(const std::vector<T>& a, const std::vector<T>& b, std::vector<T>* out) const {
+    checkSize(a.size(), b.size());
+    out->resize(a.size());
+    apply(a, b, out, &ResidueBatch::plusScalar, &ResidueBatch::plus, BatchWord<T>());
+  }
+  template <typename T>
+  void times(const std::vector<T>& a, const std::vector<T>& b, std::vector<T>* out) const {
+    checkSize(a.size(), b.size());
+    out->resize(a.size());
+    apply(a, b, out, &ResidueBatch::mulmod, &ResidueBatch::times, BatchWord<T>());
+  }
+  template <typename T>
+  void timesPlus(const std::vector<T>& a, const std::vector<T>& b, std::vector<T>* acc) const {
+    checkSize(a.size(), b.size());
+    checkSize(a.size(), acc->size());
+    timesPlus(a, b, acc, BatchWord<T>());
+  }
+  template <typename T>
+  void scale(const T& s, const std::vector<T>& a, std::vector<T>* out) const {
+    out->resize(a.size());
+    scale(static_cast<uint32_t>(reducer_.reduce(static_cast<int64_t>(s))),
+          a, out, BatchWord<T>());
+  }
+  template <typename T>
+  T dot(const std::vector<T>& a, const std::vector<T>& b) const {
+    checkSize(a.size(), b.size());
+    return dot(a, b, BatchWord<T>());
+  }
+
+ private:
+  static void checkSize(size_t a, size_t b) {
+    if (a != b) throw "Size mismatch";
+  }
+
+  template <typename T>
+  static const uint32_t* words(const std::vector<T>& v) {
+    return reinterpret_cast<const uint32_t*>(v.data());
+  }
+  template <typename T>
+  static uint32_t* words(std::vector<T>* v) {
+    return reinterpret_cast<uint32_t*>(v->data());
+  }
+
+  typedef uint32_t (ResidueBatch::*ScalarOp)(uint32_t, uint32_t) const;
+  typedef void (ResidueBatch::*ArrayOp)(const uint32_t*, const uint32_t*,
+                                        uint32_t*, size_t) const;
+
+  template <typename T>
+  void apply(const std::vector<T>& a, const std::vector<T>& b, std::vector<T>* out,
+             ScalarOp, ArrayOp op, std::true_type) const {
+    (this->*op)(words(a), words(b), words(out), a.size());
+  }
+  template <typename T>
+  void apply(const std::vector<T>& a, const std::vector<T>& b, std::vector<T>* out,
+             ScalarOp op, ArrayOp, std::false_type) const {
+    for (size_t i = 0; i < a.size(); i++) {
+      (*out)[i] = static_cast<T>((this->*op)(a[i], b[i]));
+    }
+  }
+
+  template <typename T>
+  void timesPlus(const std::vector<T>& a, const std::vector<T>& b, std::vector<T>* acc,
+                 std::true_type) const {
+    timesPlus(words(a), words(b), words(acc), a.size());
+  }
+  template <typename T>
+  void timesPlus(const std::vector<T>& a, const std::vector<T>& b, std::vector<T>* acc,
+                 std::false_type) const {
+    for (size_t i = 0; i < a.size(); i++) {
+      (*acc)[i] = static_cast<T>(plusScalar((*acc)[i], mulmod(a[i], b[i])));
+    }
+  }
+
+  template <typename T>
+  void scale(uint32_t s, const std::vector<T>& a, std::vector<T>* out,
+             std::true_type) const {
+    scale(s, words(a), words(out), a.size());
+  }
+  template <typename T>
+  void scale(uint32_t s, const std::vector<T>& a, std::vector<T>* out,
+             std::false_type) const {
+    for (size_t i = 0; i < a.size(); i++) {
+      (*out)[i] = static_cast<T>(mulmod(s, a[i]));
+    }
+  }
+
+  template <typename T>
+  T dot(const std::vector<T>& a, const std::vector<T>& b, std::true_type) const {
+    return static_cast<T>(dot(words(a), words(b), a.size()));
+  }
+  template <typename T>
+  T dot(const std::vector<T>& a, const std::vector<T>& b, std::false_type) const {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+      sum += mulmod(a[i], b[i]);
+    }
+    return static_cast<T>(reducer_.reduce(sum));
+  }
+
+  uint32_t plusScalar(uint32_t a, uint32_t b) const {
+    uint32_t sum = a + b;
+    return sum >= n_ ? sum - n_ : sum;
+  }
+
+  uint32_t mulmod(uint32_t a, uint32_t b) const {
+    return static_cast<uint32_t>(reducer_.reduce(static_cast<uint64_t>(a) * b));
+  }
+
+  // Computes t * 2^-32 mod N for t < N * 2^32 (odd N only).
+  uint32_t redc(uint64_t t) const {
+    uint32_t m = static_cast<uint32_t>(t) * ninv_;
+    uint32_t ret = static_cast<uint32_t>((t + static_cast<uint64_t>(m) * n_) >> 32);
+    return ret >= n_ ? ret - n_ : ret;
+  }
+
+#ifdef ALGEBRA_BATCH_X86
+  // Montgomery-reduces the products of the 8 lane pairs of a and b.
+  __attribute__((target("avx2")))
+  static __m256i redcAvx2(__m256i a, __m256i b, __m256i n, __m256i ninv) {
+    __m256i even = _mm256_mul_epu32(a, b);
+    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+    even = _mm256_add_epi64(even, _mm256_mul_epu32(_mm256_mul_epu32(even, ninv), n));
+    odd = _mm256_add_epi64(odd, _mm256_mul_epu32(_mm256_mul_epu32(odd, ninv), n));
+    __m256i r = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xaa);
+    return _mm256_min_epu32(r, _mm256_sub_epi32(r, n));
+  }
+
+  __attribute__((target("avx2")))
+  size_t plusAvx2(const uint32_t* a, const uint32_t* b, uint32_t* out, size_t count) const {
+    __m256i n = _mm256_set1_epi32(n_);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+      __m256i sum = _mm256_add_epi32(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                          _mm256_min_epu32(sum, _mm256_sub_epi32(sum, n)));
+    }
+    return i;
+  }
+
+  __attribute__((target("avx2")))
+  size_t timesAvx2(const uint32_t* a, const uint32_t* b, uint32_t* out, size_t count) const {
+    __m256i n = _mm256_set1_epi32(n_), ninv = _mm256_set1_epi32(ninv_);
+    __m256i r2 = _mm256_set1_epi32(r2_);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+      __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+      __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+      // b * 2^32 first, so the second step lands back on a * b.
+      vb = redcAvx2(vb, r2, n, ninv);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), redcAvx2(va, vb, n, ninv));
+    }
+    return i;
+  }
+
+  __attribute__((target("avx2")))
+  size_t timesPlusAvx2(const uint32_t* a, const uint32_t* b, uint32_t* acc, size_t count) const {
+    __m256i n = _mm256_set1_epi32(n_), ninv = _mm256_set1_epi32(ninv_);
+    __m256i r2 = _mm256_set1_epi32(r2_);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+      __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+      __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+      __m256i vacc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + i));
+      __m256i sum = _mm256_add_epi32(
+          vacc, redcAvx2(va, redcAvx2(vb, r2, n, ninv), n, ninv));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + i),
+                          _mm256_min_epu32(sum, _mm256_sub_epi32(sum, n)));
+    }
+    return i;
+  }
+
+  __attribute__((target("avx2")))
+  size_t scaleAvx2(uint32_t s_mont, const uint32_t* a, uint32_t* out, size_t count) const {
+    __m256i n = _mm256_set1_epi32(n_), ninv = _mm256_set1_epi32(ninv_);
+    __m256i s = _mm256_set1_epi32(s_mont);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+      __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), redcAvx2(va, s, n, ninv));
+    }
+    return i;
+  }
+
+  __attribute__((target("avx2")))
+  size_t dotAvx2(const uint32_t* a, const uint32_t* b, size_t count, uint64_t* sum) const {
+    __m256i n = _mm256_set1_epi32(n_), ninv = _mm256_set1_epi32(ninv_);
+    __m256i low = _mm256_set1_epi64x(0xffffffff);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+      __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+      __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+      __m256i r = redcAvx2(va, vb, n, ninv);
+      acc = _mm256_add_epi64(acc, _mm256_and_si256(r, low));
+      acc = _mm256_add_epi64(acc, _mm256_srli_epi64(r, 32));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    *sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return i;
+  }
+
+  // The AVX-512 kernels are the AVX2 ones at twice the width. GCC 12 warns
+  // about the _mm512_undefined_epi32() passthrough inside the intrinsics.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+  __attribute__((target("avx512f")))
+  static __m512i redcAvx512(__m512i a, __m512i b, __m512i n, __m512i ninv) {
+    __m512i even = _mm512_mul_epu32(a, b);
+    __m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), _mm512_srli_epi64(b, 32));
+    even = _mm512_add_epi64(even, _mm512_mul_epu32(_mm512_mul_epu32(even, ninv), n));
+    odd = _mm512_add_epi64(odd, _mm512_mul_epu32(_mm512_mul_epu32(odd, ninv), n));
+    __m512i r = _mm512_mask_blend_epi32(0xaaaa, _mm512_srli_epi64(even, 32), odd);
+    return _mm512_min_epu32(r, _mm512_sub_epi32(r, n));
+  }
+
+  __attribute__((target("avx512f")))
+  size_t plusAvx512(const uint32_t* a, const uint32_t* b, uint32_t* out, size_t count) const {
+    __m512i n = _mm512_set1_epi32(n_);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+      __m512i sum = _mm512_add_epi32(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+      _mm512_storeu_si512(out + i, _mm512_min_epu32(sum, _mm512_sub_epi32(sum, n)));
+    }
+    return i;
+  }
+
+  __attribute__((target("avx512f")))
+  size_t timesAvx512(const uint32_t* a, const uint32_t* b, uint32_t* out, size_t count) const {
+    __m512i n = _mm512_set1_epi32(n_), ninv = _mm512_set1_epi32(ninv_);
+    __m512i r2 = _mm512_set1_epi32(r2_);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+      __m512i vb = redcAvx512(_mm512_loadu_si512(b + i), r2, n, ninv);
+      _mm512_storeu_si512(out + i, redcAvx512(_mm512_loadu_si512(a + i), vb, n, ninv));
+    }
+    return i;
+  }
+
+  __attribute__((target("avx512f")))
+  size_t timesPlusAvx512(const uint32_t* a, const uint32_t* b, uint32_t* acc, size_t count) const {
+    __m512i n = _mm512_set1_epi32(n_), ninv = _mm512_set1_epi32(ninv_);
+    __m512i r2 = _mm512_set1_epi32(r2_);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+      __m512i vb = redcAvx512(_mm512_loadu_si512(b + i), r2, n, ninv);
+      __m512i sum = _mm512_add_epi32(
+          _mm512_loadu_si512(acc + i),
+          redcAvx512(_mm512_loadu_si512(a + i), vb, n, ninv));
+      _mm512_storeu_si512(acc + i, _mm512_min_epu32(sum, _mm512_sub_epi32(sum, n)));
+    }
+    return i;
+  }
+
+  __attribute__((target("avx512f")))
+  size_t scaleAvx512(uint32_t s_mont, const uint32_t* a, uint32_t* out, size_t count) const {
+    __m512i n = _mm512_set1_epi32(n_), ninv = _mm512_set1_epi32(ninv_);
+    __m512i s = _mm512_set1_epi32(s_mont);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+      _mm512_storeu_si512(out + i, redcAvx512(_mm512_loadu_si512(a + i), s, n, ninv));
+    }
+    return i;
+  }
+
+  __attribute__((target("avx512f")))
+  size_t dotAvx512(const uint32_t* a, const uint32_t* b, size_t count, uint64_t* sum) const {
+    __m512i n = _mm512_set1_epi32(n_), ninv = _mm512_set1_epi32(ninv_);
+    __m512i low = _mm512_set1_epi64(0xffffffff);
+    __m512i acc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+      __m512i r = redcAvx512(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i), n, ninv);
+      acc = _mm512_add_epi64(acc, _mm512_and_si512(r, low));
+      acc = _mm512_add_epi64(acc, _mm512_srli_epi64(r, 32));
+    }
+    uint64_t lanes[8];
+    _mm512_storeu_si512(lanes, acc);
+    for (int lane = 0; lane < 8; lane++) {
+      *sum += lanes[lane];
+    }
+    return i;
+  }
+#pragma GCC diagnostic pop
+#endif
+
+  uint32_t n_;
+  uint32_t ninv_;
+  uint32_t r2_;
+  BarrettReducer reducer_;
+  Isa isa_;
+};
+
+/**
+ * Inverts every element of a using Montgomery's trick: one inversion of
+ * the product of all the elements plus 3(k-1) multiplications. Ops needs
+ * times, id, zero and a non-throwing tryInv(const T&, T*).
+ *
+ * (*invertible)[i] is set to whether a[i] had an inverse; the matching
+ * entries of out are set to zero. out may be the same vector as a.
+ */
+template <typename Ops, typename T>
+void batchInverse(const Ops& ops, const std::vector<T>& a, std::vector<T>* out,
+                  std::vector<bool>* invertible) {
+  size_t count = a.size();
+  const T zero = ops.zero();
+  invertible->assign(count, true);
+  // prefix[i] is the product of the nonzero elements up to and including i.
+  std::vector<T> prefix;
+  prefix.reserve(count);
+  T running = ops.id();
+  size_t first = count;
+  for (size_t i = 0; i < count; i++) {
+    if (a[i] == zero) {
+      (*invertible)[i] = false;
+    } else if (first == count) {
+      first = i;
+      running = a[i];
+    } else {
+      running = ops.times(running, a[i]);
+    }
+    prefix.push_back(running);
+  }
+
+  T inv;
+  if (!ops.tryInv(running, &inv)) {
+    // Some element shares a factor with the modulus; only then is it worth
+    // finding out which ones, one at a time.
+    out->resize(count, zero);
+    for (size_t i = 0; i < count; i++) {
+      if (!(*invertible)[i] || !ops.tryInv(a[i], &(*out)[i])) {
+        (*invertible)[i] = false;
+        (*out)[i] = zero;
+      }
+    }
+    return;
+  }
+
+  out->resize(count, zero);
+  // Walking back down, inv is the inverse of prefix[i].
+  for (size_t i = count; i-- > first; ) {
+    if (!(*invertible)[i]) {
+      (*out)[i] = zero;
+    } else if (i == first) {
+      (*out)[i] = inv;
+    } else {
+      T element = a[i];
+      (*out)[i] = ops.times(inv, prefix[i - 1]);
+      inv = ops.times(inv, element);
+    }
+  }
+  for (size_t i = 0; i < first; i++) {
+    (*out)[i] = zero;
+  }
+}
@@ -0,0 +1,607 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "elements.h"
+#include "bareiss.h"
+#include "matrix.h"
+#include "modn.h"
+#include "monomial.h"
+#include "montgomery.h"
+#include "polynomial.h"
+#include "rational.h"
+#include "reduce.h"
+#include "rns.h"
+#include "trace.h"
+
+using namespace std;
+
+static const int kPrime = 1000003;
+
+typedef IntegerModNOps<kPrime>::ring StaticRing;
+typedef IntegerModNOps<kPrime>::field StaticField;
+typedef IntegerModOps<>::ring DynamicRing;
+typedef PolynomialOps<IntegerModNOps<kPrime>, MonomialOps<char> > PolyOps;
+
+/**
+ * A benchmark runs its work reps times and returns something computed
+ * from the results, so that the compiler can't throw the work away. Times
+ * are reported per rep.
+ */
+struct Benchmark {
+  string name;
+  function<uint64_t(long reps)> run;
+};
+
+struct Result {
+  string name;
+  long reps;
+  double ns;      // median over the repeats
+  double min_ns;
+};
+
+static volatile uint64_t sink;
+
+// A small deterministic generator, so every run benchmarks the same data.
+static uint64_t nextRandom(uint64_t* state) {
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return *state >> 33;
+}
+
+static double timeRun(const Benchmark& benchmark, long reps) {
+  auto start = chrono::steady_clock::now();
+  sink = sink + benchmark.run(reps);
+  return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+}
+
+// Grows reps until one run takes min_seconds, then times repeat runs.
+static Result measure(const Benchmark& benchmark, double min_seconds, int repeat) {
+  double target = min_seconds * 1e9;
+  long reps = 1;
+  double ns = timeRun(benchmark, reps);
+  while (ns < target) {
+    double grow = ns > 0 ? 1.2 * target / ns : 100;
+    reps = static_cast<long>(reps * std::min(100.0, std::max(2.0, grow)));
+    ns = timeRun(benchmark, reps);
+  }
+  vector<double> samples(1, ns / reps);
+  // A single rep that took the whole budget is not worth repeating.
+  for (int i = 1; i < repeat && reps > 1; i++) {
+    samples.push_back(timeRun(benchmark, reps) / reps);
+  }
+  sort(samples.begin(), samples.end());
+  Result ret = {benchmark.name, reps, samples[samples.size() / 2], samples[0]};
+  return ret;
+}
+
+// Runs acc = acc * x + y, the original static vs. dynamic modulus test.
+template <typename Ring>
+static uint64_t multiplyAdd(Ring acc, const Ring& x, const Ring& y, long reps) {
+  for (long i = 0; i < reps; i++) {
+    acc = acc * x + y;
+  }
+  return static_cast<uint64_t>(acc.element_);
+}
+
+static void addModN(vector<Benchmark>* benchmarks) {
+  // Read the runtime modulus through a volatile so the compiler cannot
+  // fold it into a constant.
+  static volatile int runtime_prime = kPrime;
+  static IntegerModOps<> dynamic_ops(runtime_prime);
+  static MontgomeryModOps mont(4611686018427387847ULL);
+  benchmarks->push_back({"modn/static_multiply_add", [](long reps) {
+    return multiplyAdd(StaticRing(1), StaticRing(123457), StaticRing(98765), reps);
+  }});
+  benchmarks->push_back({"modn/dynamic_multiply_add", [](long reps) {
+    return multiplyAdd(DynamicRing(1, dynamic_ops), DynamicRing(123457, dynamic_ops),
+                       DynamicRing(98765, dynamic_ops), reps);
+  }});
+  benchmarks->push_back({"modn/montgomery_multiply_add", [](long reps) {
+    typedef MontgomeryModOps::ring MontRing;
+    MontRing acc(1, mont);
+    MontRing x(4611686018427387800LL, mont), y(12345, mont);
+    for (long i = 0; i < reps; i++) {
+      acc = acc * x + y;
+    }
+    return mont.get(acc.element_);
+  }});
+  benchmarks->push_back({"modn/static_inv", [](long reps) {
+    StaticField acc(2);  // 3 / acc never reaches 0
+    for (long i = 0; i < reps; i++) {
+      acc = 3 / acc;
+    }
+    return static_cast<uint64_t>(acc.element_);
+  }});
+
+  // Bulk multiply of 4096 elements: one RingElt product each vs. timesAll.
+  static const size_t kCount = 4096;
+  static vector<int> a(kCount), b(kCount);
+  for (size_t i = 0; i < kCount; i++) {
+    a[i] = (i * 7919) % kPrime;
+    b[i] = (i * 104729) % kPrime;
+  }
+  benchmarks->push_back({"modn/ring_times_4096", [](long reps) {
+    vector<int> out(kCount);
+    for (long r = 0; r < reps; r++) {
+      for (size_t i = 0; i < kCount; i++) {
+        out[i] = DynamicRing(a[i], dynamic_ops) * b[i];
+      }
+    }
+    return static_cast<uint64_t>(out[kCount - 1]);
+  }});
+  benchmarks->push_back({"modn/timesAll_4096", [](long reps) {
+    vector<int> out(kCount);
+    for (long r = 0; r < reps; r++) {
+      dynamic_ops.timesAll(a, b, &out);
+    }
+    return static_cast<uint64_t>(out[kCount - 1]);
+  }});
+}
+
+static void addRns(vector<Benchmark>* benchmarks) {
+  // Products of 4096 numbers mod four 31-bit primes, one at a time and in
+  // bulk.
+  static const int kCount = 4096;
+  static RnsOps<4> rns {2147483647, 2147483629, 2147483587, 2147483579};
+  static vector<RnsNumber<4> > a, b;
+  uint64_t state = 1;
+  for (int i = 0; i < kCount; i++) {
+    a.push_back(rns.encode(static_cast<long long>(nextRandom(&state) >> 1)));
+    b.push_back(rns.encode(static_cast<long long>(nextRandom(&state) >> 1)));
+  }
+  benchmarks->push_back({"rns/times_4096", [](long reps) {
+    vector<RnsNumber<4> > out(kCount);
+    for (long r = 0; r < reps; r++) {
+      for (int i = 0; i < kCount; i++) {
+        out[i] = rns.times(a[i], b[i]);
+      }
+    }
+    return static_cast<uint64_t>(out[kCount - 1].residues_[0]);
+  }});
+  benchmarks->push_back({"rns/timesAll_4096", [](long reps) {
+    vector<RnsNumber<4> > out;
+    for (long r = 0; r < reps; r++) {
+      rns.timesAll(a, b, &out);
+    }
+    return static_cast<uint64_t>(out[kCount - 1].residues_[0]);
+  }});
+}
+
+static void addRational(vector<Benchmark>* benchmarks) {
+  // a[i] * b[i] + c over 1024 small fractions.
+  static vector<Rational<long long> > values;
+  uint64_t state = 1;
+  for (int i = 0; i < 1024; i++) {
+    values.push_back(Rational<long long>(nextRandom(&state) % 1000 + 1,
+                                         nextRandom(&state) % 1000 + 1));
+  }
+  benchmarks->push_back({"rational/multiply_add_1024", [](long reps) {
+    uint64_t ret = 0;
+    for (long r = 0; r < reps; r++) {
+      for (size_t i = 0; i + 1 < values.size(); i++) {
+        Rational<long long> x = values[i] * values[i + 1] + values[0];
+        ret += x.denominator_;
+      }
+    }
+    return ret;
+  }});
+
+  // A 12 x 12 system of halves and small integers, as small as it has to be
+  // for Bareiss' minors to fit in a long long.
+  typedef DenseMatrix<BasicOps<Rational<long long> > > Matrix;
+  static const int kSystem = 12;
+  static vector<Matrix> system;
+  vector<Rational<long long> > a, b;
+  for (int i = 0; i < kSystem * kSystem; i++) {
+    a.push_back(Rational<long long>(static_cast<long long>(nextRandom(&state) % 7) - 3,
+                                    nextRandom(&state) % 2 + 1));
+  }
+  for (int i = 0; i < kSystem; i++) {
+    a[i * kSystem + i] = a[i * kSystem + i] + Rational<long long>(8);
+    b.push_back(Rational<long long>(static_cast<long long>(nextRandom(&state) % 7) - 3));
+  }
+  system.push_back(denseMatrix(BasicOps<Rational<long long> >::instance, kSystem, kSystem, a));
+  system.push_back(denseMatrix(BasicOps<Rational<long long> >::instance, 1, kSystem, b));
+  benchmarks->push_back({"rational/bareiss_solve_12", [](long reps) {
+    uint64_t ret = 0;
+    for (long r = 0; r < reps; r++) {
+      ret += bareissSolve(system[0], system[1])[0][0].element_.denominator_;
+    }
+    return ret;
+  }});
+  benchmarks->push_back({"rational/modular_solve_12", [](long reps) {
+    uint64_t ret = 0;
+    for (long r = 0; r < reps; r++) {
+      ret += modularSolve(system[0], system[1])[0][0].element_.denominator_;
+    }
+    return ret;
+  }});
+}
+
+static Monomial<char> randomMonomial(int variables, int max_degree, uint64_t* state) {
+  Monomial<char> ret;
+  for (int v = 0; v < variables; v++) {
+    int degree = nextRandom(state) % (max_degree + 1);
+    for (int d = 0; d < degree; d++) ret << static_cast<char>('a' + v);
+  }
+  return ret;
+}
+
+static void addMonomial(vector<Benchmark>* benchmarks) {
+  static const int kVariables[] = {2, 8, 26};
+  for (int variables : kVariables) {
+    uint64_t state = variables;
+    Monomial<char> x = randomMonomial(variables, 5, &state);
+    Monomial<char> y = randomMonomial(variables, 5, &state);
+    benchmarks->push_back({"monomial/multiply_vars=" + to_string(variables),
+                           [x, y](long reps) {
+      uint64_t ret = 0;
+      for (long r = 0; r < reps; r++) {
+        ret += (x * y).exponents_.size();
+      }
+      return ret;
+    }});
+  }
+}
+
+// terms terms, either dense (1 + x + ... + x^(terms-1)) or sparse
+// (random monomials in 8 variables).
+static PolyOps::element makePolynomial(int terms, bool dense, uint64_t seed) {
+  PolyOps::element ret;
+  uint64_t state = seed;
+  Monomial<char> power;
+  for (int i = 0; i < terms; i++) {
+    StaticRing coefficient(static_cast<int>(nextRandom(&state) % kPrime));
+    if (dense) {
+      ret << make_pair(coefficient, power);
+      power << 'x';
+    } else {
+      ret << make_pair(coefficient, randomMonomial(8, 4, &state));
+    }
+  }
+  return ret;
+}
+
+static void addPolynomial(vector<Benchmark>* benchmarks) {
+  static const int kTerms[] = {10, 30, 100, 300};
+  for (int dense = 1; dense >= 0; dense--) {
+    for (int terms : kTerms) {
+      PolyOps::element x = makePolynomial(terms, dense, 1);
+      PolyOps::element y = makePolynomial(terms, dense, 2);
+      benchmarks->push_back({string("polynomial/multiply_") +
+                             (dense ? "dense" : "sparse") + "_terms=" + to_string(terms),
+                             [x, y](long reps) {
+        uint64_t ret = 0;
+        for (long r = 0; r < reps; r++) {
+          ret += (x * y).components_.size();
+        }
+        return ret;
+      }});
+    }
+  }
+}
+
+static DenseMatrix<IntegerModNOps<kPrime> > makeMatrix(int n, uint64_t seed) {
+  DenseMatrix<IntegerModNOps<kPrime> > ret(n, n, StaticRing(0));
+  uint64_t state = seed;
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      ret[i][j] = StaticRing(static_cast<int>(nextRandom(&state) % kPrime));
+    }
+  }
+  return ret;
+}
+
+static void addMatrix(vector<Benchmark>* benchmarks) {
+  static const int kSizes[] = {8, 32, 128, 512, 1024};
+  typedef DenseMatrix<IntegerModNOps<kPrime> > Matrix;
+  for (int n : kSizes) {
+    // Built on first use, so that filtered out sizes cost nothing.
+    shared_ptr<vector<Matrix> > inputs = make_shared<vector<Matrix> >();
+    benchmarks->push_back({"matrix/multiply_n=" + to_string(n), [n, inputs](long reps) {
+      if (inputs->empty()) {
+        inputs->push_back(makeMatrix(n, 1));
+        inputs->push_back(makeMatrix(n, 2));
+      }
+      uint64_t ret = 0;
+      for (long r = 0; r < reps; r++) {
+        ret += static_cast<uint64_t>(((*inputs)[0] * (*inputs)[1])[n - 1][n - 1].element_);
+      }
+      return ret;
+    }});
+  }
+  static const int kEliminationSizes[] = {32, 128, 512};
+  for (int n : kEliminationSizes) {
+    shared_ptr<vector<Matrix> > inputs = make_shared<vector<Matrix> >();
+    benchmarks->push_back({"matrix/pluq_n=" + to_string(n), [n, inputs](long reps) {
+      if (inputs->empty()) inputs->push_back(makeMatrix(n, 3));
+      uint64_t ret = 0;
+      for (long r = 0; r < reps; r++) {
+        ret += pluq((*inputs)[0]).rank();
+      }
+      return ret;
+    }});
+    benchmarks->push_back({"matrix/inverse_n=" + to_string(n), [n, inputs](long reps) {
+      if (inputs->empty()) inputs->push_back(makeMatrix(n, 3));
+      uint64_t ret = 0;
+      for (long r = 0; r < reps; r++) {
+        ret += static_cast<uint64_t>(inverse((*inputs)[0])[n - 1][n - 1].element_);
+      }
+      return ret;
+    }});
+  }
+}
+
+static void addTrace(vector<Benchmark>* benchmarks) {
+  static const int kLengths[] = {8, 64};
+  for (int length : kLengths) {
+    // A trace and its rotation by length / 2, which the cyclic comparison
+    // finds last.
+    Trace<char> x, y;
+    uint64_t state = length;
+    vector<char> letters;
+    for (int i = 0; i < length; i++) {
+      letters.push_back(static_cast<char>('a' + nextRandom(&state) % 3));
+    }
+    for (int i = 0; i < length; i++) {
+      x << letters[i];
+      y << letters[(i + length / 2) % length];
+    }
+    benchmarks->push_back({"trace/equal_length=" + to_string(length),
+                           [x, y](long reps) {
+      uint64_t ret = 0;
+      for (long r = 0; r < reps; r++) {
+        ret += x == y;
+      }
+      return ret;
+    }});
+    benchmarks->push_back({"trace/hash_length=" + to_string(length),
+                           [x](long reps) {
+      uint64_t ret = 0;
+      for (long r = 0; r < reps; r++) {
+        ret += hash<Trace<char> >()(x);
+      }
+      return ret;
+    }});
+  }
+}
+
+static void addPow(vector<Benchmark>* benchmarks) {
+  static MontgomeryModOps mont(4611686018427387847ULL);
+  benchmarks->push_back({"pow/static_field_64bit", [](long reps) {
+    StaticField acc(3);
+    for (long r = 0; r < reps; r++) {
+      acc = acc ^ 0x9e3779b97f4a7c15ULL;
+    }
+    return static_cast<uint64_t>(acc.element_);
+  }});
+  benchmarks->push_back({"pow/montgomery_256bit", [](long reps) {
+    BigUnsigned n(4611686018427387846ULL);
+    n = n * n * n * n;
+    MontgomeryModOps::ring acc(3, mont);
+    for (long r = 0; r < reps; r++) {
+      acc = (acc ^ n) + 1;
+    }
+    return mont.get(acc.element_);
+  }});
+  benchmarks->push_back({"pow/matrix_n=8_exp=1000", [](long reps) {
+    typedef DenseMatrixNSpace<8, IntegerModNOps<kPrime> > GL8;
+    GL8::ring x(makeMatrix(8, 3), GL8::instance);
+    uint64_t ret = 0;
+    for (long r = 0; r < reps; r++) {
+      ret += static_cast<uint64_t>((x ^ 1000).element_[7][7].element_);
+    }
+    return ret;
+  }});
+  benchmarks->push_back({"pow/multiPow_bases=64", [](long reps) {
+    vector<StaticField> bases;
+    vector<uint64_t> exponents;
+    uint64_t state = 64;
+    for (int i = 0; i < 64; i++) {
+      bases.push_back(StaticField(static_cast<int>(nextRandom(&state) % (kPrime - 1) + 1)));
+      exponents.push_back(nextRandom(&state) << 31 | nextRandom(&state));
+    }
+    uint64_t ret = 0;
+    for (long r = 0; r < reps; r++) {
+      ret += static_cast<uint64_t>(multiPow(bases, exponents).element_);
+    }
+    return ret;
+  }});
+}
+
+static void addReduce(vector<Benchmark>* benchmarks) {
+  benchmarks->push_back({"reduce/product_100000", [](long reps) {
+    vector<StaticField> values;
+    for (int i = 1; i <= 100000; i++) values.push_back(StaticField(i));
+    uint64_t ret = 0;
+    for (long r = 0; r < reps; r++) {
+      ret += static_cast<uint64_t>(product(values.begin(), values.end()).element_);
+    }
+    return ret;
+  }});
+}
+
+static void writeJson(const vector<Result>& results, ostream& stream) {
+  stream << "{\"benchmarks\": [" << endl;
+  for (size_t i = 0; i < results.size(); i++) {
+    stream << "  {\"name\": \"" << results[i].name << "\", \"reps\": " << results[i].reps
+           << ", \"ns_per_op\": " << results[i].ns
+           << ", \"min_ns_per_op\": " << results[i].min_ns << "}"
+           << (i + 1 < results.size() ? "," : "") << endl;
+  }
+  stream << "]}" << endl;
+}
+
+// Reads back the name -> min_ns_per_op pairs that writeJson wrote.
+static map<string, double> readJson(istream& stream) {
+  stringstream buffer;
+  buffer << stream.rdbuf();
+  string text = buffer.str();
+  map<string, double> ret;
+  size_t pos = 0;
+  while ((pos = text.find("\"name\": \"", pos)) != string::npos) {
+    pos += 9;
+    size_t end = text.find('"', pos);
+    size_t value = text.find("\"min_ns_per_op\": ", end);
+    if (end == string::npos || value == string::npos) break;
+    ret[text.substr(pos, end - pos)] = atof(text.c_str() + value + 17);
+    pos = end;
+  }
+  return ret;
+}
+
+/**
+ * Compares against a baseline on the fastest repeat, which is the least
+ * disturbed by whatever else the machine is doing. Returns the number of
+ * benchmarks that got slower by more than threshold.
+ */
+static int compare(const vector<Result>& results, const map<string, double>& baseline,
+                   double threshold) {
+  int regressions = 0;
+  char line[200];
+  snprintf(line, sizeof(line), "%-40s %14s %14s %9s", "benchmark", "baseline ns",
+           "current ns", "change");
+  cout << endl << line << endl;
+  for (size_t i = 0; i < results.size(); i++) {
+    auto it = baseline.find(results[i].name);
+    if (it == baseline.end()) {
+      snprintf(line, sizeof(line), "%-40s %14s %14.1f", results[i].name.c_str(), "-",
+               results[i].min_ns);
+      cout << line << endl;
+      continue;
+    }
+    double change = results[i].min_ns / it->second - 1;
+    const char* verdict = "";
+    if (change > threshold) {
+      verdict = "  REGRESSION";
+      regressions++;
+    } else if (change < -threshold) {
+      verdict = "  improved";
+    }
+    snprintf(line, sizeof(line), "%-40s %14.1f %14.1f %+8.1f%%%s", results[i].name.c_str(),
+             it->second, results[i].min_ns, change * 100, verdict);
+    cout << line << endl;
+  }
+  return regressions;
+}
+
+static void usage(const char* name) {
+  cerr << "usage: " << name << " [options]" << endl
+       << "  --list               list the benchmarks and exit" << endl
+       << "  --filter=TEXT        only run benchmarks whose name contains TEXT" << endl
+       << "  --min-time=SECONDS   time each repeat for at least this long (0.1)" << endl
+       << "  --repeat=N           repeats per benchmark; the median is reported (3)" << endl
+       << "  --json=FILE          write the results to FILE as JSON" << endl
+       << "  --compare=FILE       compare against results saved with --json" << endl
+       << "  --threshold=FRACTION slowdown that counts as a regression (0.1)" << endl
+       << "With --compare, the exit status is 1 if anything regressed." << endl;
+}
+
+int main(int argc, char** argv) {
+  string filter, json_file, compare_file;
+  double min_time = 0.1, threshold = 0.1;
+  int repeat = 3;
+  bool list = false;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    size_t eq = arg.find('=');
+    string key = arg.substr(0, eq), value = eq == string::npos ? "" : arg.substr(eq + 1);
+    if (key == "--list") {
+      list = true;
+    } else if (key == "--filter") {
+      filter = value;
+    } else if (key == "--min-time") {
+      min_time = atof(value.c_str());
+    } else if (key == "--repeat") {
+      repeat = std::max(1, atoi(value.c_str()));
+    } else if (key == "--json") {
+      json_file = value;
+    } else if (key == "--compare") {
+      compare_file = value;
+    } else if (key == "--threshold") {
+      threshold = atof(value.c_str());
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  map<string, double> baseline;
+  if (!compare_file.empty()) {
+    ifstream in(compare_file);
+    if (!in) {
+      cerr << "cannot read " << compare_file << endl;
+      return 2;
+    }
+    baseline = readJson(in);
+  }
+
+  vector<Benchmark> benchmarks;
+  addModN(&benchmarks);
+  addRns(&benchmarks);
+  addRational(&benchmarks);
+  addMonomial(&benchmarks);
+  addPolynomial(&benchmarks);
+  addMatrix(&benchmarks);
+  addTrace(&benchmarks);
+  addPow(&benchmarks);
+  addReduce(&benchmarks);
+
+  vector<Result> results;
+  for (size_t i = 0; i < benchmarks.size(); i++) {
+    if (benchmarks[i].name.find(filter) == string::npos) continue;
+    if (list) {
+      cout << benchmarks[i].name << endl;
+      continue;
+    }
+    Result result = measure(benchmarks[i], min_time, repeat);
+    char line[200];
+    snprintf(line, sizeof(line), "%-40s %14.1f ns/op %12ld reps", result.name.c_str(),
+             result.ns, result.reps);
+    cout << line << endl;
+    results.push_back(result);
+  }
+
+  if (!json_file.empty()) {
+    ofstream out(json_file);
+    writeJson(results, out);
+  }
+  if (!compare_file.empty() && compare(results, baseline, threshold) > 0) {
+    return 1;
+  }
+  return 0;
+}
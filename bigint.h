@@ -0,0 +1,302 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#pragma once
+
+/**
+ * Just enough arbitrary precision unsigned arithmetic for CRT
+ * reconstruction: addition, subtraction of a smaller value, multiplication
+ * (Karatsuba above kKaratsubaLimbs), multiply-add by a word, comparison,
+ * and decimal output. Limbs are 32 bits, least significant first, with no
+ * leading zero limbs.
+ */
+class BigUnsigned {
+ public:
+  static const size_t kKaratsubaLimbs = 32;
+
+  BigUnsigned() {}
+  BigUnsigned(uint64_t x) {
+    while (x != 0) {
+      limbs_.push_back(static_cast<uint32_t>(x));
+      x >>= 32;
+    }
+  }
+
+  static BigUnsigned fromWide(unsigned __int128 x) {
+    BigUnsigned ret;
+    while (x != 0) {
+      ret.limbs_.push_back(static_cast<uint32_t>(x));
+      x >>= 32;
+    }
+    return ret;
+  }
+
+  bool isZero() const {
+    return limbs_.empty();
+  }
+
+  bool fitsWide() const {
+    return limbs_.size() <= 4;
+  }
+
+  unsigned __int128 toWide() const {
+    if (!fitsWide()) throw "BigUnsigned does not fit in 128 bits";
+    unsigned __int128 ret = 0;
+    for (size_t i = limbs_.size(); i-- > 0;) {
+      ret = (ret << 32) | limbs_[i];
+    }
+    return ret;
+  }
+
+  const std::vector<uint32_t>& limbs() const {
+    return limbs_;
+  }
+
+  int compare(const BigUnsigned& other) const {
+    if (limbs_.size() != other.limbs_.size()) {
+      return limbs_.size() < other.limbs_.size() ? -1 : 1;
+    }
+    for (size_t i = limbs_.size(); i-- > 0;) {
+      if (limbs_[i] != other.limbs_[i]) {
+        return limbs_[i] < other.limbs_[i] ? -1 : 1;
+      }
+    }
+    return 0;
+  }
+  bool operator==(const BigUnsigned& other) const {
+    return limbs_ == other.limbs_;
+  }
+  bool operator!=(const BigUnsigned& other) const {
+    return limbs_ != other.limbs_;
+  }
+  bool operator<(const BigUnsigned& other) const {
+    return compare(other) < 0;
+  }
+  bool operator<=(const BigUnsigned& other) const {
+    return compare(other) <= 0;
+  }
+  bool operator>(const BigUnsigned& other) const {
+    return compare(other) > 0;
+  }
+  bool operator>=(const BigUnsigned& other) const {
+    return compare(other) >= 0;
+  }
+
+  BigUnsigned& operator+=(const BigUnsigned& other) {
+    if (limbs_.size() < other.limbs_.size()) {
+      limbs_.resize(other.limbs_.size(), 0);
+    }
+    addAt(&limbs_, other.limbs_.data(), other.limbs_.size(), 0);
+    return *this;
+  }
+  BigUnsigned operator+(const BigUnsigned& other) const {
+    BigUnsigned ret(*this);
+    ret += other;
+    return ret;
+  }
+
+  // Requires other <= *this.
+  BigUnsigned& operator-=(const BigUnsigned& other) {
+    if (*this < other) throw "BigUnsigned subtraction underflow";
+    int64_t borrow = 0;
+    for (size_t i = 0; i < limbs_.size(); i++) {
+      int64_t d = static_cast<int64_t>(limbs_[i]) - borrow -
+          (i < other.limbs_.size() ? other.limbs_[i] : 0);
+      borrow = d < 0;
+      limbs_[i] = static_cast<uint32_t>(d);
+    }
+    trim(&limbs_);
+    return *this;
+  }
+  BigUnsigned operator-(const BigUnsigned& other) const {
+    BigUnsigned ret(*this);
+    ret -= other;
+    return ret;
+  }
+
+  // *this = *this * m + a
+  void mulAdd(uint32_t m, uint32_t a) {
+    uint64_t carry = a;
+    for (size_t i = 0; i < limbs_.size(); i++) {
+      uint64_t t = static_cast<uint64_t>(limbs_[i]) * m + carry;
+      limbs_[i] = static_cast<uint32_t>(t);
+      carry = t >> 32;
+    }
+    if (carry != 0) limbs_.push_back(static_cast<uint32_t>(carry));
+    trim(&limbs_);
+  }
+
+  BigUnsigned operator*(const BigUnsigned& other) const {
+    BigUnsigned ret;
+    if (isZero() || other.isZero()) return ret;
+    ret.limbs_.assign(limbs_.size() + other.limbs_.size(), 0);
+    multiply(limbs_.data(), limbs_.size(), other.limbs_.data(),
+             other.limbs_.size(), ret.limbs_.data());
+    trim(&ret.limbs_);
+    return ret;
+  }
+
+  uint32_t mod(uint32_t m) const {
+    uint64_t r = 0;
+    for (size_t i = limbs_.size(); i-- > 0;) {
+      r = ((r << 32) | limbs_[i]) % m;
+    }
+    return static_cast<uint32_t>(r);
+  }
+
+  std::string toString() const {
+    if (isZero()) return "0";
+    // Peel off base 10^9 digits, least significant first.
+    std::vector<uint32_t> n(limbs_);
+    std::vector<uint32_t> chunks;
+    while (!n.empty()) {
+      uint64_t r = 0;
+      for (size_t i = n.size(); i-- > 0;) {
+        uint64_t cur = (r << 32) | n[i];
+        n[i] = static_cast<uint32_t>(cur / 1000000000);
+        r = cur % 1000000000;
+      }
+      trim(&n);
+      chunks.push_back(static_cast<uint32_t>(r));
+    }
+    std::string ret = std::to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0;) {
+      std::string chunk = std::to_string(chunks[i]);
+      ret.append(9 - chunk.size(), '0');
+      ret += chunk;
+    }
+    return ret;
+  }
+
+ private:
+  static void trim(std::vector<uint32_t>* limbs) {
+    while (!limbs->empty() && limbs->back() == 0) limbs->pop_back();
+  }
+
+  // (*dst)[at..] += src[0..n), growing dst if the carry runs off the end.
+  static void addAt(std::vector<uint32_t>* dst, const uint32_t* src,
+                    size_t n, size_t at) {
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < n; i++) {
+      uint64_t t = static_cast<uint64_t>((*dst)[at + i]) + src[i] + carry;
+      (*dst)[at + i] = static_cast<uint32_t>(t);
+      carry = t >> 32;
+    }
+    for (i += at; carry != 0; i++) {
+      if (i == dst->size()) dst->push_back(0);
+      uint64_t t = static_cast<uint64_t>((*dst)[i]) + carry;
+      (*dst)[i] = static_cast<uint32_t>(t);
+      carry = t >> 32;
+    }
+  }
+
+  // out[0..na+nb) = a * b; out must start zeroed.
+  static void schoolbook(const uint32_t* a, size_t na, const uint32_t* b,
+                         size_t nb, uint32_t* out) {
+    for (size_t i = 0; i < na; i++) {
+      uint64_t carry = 0;
+      for (size_t j = 0; j < nb; j++) {
+        uint64_t t = static_cast<uint64_t>(a[i]) * b[j] + out[i + j] + carry;
+        out[i + j] = static_cast<uint32_t>(t);
+        carry = t >> 32;
+      }
+      out[i + nb] = static_cast<uint32_t>(carry);
+    }
+  }
+
+  // out[0..na+nb) = a * b; out must start zeroed.
+  static void multiply(const uint32_t* a, size_t na, const uint32_t* b,
+                       size_t nb, uint32_t* out) {
+    if (na < nb) {
+      std::swap(a, b);
+      std::swap(na, nb);
+    }
+    if (nb < kKaratsubaLimbs) {
+      schoolbook(a, na, b, nb, out);
+      return;
+    }
+    // a = a1 * B^h + a0, b = b1 * B^h + b0, and
+    // a * b = z2 * B^2h + (z1 - z2 - z0) * B^h + z0,
+    // with z1 = (a0 + a1) * (b0 + b1).
+    size_t h = (na + 1) / 2;
+    if (nb <= h) {
+      // Too lopsided to split b; do a in two halves instead.
+      std::vector<uint32_t> lo(h + nb, 0), hi(na - h + nb, 0);
+      multiply(a, h, b, nb, lo.data());
+      multiply(a + h, na - h, b, nb, hi.data());
+      std::vector<uint32_t> acc(lo);
+      acc.resize(na + nb, 0);
+      addAt(&acc, hi.data(), hi.size(), h);
+      std::copy(acc.begin(), acc.begin() + na + nb, out);
+      return;
+    }
+    BigUnsigned a0 = fromLimbs(a, h), a1 = fromLimbs(a + h, na - h);
+    BigUnsigned b0 = fromLimbs(b, h), b1 = fromLimbs(b + h, nb - h);
+    BigUnsigned z0 = a0 * b0;
+    BigUnsigned z2 = a1 * b1;
+    BigUnsigned z1 = (a0 + a1) * (b0 + b1);
+    z1 -= z0;
+    z1 -= z2;
+    std::vector<uint32_t> acc(na + nb, 0);
+    std::copy(z0.limbs_.begin(), z0.limbs_.end(), acc.begin());
+    std::copy(z2.limbs_.begin(), z2.limbs_.end(), acc.begin() + 2 * h);
+    addAt(&acc, z1.limbs_.data(), z1.limbs_.size(), h);
+    std::copy(acc.begin(), acc.begin() + na + nb, out);
+  }
+
+  static BigUnsigned fromLimbs(const uint32_t* limbs, size_t n) {
+    BigUnsigned ret;
+    ret.limbs_.assign(limbs, limbs + n);
+    trim(&ret.limbs_);
+    return ret;
+  }
+
+  std::vector<uint32_t> limbs_;
+};
+namespace std {
+  template <>
+  struct hash<BigUnsigned> {
+    size_t operator()(const BigUnsigned& n) const {
+      size_t ret = 0;
+      for (auto it = n.limbs().begin(); it != n.limbs().end(); ++it) {
+        ret *= 31;
+        ret += hash<uint32_t>()(*it);
+      }
+      return ret;
+    }
+  };
+}
+
+static inline std::ostream& operator<<(std::ostream& stream, const BigUnsigned& n) {
+  stream << n.toString();
+  return stream;
+}
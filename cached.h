@@ -0,0 +1,282 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "elements.h"
+
+#pragma once
+
+template <typename Ops> class DenseMatrix;
+template <typename T> class Monomial;
+template <typename R, typename S> class Polynomial;
+
+// Element wrappers (GroupElt, RingElt, ...) count what they wrap.
+template <typename T>
+static auto elementBytes(const T& elt, int) -> decltype(elt.element_, size_t()) {
+  return sizeof(elt) - sizeof(elt.element_) + elementBytes(elt.element_);
+}
+
+template <typename T>
+static size_t elementBytes(const T&, long) {
+  return sizeof(T);
+}
+
+/**
+ * Roughly how much memory an element takes, for CachedOps to keep to its
+ * capacity. Elements that own heap memory overload this.
+ */
+template <typename T>
+static size_t elementBytes(const T& value) {
+  return elementBytes(value, 0);
+}
+
+template <typename T>
+static size_t elementBytes(const std::vector<T>& values) {
+  size_t ret = sizeof(values);
+  for (size_t i = 0; i < values.size(); i++) {
+    ret += elementBytes(values[i]);
+  }
+  return ret + (values.capacity() - values.size()) * sizeof(T);
+}
+
+template <typename Ops>
+static size_t elementBytes(const DenseMatrix<Ops>& matrix) {
+  return sizeof(matrix) - sizeof(matrix.elements_) + elementBytes(matrix.elements_);
+}
+
+// Hash nodes cost about two pointers on top of their value, plus a bucket.
+template <typename T>
+static size_t elementBytes(const Monomial<T>& monomial) {
+  return sizeof(monomial) + monomial.exponents_.bucket_count() * sizeof(void*) +
+      monomial.exponents_.size() * (sizeof(std::pair<T, int>) + 2 * sizeof(void*));
+}
+
+template <typename R, typename S>
+static size_t elementBytes(const Polynomial<R, S>& poly) {
+  size_t ret = sizeof(poly) + poly.components_.bucket_count() * sizeof(void*);
+  for (auto it = poly.components_.begin(); it != poly.components_.end(); ++it) {
+    ret += elementBytes(it->first) + elementBytes(it->second) + 2 * sizeof(void*);
+  }
+  return ret;
+}
+
+struct CacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  size_t entries;
+  size_t bytes;
+
+  double hitRate() const {
+    return hits + misses ? static_cast<double>(hits) / (hits + misses) : 0;
+  }
+};
+
+/**
+ * Wraps an ops structure whose times (and inv) are expensive, e.g. those
+ * of PolynomialOps or DenseMatrixOps, and remembers their results in an
+ * LRU cache of at most capacity bytes (by elementBytes()), e.g.
+ *
+ *   DenseMatrixNSpace<8, IntegerModNOps<101> > space;
+ *   CachedOps<DenseMatrixNSpace<8, IntegerModNOps<101> > > cached(space);
+ *   typedef CachedOps<DenseMatrixNSpace<8, IntegerModNOps<101> > >::group GL8;
+ *   GL8 g(generator, cached);
+ *   ... g ^ 1000 ...  // repeats the same squarings as the last time
+ *
+ * Entries are found by the std::hash of the operands and then compared
+ * with ==, so the element type needs both. The cache is split into shards
+ * by hash, each with its own lock, so threads rarely wait on each other;
+ * products are computed outside the lock.
+ *
+ * Only times and inv are cached: everything else is passed straight
+ * through. In particular CachedOps has no timesPlus or pow of its own, so
+ * that a * b + c and powers go through the cached times.
+ */
+template <typename Ops>
+class CachedOps {
+ public:
+  CachedOps(const Ops& ops, size_t capacity = 64 << 20, int shards = 16) :
+      ops_(ops), shards_(std::max(shards, 1)) {
+    for (size_t i = 0; i < shards_.size(); i++) {
+      shards_[i].reset(new Shard(capacity / shards_.size()));
+    }
+  }
+
+  typedef typename Ops::element element;
+  typedef SemigroupElt<CachedOps<Ops> > semigroup;
+  typedef MonoidElt<CachedOps<Ops> > monoid;
+  typedef GroupElt<CachedOps<Ops> > group;
+  typedef RingElt<CachedOps<Ops> > ring;
+  typedef FieldElt<CachedOps<Ops> > field;
+
+  static const bool kCommutative = CommutativeOps<Ops>::value;
+
+  void init(element& a) const {
+    ops_.init(a);
+  }
+
+  element zero() const {
+    return ops_.zero();
+  }
+
+  element id() const {
+    return ops_.id();
+  }
+
+  element negate(const element& a) const {
+    return ops_.negate(a);
+  }
+
+  element plus(const element& a, const element& b) const {
+    return ops_.plus(a, b);
+  }
+
+  element times(const element& a, const element& b) const {
+    return cached(kTimes, a, b, [&]() { return ops_.times(a, b); });
+  }
+
+  element inv(const element& a) const {
+    return cached(kInv, a, a, [&]() { return ops_.inv(a); });
+  }
+
+  CacheStats stats() const {
+    CacheStats ret = CacheStats();
+    for (size_t i = 0; i < shards_.size(); i++) {
+      Shard& shard = *shards_[i];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      ret.hits += shard.hits;
+      ret.misses += shard.misses;
+      ret.evictions += shard.evictions;
+      ret.entries += shard.entries.size();
+      ret.bytes += shard.bytes;
+    }
+    return ret;
+  }
+
+  // Drops every entry (but keeps the counts).
+  void clear() {
+    for (size_t i = 0; i < shards_.size(); i++) {
+      Shard& shard = *shards_[i];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.entries.clear();
+      shard.index.clear();
+      shard.bytes = 0;
+    }
+  }
+
+  const Ops& ops() const {
+    return ops_;
+  }
+
+ private:
+  enum Op { kTimes, kInv };
+
+  struct Entry {
+    Op op;
+    size_t hash;
+    element a, b, result;
+    size_t bytes;
+  };
+
+  typedef std::list<Entry> EntryList;
+
+  // entries is most recently used first; index finds them by hash.
+  struct Shard {
+    explicit Shard(size_t capacity) :
+        capacity(capacity), bytes(0), hits(0), misses(0), evictions(0) {}
+
+    std::mutex mutex;
+    EntryList entries;
+    std::unordered_multimap<size_t, typename EntryList::iterator> index;
+    size_t capacity;
+    size_t bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+  };
+
+  template <typename F>
+  element cached(Op op, const element& a, const element& b, const F& compute) const {
+    size_t hash = (std::hash<element>()(a) * 31 + std::hash<element>()(b)) * 2 + op;
+    Shard& shard = *shards_[(hash ^ hash >> 29) % shards_.size()];
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      auto it = find(shard, op, hash, a, b);
+      if (it != shard.entries.end()) {
+        shard.hits++;
+        shard.entries.splice(shard.entries.begin(), shard.entries, it);
+        return it->result;
+      }
+      shard.misses++;
+    }
+    element result = compute();
+    // The entry, its list node and its index node.
+    Entry entry = {op, hash, a, b, result, 0};
+    entry.bytes = sizeof(Entry) - 3 * sizeof(element) + 5 * sizeof(void*) +
+        elementBytes(a) + elementBytes(b) + elementBytes(result);
+    if (entry.bytes > shard.capacity) return result;
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // Another thread may have got there first.
+    if (find(shard, op, hash, a, b) != shard.entries.end()) return result;
+    while (shard.bytes + entry.bytes > shard.capacity) {
+      const Entry& last = shard.entries.back();
+      auto range = shard.index.equal_range(last.hash);
+      for (auto it = range.first; it != range.second; ++it) {
+        if (&*it->second == &last) {
+          shard.index.erase(it);
+          break;
+        }
+      }
+      shard.bytes -= last.bytes;
+      shard.entries.pop_back();
+      shard.evictions++;
+    }
+    shard.bytes += entry.bytes;
+    shard.entries.push_front(std::move(entry));
+    shard.index.insert(std::make_pair(hash, shard.entries.begin()));
+    return result;
+  }
+
+  static typename EntryList::iterator find(Shard& shard, Op op, size_t hash,
+                                           const element& a, const element& b) {
+    auto range = shard.index.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      const Entry& entry = *it->second;
+      if (entry.op == op && entry.a == a && entry.b == b) return it->second;
+    }
+    return shard.entries.end();
+  }
+
+  const Ops& ops_;
+  std::vector<std::unique_ptr<Shard> > shards_;
+};
@@ -22,46 +22,437 @@
  * THE SOFTWARE.
  */
 
-// Code largely taken from Josh Grochow's implementation
+// Reconstructs integers from their residues mod a set of pairwise coprime
+// moduli, one tuple per line:
+//
+//   chinese -m 3,4,5 [-i input] [-o output] [-b] [-j threads] [-s]
+//
+// Tuples are read from stdin, or from -i, which is mmap'ed. Each line has
+// one residue per modulus, separated by spaces, tabs or commas; blank lines
+// are skipped. Results are written in input order, one decimal number per
+// line, or with -b as fixed-width little-endian binary: each value takes
+// as many 32-bit words as the product of the moduli does. -s reports
+// throughput on stderr.
 
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <iostream>
-#include <utility>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
-#include "elements.h"
-#include "modn.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bigint.h"
+#include "crt.h"
 
 using namespace std;
 
-int main(int argc, char** argv) {
-  typedef IntegerModOps<> Mod;
-  typedef typename Mod::ring ring;
-  vector<typename Mod::ring> inputs {
-    ring(2, Mod(3)),
-    ring(3, Mod(4)),
-    ring(1, Mod(5))
-  };
-
-  // Collect the "B"s from the extended Euclidean algorithm
-  int finalMod = 1;
-  vector<int> b;
-  for (size_t i = 0; i < inputs.size(); i++) {
-    finalMod *= inputs[i].ops_.N;
-    int curMod = inputs[i].ops_.N;
-    int tmpMod = 1;
-    for (size_t j = 0; j < inputs.size(); j++) {
-      if (i == j) continue;
-      tmpMod *= inputs[j].ops_.N;
-    }
-    int t[3] = {0};
-    extendedGcd(curMod, tmpMod, t);
-    b.push_back(t[2] * tmpMod);
+namespace {
+
+const size_t kBatchBytes = 1 << 20;
+
+struct Options {
+  vector<uint32_t> moduli;
+  const char* input = nullptr;
+  const char* output = nullptr;
+  bool binary = false;
+  bool stats = false;
+  int threads = 0;
+};
+
+// A run of whole lines of input, and the formatted results for them.
+struct Batch {
+  string owned;
+  const char* begin;
+  const char* end;
+  string out;
+  size_t tuples = 0;
+  string error;
+  bool done = false;
+};
+
+void usage(const char* argv0) {
+  cerr << "usage: " << argv0 << " -m m1,m2,... [-i input] [-o output]"
+       << " [-b] [-j threads] [-s]" << endl;
+  exit(2);
+}
+
+bool parseModuli(const char* arg, vector<uint32_t>* moduli) {
+  const char* p = arg;
+  while (*p) {
+    char* end;
+    unsigned long long m = strtoull(p, &end, 10);
+    if (end == p || m < 2 || m > 0xffffffffULL) return false;
+    moduli->push_back(static_cast<uint32_t>(m));
+    p = end;
+    if (*p == ',') p++;
+    else if (*p) return false;
+  }
+  return !moduli->empty();
+}
+
+void appendDecimal(unsigned __int128 x, string* out) {
+  char buf[40];
+  char* p = buf + sizeof(buf);
+  do {
+    *--p = static_cast<char>('0' + static_cast<int>(x % 10));
+    x /= 10;
+  } while (x != 0);
+  out->append(p, buf + sizeof(buf) - p);
+}
+
+void appendBinary(const uint32_t* limbs, size_t n, size_t width, string* out) {
+  for (size_t i = 0; i < width; i++) {
+    uint32_t limb = i < n ? limbs[i] : 0;
+    char bytes[4] = {
+      static_cast<char>(limb), static_cast<char>(limb >> 8),
+      static_cast<char>(limb >> 16), static_cast<char>(limb >> 24)
+    };
+    out->append(bytes, 4);
+  }
+}
+
+/**
+ * Parses, reconstructs and formats batches on a set of worker threads.
+ * submit() hands a batch over and next() gives finished batches back in
+ * the order they were submitted; at most window batches are in flight.
+ */
+class Pipeline {
+ public:
+  Pipeline(const CrtBasis& basis, bool binary, int threads)
+      : basis_(basis), binary_(binary),
+        width_(basis.product().limbs().size()), stopping_(false) {
+    if (threads <= 0) threads = thread::hardware_concurrency();
+    if (threads <= 0) threads = 1;
+    window_ = 4 * threads;
+    for (int i = 0; i < threads; i++) {
+      workers_.push_back(thread([this]() { work(); }));
+    }
+  }
+
+  ~Pipeline() {
+    {
+      lock_guard<mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    queued_cv_.notify_all();
+    for (size_t i = 0; i < workers_.size(); i++) {
+      workers_[i].join();
+    }
+  }
+
+  bool full() const {
+    return inflight_.size() >= window_;
+  }
+
+  bool empty() const {
+    return inflight_.empty();
+  }
+
+  void submit(unique_ptr<Batch> batch) {
+    lock_guard<mutex> lock(mutex_);
+    queue_.push_back(batch.get());
+    inflight_.push_back(move(batch));
+    queued_cv_.notify_one();
+  }
+
+  unique_ptr<Batch> next() {
+    unique_lock<mutex> lock(mutex_);
+    done_cv_.wait(lock, [this]() { return inflight_.front()->done; });
+    unique_ptr<Batch> ret = move(inflight_.front());
+    inflight_.pop_front();
+    return ret;
+  }
+
+ private:
+  void work() {
+    vector<uint32_t> residues(basis_.size());
+    while (true) {
+      Batch* batch;
+      {
+        unique_lock<mutex> lock(mutex_);
+        queued_cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+        if (queue_.empty()) return;
+        batch = queue_.front();
+        queue_.pop_front();
+      }
+      process(batch, &residues);
+      {
+        lock_guard<mutex> lock(mutex_);
+        batch->done = true;
+      }
+      done_cv_.notify_all();
+    }
+  }
+
+  void process(Batch* batch, vector<uint32_t>* residues) {
+    const char* p = batch->begin;
+    size_t k = basis_.size();
+    batch->out.reserve(binary_ ? width_ * 4 * (batch->end - p) / (2 * k)
+                       : (batch->end - p) * 2);
+    while (p < batch->end) {
+      const char* line = p;
+      size_t count = 0;
+      bool bad = false;
+      while (p < batch->end && *p != '\n') {
+        if (*p == ' ' || *p == '\t' || *p == ',' || *p == '\r') {
+          p++;
+          continue;
+        }
+        bool negative = *p == '-';
+        if (negative) p++;
+        if (p == batch->end || *p < '0' || *p > '9') {
+          bad = true;
+          break;
+        }
+        uint64_t value = 0;
+        while (p < batch->end && *p >= '0' && *p <= '9') {
+          if (value > (~0ULL - 9) / 10) {
+            bad = true;
+            break;
+          }
+          value = value * 10 + (*p - '0');
+          p++;
+        }
+        if (bad || count == k) {
+          bad = true;
+          break;
+        }
+        const BarrettReducer& reducer = basis_.reducer(count);
+        uint64_t r = reducer.reduce(value);
+        if (negative && r != 0) r = basis_.modulus(count) - r;
+        (*residues)[count++] = static_cast<uint32_t>(r);
+      }
+      const char* eol = static_cast<const char*>(
+          memchr(line, '\n', batch->end - line));
+      if (!eol) eol = batch->end;
+      if (count == 0 && !bad) {
+        p = eol + 1;
+        continue;
+      }
+      if (bad || count != k) {
+        batch->error = "malformed tuple: " + string(line, eol - line);
+        return;
+      }
+      p = eol + 1;
+      batch->tuples++;
+      if (basis_.fitsWide()) {
+        unsigned __int128 value = basis_.reconstructWide(residues->data());
+        if (binary_) {
+          uint32_t limbs[4] = {
+            static_cast<uint32_t>(value), static_cast<uint32_t>(value >> 32),
+            static_cast<uint32_t>(value >> 64), static_cast<uint32_t>(value >> 96)
+          };
+          appendBinary(limbs, 4, width_, &batch->out);
+        } else {
+          appendDecimal(value, &batch->out);
+          batch->out += '\n';
+        }
+      } else {
+        BigUnsigned value = basis_.reconstruct(residues->data());
+        if (binary_) {
+          appendBinary(value.limbs().data(), value.limbs().size(), width_,
+                       &batch->out);
+        } else {
+          batch->out += value.toString();
+          batch->out += '\n';
+        }
+      }
+    }
+  }
+
+  const CrtBasis& basis_;
+  bool binary_;
+  size_t width_;
+  size_t window_;
+  vector<thread> workers_;
+  mutex mutex_;
+  condition_variable queued_cv_;
+  condition_variable done_cv_;
+  deque<Batch*> queue_;
+  deque<unique_ptr<Batch> > inflight_;
+  bool stopping_;
+};
+
+// Writes out finished batches, oldest first, until the pipeline has room
+// for another one (or, with drain, until it is empty).
+bool flush(Pipeline* pipeline, FILE* out, bool drain, size_t* tuples) {
+  while (drain ? !pipeline->empty() : pipeline->full()) {
+    unique_ptr<Batch> batch = pipeline->next();
+    if (!batch->error.empty()) {
+      cerr << batch->error << endl;
+      return false;
+    }
+    if (fwrite(batch->out.data(), 1, batch->out.size(), out) != batch->out.size()) {
+      perror("write");
+      return false;
+    }
+    *tuples += batch->tuples;
+  }
+  return true;
+}
+
+bool run(const Options& options, const CrtBasis& basis, FILE* out,
+         size_t* tuples) {
+  Pipeline pipeline(basis, options.binary, options.threads);
+
+  if (options.input) {
+    int fd = open(options.input, O_RDONLY);
+    if (fd < 0) {
+      perror(options.input);
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      perror(options.input);
+      close(fd);
+      return false;
+    }
+    size_t size = st.st_size;
+    if (size == 0) {
+      close(fd);
+      return true;
+    }
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      perror("mmap");
+      return false;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    const char* data = static_cast<const char*>(map);
+    const char* end = data + size;
+    bool ok = true;
+    for (const char* p = data; ok && p < end;) {
+      const char* stop = p + kBatchBytes < end ? p + kBatchBytes : end;
+      if (stop < end) {
+        const char* eol = static_cast<const char*>(memchr(stop, '\n', end - stop));
+        stop = eol ? eol + 1 : end;
+      }
+      unique_ptr<Batch> batch(new Batch);
+      batch->begin = p;
+      batch->end = stop;
+      pipeline.submit(move(batch));
+      p = stop;
+      ok = flush(&pipeline, out, false, tuples);
+    }
+    ok = ok && flush(&pipeline, out, true, tuples);
+    // Let the workers finish with the mapping before it goes away.
+    while (!pipeline.empty()) pipeline.next();
+    munmap(map, size);
+    return ok;
+  }
+
+  string carry;
+  bool eof = false;
+  while (!eof) {
+    unique_ptr<Batch> batch(new Batch);
+    batch->owned.swap(carry);
+    size_t have = batch->owned.size();
+    batch->owned.resize(have + kBatchBytes);
+    while (have < batch->owned.size()) {
+      ssize_t n = read(0, &batch->owned[have], batch->owned.size() - have);
+      if (n < 0) {
+        perror("read");
+        return false;
+      }
+      if (n == 0) {
+        eof = true;
+        break;
+      }
+      have += n;
+    }
+    batch->owned.resize(have);
+    if (!eof) {
+      // Hold back the partial last line for the next batch.
+      size_t eol = batch->owned.rfind('\n');
+      if (eol == string::npos) {
+        carry.swap(batch->owned);
+        continue;
+      }
+      carry.assign(batch->owned, eol + 1, string::npos);
+      batch->owned.resize(eol + 1);
+    }
+    batch->begin = batch->owned.data();
+    batch->end = batch->owned.data() + batch->owned.size();
+    pipeline.submit(move(batch));
+    if (!flush(&pipeline, out, false, tuples)) return false;
   }
+  return flush(&pipeline, out, true, tuples);
+}
+
+}  // namespace
 
-  auto final = ring(0, Mod(finalMod));
-  for (size_t i = 0; i < b.size(); i++) {
-    final = final + b[i] * inputs[i];
+int main(int argc, char** argv) {
+  Options options;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:i:o:bj:s")) != -1) {
+    switch (opt) {
+      case 'm':
+        if (!parseModuli(optarg, &options.moduli)) usage(argv[0]);
+        break;
+      case 'i':
+        options.input = optarg;
+        break;
+      case 'o':
+        options.output = optarg;
+        break;
+      case 'b':
+        options.binary = true;
+        break;
+      case 'j':
+        options.threads = atoi(optarg);
+        break;
+      case 's':
+        options.stats = true;
+        break;
+      default:
+        usage(argv[0]);
+    }
   }
+  if (options.moduli.empty() || optind != argc) usage(argv[0]);
+
+  try {
+    CrtBasis basis(options.moduli);
+
+    FILE* out = stdout;
+    if (options.output) {
+      out = fopen(options.output, "wb");
+      if (!out) {
+        perror(options.output);
+        return 1;
+      }
+    }
+    static char buffer[1 << 20];
+    setvbuf(out, buffer, _IOFBF, sizeof(buffer));
 
-  std::cout << final << std::endl;
+    auto start = chrono::steady_clock::now();
+    size_t tuples = 0;
+    bool ok = run(options, basis, out, &tuples);
+    if (fflush(out) != 0) {
+      perror("write");
+      ok = false;
+    }
+    double seconds = chrono::duration<double>(
+        chrono::steady_clock::now() - start).count();
+    if (out != stdout) fclose(out);
+    if (options.stats) {
+      cerr << tuples << " tuples in " << seconds << " s ("
+           << (seconds > 0 ? tuples / seconds : 0) << " tuples/s)" << endl;
+    }
+    return ok ? 0 : 1;
+  } catch (const char* e) {
+    cerr << e << endl;
+    return 1;
+  }
 }
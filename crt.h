@@ -0,0 +1,355 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "bigint.h"
+#include "math.h"
+
+#pragma once
+
+/**
+ * Chinese remainder reconstruction for a fixed set of pairwise coprime
+ * moduli below 2^32. Everything that depends only on the moduli is
+ * computed once in the constructor, so a basis is meant to be built once
+ * and then used for every residue tuple of a computation.
+ *
+ * Two methods are available:
+ *  - kGarner: mixed-radix digits by Garner's algorithm, O(K^2) word
+ *    operations per tuple with no big number arithmetic until the final
+ *    Horner step. Best for small K, and the only method for 128-bit output.
+ *  - kTree: sum of r[i] * c[i] * M / m[i] over a subproduct tree, so the
+ *    big multiplications are balanced and go through Karatsuba. Best once
+ *    K is past a hundred or so.
+ * kAuto picks between them by K.
+ *
+ * reconstructAll() does many tuples at once, split over threads.
+ */
+class CrtBasis {
+ public:
+  enum Method {
+    kAuto,
+    kGarner,
+    kTree,
+  };
+
+  static const size_t kTreeMinModuli = 144;
+
+  CrtBasis(const std::vector<uint32_t>& moduli) : moduli_(moduli) {
+    size_t k = moduli_.size();
+    if (k == 0) throw "CRT basis needs at least one modulus";
+    reducers_.reserve(k);
+    for (size_t i = 0; i < k; i++) {
+      if (moduli_[i] < 2) throw "CRT moduli must be at least 2";
+      reducers_.push_back(BarrettReducer(moduli_[i]));
+    }
+
+    // radix_ holds m[j] mod m[i] for j < i, row i starting at i * (i - 1) / 2.
+    radix_.resize(k * (k - 1) / 2);
+    garner_.resize(k);
+    for (size_t i = 0; i < k; i++) {
+      uint64_t prefix = 1 % moduli_[i];
+      uint32_t* row = radix_.data() + i * (i - 1) / 2;
+      for (size_t j = 0; j < i; j++) {
+        if (gcd(moduli_[i], moduli_[j]) != 1) {
+          throw "CRT moduli must be pairwise coprime";
+        }
+        row[j] = static_cast<uint32_t>(reducers_[i].reduce(
+            static_cast<uint64_t>(moduli_[j])));
+        prefix = reducers_[i].reduce(prefix * row[j]);
+      }
+      garner_[i] = invert(prefix, moduli_[i]);
+    }
+
+    // Subproduct tree: level 0 is the moduli, each level above pairs up the
+    // one below (an odd one out is carried up as is), and the top is M.
+    tree_.push_back(std::vector<BigUnsigned>());
+    for (size_t i = 0; i < k; i++) {
+      tree_[0].push_back(BigUnsigned(moduli_[i]));
+    }
+    while (tree_.back().size() > 1) {
+      const std::vector<BigUnsigned>& below = tree_.back();
+      std::vector<BigUnsigned> level;
+      for (size_t i = 0; i + 1 < below.size(); i += 2) {
+        level.push_back(below[i] * below[i + 1]);
+      }
+      if (below.size() % 2) level.push_back(below.back());
+      tree_.push_back(level);
+    }
+    fits_wide_ = product().fitsWide();
+
+    // c[i] = (M / m[i])^-1 mod m[i]; (M / m[i]) mod m[i] is the product of
+    // everything else, which the radix table already has half of.
+    cofactor_.resize(k);
+    for (size_t i = 0; i < k; i++) {
+      uint64_t other = 1 % moduli_[i];
+      for (size_t j = 0; j < k; j++) {
+        if (j == i) continue;
+        uint64_t mj = j < i ? radix_[i * (i - 1) / 2 + j]
+            : reducers_[i].reduce(static_cast<uint64_t>(moduli_[j]));
+        other = reducers_[i].reduce(other * mj);
+      }
+      cofactor_[i] = invert(other, moduli_[i]);
+    }
+  }
+
+  size_t size() const {
+    return moduli_.size();
+  }
+
+  uint32_t modulus(size_t i) const {
+    return moduli_[i];
+  }
+
+  const BarrettReducer& reducer(size_t i) const {
+    return reducers_[i];
+  }
+
+  // M, the product of the moduli.
+  const BigUnsigned& product() const {
+    return tree_.back()[0];
+  }
+
+  // Whether M, and so every reconstruction, fits in 128 bits.
+  bool fitsWide() const {
+    return fits_wide_;
+  }
+
+  /**
+   * Garner's algorithm: fills digits with the mixed-radix digits of the
+   * number with the given residues, so that it equals
+   * digits[0] + m[0] * (digits[1] + m[1] * (digits[2] + ...)).
+   */
+  void mixedRadix(const uint32_t* residues, uint32_t* digits) const {
+    for (size_t i = 0; i < moduli_.size(); i++) {
+      const BarrettReducer& reducer = reducers_[i];
+      const uint32_t* row = radix_.data() + i * (i - 1) / 2;
+      // The value of the digits so far, mod m[i], by Horner's rule.
+      uint64_t partial = 0;
+      for (size_t j = i; j-- > 0;) {
+        partial = reducer.reduce(partial * row[j] + digits[j]);
+      }
+      uint64_t diff = residues[i] + static_cast<uint64_t>(moduli_[i]) - partial;
+      digits[i] = static_cast<uint32_t>(
+          reducer.reduce(reducer.reduce(diff) * garner_[i]));
+    }
+  }
+
+  // The number in [0, M) with the given residues; requires fitsWide().
+  unsigned __int128 reconstructWide(const uint32_t* residues) const {
+    if (!fits_wide_) throw "CRT basis too large for a 128-bit result";
+    size_t k = moduli_.size();
+    uint32_t stack_digits[8];
+    std::vector<uint32_t> heap_digits;
+    uint32_t* digits = stack_digits;
+    if (k > 8) {
+      heap_digits.resize(k);
+      digits = heap_digits.data();
+    }
+    mixedRadix(residues, digits);
+    unsigned __int128 ret = 0;
+    for (size_t i = k; i-- > 0;) {
+      ret = ret * moduli_[i] + digits[i];
+    }
+    return ret;
+  }
+
+  // The number in [0, M) with the given residues.
+  BigUnsigned reconstruct(const uint32_t* residues,
+                          Method method = kAuto) const {
+    if (method == kAuto) {
+      method = moduli_.size() >= kTreeMinModuli ? kTree : kGarner;
+    }
+    return method == kTree ? reconstructTree(residues)
+        : reconstructGarner(residues);
+  }
+
+  /**
+   * Reconstructs residues.size() / size() tuples, laid out one after the
+   * other, into out. Work is split into contiguous chunks over threads
+   * (0 means one per hardware thread).
+   */
+  void reconstructAll(const std::vector<uint32_t>& residues,
+                      std::vector<unsigned __int128>* out,
+                      int threads = 0) const {
+    if (!fits_wide_) throw "CRT basis too large for a 128-bit result";
+    size_t count = tuples(residues);
+    out->resize(count);
+    unsigned __int128* dst = out->data();
+    parallelFor(count, threads, [&](size_t begin, size_t end) {
+      for (size_t t = begin; t < end; t++) {
+        dst[t] = reconstructWide(&residues[t * moduli_.size()]);
+      }
+    });
+  }
+
+  void reconstructAll(const std::vector<uint32_t>& residues,
+                      std::vector<BigUnsigned>* out,
+                      int threads = 0, Method method = kAuto) const {
+    size_t count = tuples(residues);
+    out->resize(count);
+    BigUnsigned* dst = out->data();
+    parallelFor(count, threads, [&](size_t begin, size_t end) {
+      for (size_t t = begin; t < end; t++) {
+        dst[t] = reconstruct(&residues[t * moduli_.size()], method);
+      }
+    });
+  }
+
+ private:
+  static uint32_t invert(uint64_t a, uint32_t m) {
+    long long extgcd[3] = {0};
+    extendedGcd<long long>(a, m, extgcd);
+    return static_cast<uint32_t>(mod<long long>(extgcd[1], m));
+  }
+
+  size_t tuples(const std::vector<uint32_t>& residues) const {
+    if (residues.size() % moduli_.size() != 0) {
+      throw "Residue count is not a multiple of the basis size";
+    }
+    return residues.size() / moduli_.size();
+  }
+
+  template <typename F>
+  static void parallelFor(size_t count, int threads, const F& body) {
+    if (threads <= 0) threads = std::thread::hardware_concurrency();
+    if (threads <= 0) threads = 1;
+    // Not worth a thread for fewer than a few hundred tuples.
+    size_t max_threads = count / 256 + 1;
+    if (static_cast<size_t>(threads) > max_threads) threads = max_threads;
+    if (threads == 1) {
+      body(0, count);
+      return;
+    }
+    std::vector<std::thread> workers;
+    size_t chunk = (count + threads - 1) / threads;
+    for (size_t begin = 0; begin < count; begin += chunk) {
+      size_t end = std::min(count, begin + chunk);
+      workers.push_back(std::thread([&body, begin, end]() {
+        body(begin, end);
+      }));
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+      workers[i].join();
+    }
+  }
+
+  BigUnsigned reconstructGarner(const uint32_t* residues) const {
+    size_t k = moduli_.size();
+    std::vector<uint32_t> digits(k);
+    mixedRadix(residues, digits.data());
+    BigUnsigned ret(digits[k - 1]);
+    for (size_t i = k - 1; i-- > 0;) {
+      ret.mulAdd(moduli_[i], digits[i]);
+    }
+    return ret;
+  }
+
+  /**
+   * x = sum(y[i] * M / m[i]) - q * M with y[i] = r[i] * c[i] mod m[i] and
+   * q = floor(sum(y[i] / m[i])). The sum is built up the subproduct tree,
+   * each node being left * P(right) + right * P(left); q is estimated in
+   * floating point and then corrected.
+   */
+  BigUnsigned reconstructTree(const uint32_t* residues) const {
+    size_t k = moduli_.size();
+    std::vector<BigUnsigned> sums(k);
+    double fraction = 0;
+    for (size_t i = 0; i < k; i++) {
+      uint64_t y = reducers_[i].reduce(
+          static_cast<uint64_t>(residues[i]) * cofactor_[i]);
+      fraction += static_cast<double>(y) / moduli_[i];
+      sums[i] = BigUnsigned(y);
+    }
+    for (size_t level = 0; level + 1 < tree_.size(); level++) {
+      const std::vector<BigUnsigned>& products = tree_[level];
+      std::vector<BigUnsigned> above;
+      above.reserve((sums.size() + 1) / 2);
+      for (size_t i = 0; i + 1 < sums.size(); i += 2) {
+        BigUnsigned node = sums[i] * products[i + 1];
+        node += sums[i + 1] * products[i];
+        above.push_back(node);
+      }
+      if (sums.size() % 2) above.push_back(sums.back());
+      sums.swap(above);
+    }
+
+    const BigUnsigned& m = product();
+    BigUnsigned sub = m;
+    sub.mulAdd(static_cast<uint32_t>(std::floor(fraction)), 0);
+    while (sub > sums[0]) {
+      sub -= m;
+    }
+    BigUnsigned ret = sums[0] - sub;
+    while (ret >= m) {
+      ret -= m;
+    }
+    return ret;
+  }
+
+  std::vector<uint32_t> moduli_;
+  std::vector<BarrettReducer> reducers_;
+  std::vector<uint32_t> radix_;
+  std::vector<uint32_t> garner_;
+  std::vector<uint32_t> cofactor_;
+  std::vector<std::vector<BigUnsigned> > tree_;
+  bool fits_wide_;
+};
+
+/**
+ * Rational reconstruction: finds n / d in lowest terms with n = u * d mod m,
+ * |n| <= sqrt(m / 2) and 0 < d <= sqrt(m / 2), by stopping the extended
+ * Euclidean algorithm on (m, u) halfway (Wang's algorithm). There is at
+ * most one such fraction; returns false if there is none. m must be below
+ * 2^126, as a CrtBasis that fitsWide() with moduli below 2^31 is.
+ */
+static inline bool rationalReconstruction(unsigned __int128 u, unsigned __int128 m,
+                                          __int128* numerator, __int128* denominator) {
+  // bound = floor(sqrt(m / 2)), from a floating point estimate.
+  unsigned __int128 half = m / 2;
+  unsigned __int128 bound = static_cast<unsigned __int128>(
+      sqrtl(static_cast<long double>(half)));
+  while (bound * bound > half) bound--;
+  while ((bound + 1) * (bound + 1) <= half) bound++;
+
+  __int128 limit = static_cast<__int128>(bound);
+  __int128 r0 = static_cast<__int128>(m), r1 = static_cast<__int128>(u % m);
+  __int128 t0 = 0, t1 = 1;
+  while (r1 > limit) {
+    __int128 q = r0 / r1;
+    __int128 tmp = r0 - q * r1; r0 = r1; r1 = tmp;
+    tmp = t0 - q * t1; t0 = t1; t1 = tmp;
+  }
+  if (t1 < 0) {
+    t1 = -t1;
+    r1 = -r1;
+  }
+  if (t1 > limit || gcd(r1, t1) != 1) return false;
+  *numerator = r1;
+  *denominator = t1;
+  return true;
+}
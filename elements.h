@@ -24,36 +24,127 @@
 
 #include <ostream>
 #include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bigint.h"
+#include "perf.h"
+#include "power.h"
+
+#pragma once
+
+template <typename Ops> class SemigroupElt;
+
+// Base of the RingElt/FieldElt expression template nodes, see below.
+struct EltExprBase {};
+
+// Enables the converting constructors below for values that are not
+// elements themselves but convert to Ops::element, e.g. an int literal for
+// a Residue element. Without them `GroupElt<Ops> g = 1` would need two
+// user-defined conversions.
+template <typename Ops, typename U>
+struct ConvertsToElement : std::enable_if<
+    std::is_convertible<U, typename Ops::element>::value &&
+    !std::is_base_of<SemigroupElt<Ops>, U>::value &&
+    !std::is_base_of<EltExprBase, U>::value> {};
+
+// Whether Ops carries no state and has an Ops::instance, in which case
+// elements get at their ops through that instead of storing a reference.
+template <typename Ops, typename = void>
+struct StatelessOps : std::false_type {};
+template <typename Ops>
+struct StatelessOps<Ops, decltype(void(&Ops::instance))> : std::is_empty<Ops> {};
+
+// CommutativeOps<Ops>, whether Ops::times commutes, is in power.h, which
+// needs it for multiPower.
+
+// Holds on to an element's ops: a reference for ops with state, nothing
+// (as an empty base) for stateless ones, so that e.g. a
+// RingElt<IntegerModNOps<N> > is no bigger than its element.
+template <typename Ops, bool Stateless = StatelessOps<Ops>::value>
+class EltOpsHolder {
+ public:
+  EltOpsHolder(const Ops& ops) : ops_(ops) {}
+
+  const Ops& ops() const {
+    return ops_;
+  }
+
+ private:
+  const Ops& ops_;
+};
+template <typename Ops>
+class EltOpsHolder<Ops, true> {
+ public:
+  EltOpsHolder(const Ops& ops) {}
+
+  const Ops& ops() const {
+    return Ops::instance;
+  }
+};
+
+// Marks a value that came out of the ops, and so is already normalized:
+// elements built from one skip init.
+struct EltNormalized {};
 
 // NOTE: For ops that don't have default constructors, the expectation
 // is that they will survive for the duration of the element's
 // lifetime.
 template <typename Ops>
-class SemigroupElt {
+class SemigroupElt : public EltOpsHolder<Ops> {
   typedef typename Ops::element T;
  public:
-  SemigroupElt(const T& element) : element_(element), ops_(Ops::instance) {
-    ops_.init(element_);
-  }
-  SemigroupElt(const T& element, const Ops& ops) : element_(element), ops_(ops) {
-    ops_.init(element_);
-  }
-  SemigroupElt(const SemigroupElt<Ops>& other) : element_(other.element_), ops_(other.ops_) {
-    ops_.init(element_);
-  }
-
-  void operator=(const SemigroupElt<Ops>& other) {
+  SemigroupElt(const T& element) :
+      EltOpsHolder<Ops>(Ops::instance), element_(element) {
+    this->ops().init(element_);
+  }
+  template <typename U>
+  SemigroupElt(const U& element, typename ConvertsToElement<Ops, U>::type* = 0) :
+      EltOpsHolder<Ops>(Ops::instance), element_(element) {
+    this->ops().init(element_);
+  }
+  SemigroupElt(const T& element, const Ops& ops) :
+      EltOpsHolder<Ops>(ops), element_(element) {
+    this->ops().init(element_);
+  }
+  SemigroupElt(T&& element, const Ops& ops) :
+      EltOpsHolder<Ops>(ops), element_(std::move(element)) {
+    this->ops().init(element_);
+  }
+  SemigroupElt(T element, const Ops& ops, EltNormalized) :
+      EltOpsHolder<Ops>(ops), element_(std::move(element)) {}
+  // The other element was normalized when it was built, so no init.
+  SemigroupElt(const SemigroupElt<Ops>& other) :
+      EltOpsHolder<Ops>(other), element_(other.element_) {}
+  SemigroupElt(SemigroupElt<Ops>&& other) :
+      EltOpsHolder<Ops>(other), element_(std::move(other.element_)) {}
+
+  SemigroupElt& operator=(const SemigroupElt<Ops>& other) {
     element_ = other.element_;
+    return *this;
   }
-  void operator=(const T& other) {
+  SemigroupElt& operator=(SemigroupElt<Ops>&& other) {
+    element_ = std::move(other.element_);
+    return *this;
+  }
+  SemigroupElt& operator=(const T& other) {
     element_ = other;
+    return *this;
   }
 
   SemigroupElt operator*(const T& other) const {
-    return SemigroupElt(ops_.times(element_, other), ops_);
+    return SemigroupElt(this->ops().times(element_, other), this->ops(),
+                        EltNormalized());
+  }
+  template <typename I>
+  typename std::enable_if<std::is_integral<I>::value, SemigroupElt>::type
+  operator^(I n) const {
+    return SemigroupElt(this->pow(exponent(n), element_), this->ops(),
+                        EltNormalized());
   }
-  SemigroupElt operator^(int n) const {
-    return SemigroupElt(this->pow(n, element_), this->ops_);
+  SemigroupElt operator^(const BigUnsigned& n) const {
+    return SemigroupElt(this->pow(n, element_), this->ops(), EltNormalized());
   }
 
   bool operator==(const SemigroupElt<Ops>& other) const {
@@ -73,20 +164,39 @@ class SemigroupElt {
 
   T element_;
 
-  const Ops& ops_;
-
  protected:
-  T pow(int n, T base) const {
-    T result = this->ops_.id();
-    while (n > 0) {
-      if (n % 2 == 1) {
-        result = this->ops_.times(result, base);
-        n--;
-      }
-      base = this->ops_.times(base, base);
-      n /= 2;
-    }
-    return result;
+  // n as an unsigned exponent; negative ones only make sense in groups
+  // and fields, which invert the base first and use negatedExponent.
+  template <typename I>
+  static uint64_t exponent(I n) {
+    if (n < 0) throw "Negative exponent";
+    return static_cast<uint64_t>(n);
+  }
+
+  template <typename I>
+  static uint64_t negatedExponent(I n) {
+    return static_cast<uint64_t>(-(n + 1)) + 1;
+  }
+
+  // N is uint64_t or BigUnsigned.
+  template <typename N>
+  T pow(const N& n, const T& base) const {
+    ALGEBRA_PERF_REGION("SemigroupElt::pow");
+    return pow(n, base, 0);
+  }
+
+  // Ops that can raise to a power directly (e.g. from log tables) provide
+  // pow(base, n); everything else goes through the sliding window in
+  // power.h.
+  template <typename N, typename O = Ops>
+  auto pow(const N& n, const T& base, int) const ->
+      decltype(std::declval<const O&>().pow(base, n)) {
+    return this->ops().pow(base, n);
+  }
+
+  template <typename N>
+  T pow(const N& n, const T& base, long) const {
+    return power(this->ops(), base, n);
   }
 
 };
@@ -102,18 +212,34 @@ class MonoidElt : public SemigroupElt<Ops> {
   typedef typename Ops::element T;
  public:
   MonoidElt(const T& element) : SemigroupElt<Ops>(element) {}
+  template <typename U>
+  MonoidElt(const U& element, typename ConvertsToElement<Ops, U>::type* = 0) :
+      SemigroupElt<Ops>(T(element)) {}
   MonoidElt(const T& element, const Ops& ops) : SemigroupElt<Ops>(element, ops) {}
+  MonoidElt(T&& element, const Ops& ops) : SemigroupElt<Ops>(std::move(element), ops) {}
+  MonoidElt(T element, const Ops& ops, EltNormalized normalized) :
+      SemigroupElt<Ops>(std::move(element), ops, normalized) {}
   MonoidElt(const MonoidElt<Ops>& other) : SemigroupElt<Ops>(other) {}
+  MonoidElt(MonoidElt<Ops>&& other) : SemigroupElt<Ops>(std::move(other)) {}
+  MonoidElt& operator=(const MonoidElt<Ops>& other) = default;
+  MonoidElt& operator=(MonoidElt<Ops>&& other) = default;
 
   MonoidElt id() const {
-    return MonoidElt(this->ops_.id(), this->ops_);
+    return MonoidElt(this->ops().id(), this->ops(), EltNormalized());
   }
 
   MonoidElt operator*(const T& other) const {
-    return MonoidElt(this->ops_.times(this->element_, other), this->ops_);
+    return MonoidElt(this->ops().times(this->element_, other), this->ops(),
+                     EltNormalized());
+  }
+  template <typename I>
+  typename std::enable_if<std::is_integral<I>::value, MonoidElt>::type
+  operator^(I n) const {
+    return MonoidElt(this->pow(this->exponent(n), this->element_), this->ops(),
+                     EltNormalized());
   }
-  MonoidElt operator^(int n) const {
-    return MonoidElt(this->pow(n, this->element_), this->ops_);
+  MonoidElt operator^(const BigUnsigned& n) const {
+    return MonoidElt(this->pow(n, this->element_), this->ops(), EltNormalized());
   }
 };
 
@@ -122,34 +248,52 @@ class GroupElt : public MonoidElt<Ops> {
   typedef typename Ops::element T;
  public:
   GroupElt(const T& element) : MonoidElt<Ops>(element) {}
+  template <typename U>
+  GroupElt(const U& element, typename ConvertsToElement<Ops, U>::type* = 0) :
+      MonoidElt<Ops>(T(element)) {}
   GroupElt(const T& element, const Ops& ops) : MonoidElt<Ops>(element, ops) {}
+  GroupElt(T&& element, const Ops& ops) : MonoidElt<Ops>(std::move(element), ops) {}
+  GroupElt(T element, const Ops& ops, EltNormalized normalized) :
+      MonoidElt<Ops>(std::move(element), ops, normalized) {}
   GroupElt(const GroupElt<Ops>& other) : MonoidElt<Ops>(other) {}
+  GroupElt(GroupElt<Ops>&& other) : MonoidElt<Ops>(std::move(other)) {}
+  GroupElt& operator=(const GroupElt<Ops>& other) = default;
+  GroupElt& operator=(GroupElt<Ops>&& other) = default;
 
   GroupElt inv() {
-    return GroupElt(this->ops_.inv(this->element_), this->ops_);
+    return GroupElt(this->ops().inv(this->element_), this->ops(), EltNormalized());
   }
 
   GroupElt operator*(const T& other) const {
-    return GroupElt(this->ops_.times(this->element_, other), this->ops_);
+    return GroupElt(this->ops().times(this->element_, other), this->ops(),
+                    EltNormalized());
   }
 
   GroupElt operator/(const T& other) const {
     return GroupElt(
-        this->ops_.times(this->element_, this->ops_.inv(other)),
-        this->ops_);
+        this->ops().times(this->element_, this->ops().inv(other)),
+        this->ops(), EltNormalized());
   }
 
-  GroupElt operator^(int n) const {
+  template <typename I>
+  typename std::enable_if<std::is_integral<I>::value, GroupElt>::type
+  operator^(I n) const {
     if (n >= 0)
-      return GroupElt(this->pow(n, this->element_), this->ops_);
+      return GroupElt(this->pow(this->exponent(n), this->element_), this->ops(),
+                      EltNormalized());
     else
-      return GroupElt(this->pow(-n, this->ops_.inv(this->element_)), this->ops_);
+      return GroupElt(this->pow(this->negatedExponent(n),
+                                this->ops().inv(this->element_)),
+                      this->ops(), EltNormalized());
+  }
+  GroupElt operator^(const BigUnsigned& n) const {
+    return GroupElt(this->pow(n, this->element_), this->ops(), EltNormalized());
   }
 };
 
 template <typename Ops>
 GroupElt<Ops> operator/(const typename Ops::element& a, const GroupElt<Ops>& b) {
-  return GroupElt<Ops>(b.ops_.times(a, b.ops_.inv(b)), b.ops_);
+  return GroupElt<Ops>(b.ops().times(a, b.ops().inv(b)), b.ops(), EltNormalized());
 }
 
 
@@ -158,30 +302,39 @@ class RingElt : public MonoidElt<Ops> {
   typedef typename Ops::element T;
  public:
   RingElt(const T& element) : MonoidElt<Ops>(element) {}
+  template <typename U>
+  RingElt(const U& element, typename ConvertsToElement<Ops, U>::type* = 0) :
+      MonoidElt<Ops>(T(element)) {}
   RingElt(const T& element, const Ops& ops) : MonoidElt<Ops>(element, ops) {}
+  RingElt(T&& element, const Ops& ops) : MonoidElt<Ops>(std::move(element), ops) {}
+  RingElt(T element, const Ops& ops, EltNormalized normalized) :
+      MonoidElt<Ops>(std::move(element), ops, normalized) {}
   RingElt(const RingElt<Ops>& other) : MonoidElt<Ops>(other) {}
+  RingElt(RingElt<Ops>&& other) : MonoidElt<Ops>(std::move(other)) {}
+  RingElt& operator=(const RingElt<Ops>& other) = default;
+  RingElt& operator=(RingElt<Ops>&& other) = default;
+  // Evaluates an expression template.
+  template <typename X>
+  RingElt(const X& expr, typename std::enable_if<
+              std::is_same<typename X::elt_type, RingElt<Ops> >::value>::type* = 0) :
+      MonoidElt<Ops>(expr.eval(), expr.ops(), EltNormalized()) {}
 
   RingElt id() const {
-    return RingElt(this->ops_.id(), this->ops_);
+    return RingElt(this->ops().id(), this->ops(), EltNormalized());
   }
   RingElt zero() const {
-    return RingElt(this->ops_.zero(), this->ops_);
+    return RingElt(this->ops().zero(), this->ops(), EltNormalized());
   }
 
-  RingElt operator-() const {
-    return RingElt(this->ops_.negate(this->element_), this->ops_);
-  }
-  RingElt operator-(const T& other) const {
-    return RingElt(this->ops_.plus(this->element_, this->ops_.negate(other)), this->ops_);
-  }
-  RingElt operator+(const T& other) const {
-    return RingElt(this->ops_.plus(this->element_, other), this->ops_);
-  }
-  RingElt operator*(const T& other) const {
-    return RingElt(this->ops_.times(this->element_, other), this->ops_);
+  // +, -, * (and / for FieldElt) build expression templates, see below.
+  template <typename I>
+  typename std::enable_if<std::is_integral<I>::value, RingElt>::type
+  operator^(I n) const {
+    return RingElt(this->pow(this->exponent(n), this->element_), this->ops(),
+                   EltNormalized());
   }
-  RingElt operator^(int n) const {
-    return RingElt(this->pow(n, this->element_), this->ops_);
+  RingElt operator^(const BigUnsigned& n) const {
+    return RingElt(this->pow(n, this->element_), this->ops(), EltNormalized());
   }
 };
 
@@ -191,41 +344,492 @@ class FieldElt : public MonoidElt<Ops> {
   typedef typename Ops::element T;
  public:
   FieldElt(const T& element) : MonoidElt<Ops>(element) {}
+  template <typename U>
+  FieldElt(const U& element, typename ConvertsToElement<Ops, U>::type* = 0) :
+      MonoidElt<Ops>(T(element)) {}
   FieldElt(const T& element, const Ops& ops) : MonoidElt<Ops>(element, ops) {}
+  FieldElt(T&& element, const Ops& ops) : MonoidElt<Ops>(std::move(element), ops) {}
+  FieldElt(T element, const Ops& ops, EltNormalized normalized) :
+      MonoidElt<Ops>(std::move(element), ops, normalized) {}
   FieldElt(const FieldElt<Ops>& other) : MonoidElt<Ops>(other) {}
+  FieldElt(FieldElt<Ops>&& other) : MonoidElt<Ops>(std::move(other)) {}
+  FieldElt& operator=(const FieldElt<Ops>& other) = default;
+  FieldElt& operator=(FieldElt<Ops>&& other) = default;
+  // Evaluates an expression template.
+  template <typename X>
+  FieldElt(const X& expr, typename std::enable_if<
+              std::is_same<typename X::elt_type, FieldElt<Ops> >::value>::type* = 0) :
+      MonoidElt<Ops>(expr.eval(), expr.ops(), EltNormalized()) {}
 
   FieldElt id() const {
-    return FieldElt(this->ops_.id(), this->ops_);
+    return FieldElt(this->ops().id(), this->ops(), EltNormalized());
   }
   FieldElt zero() const {
-    return FieldElt(this->ops_.zero(), this->ops_);
+    return FieldElt(this->ops().zero(), this->ops(), EltNormalized());
   }
 
-  FieldElt operator-() const {
-    return FieldElt(this->ops_.negate(this->element_), this->ops_);
+  template <typename I>
+  typename std::enable_if<std::is_integral<I>::value, FieldElt>::type
+  operator^(I n) const {
+    if (n >= 0)
+      return FieldElt(this->pow(this->exponent(n), this->element_), this->ops(),
+                      EltNormalized());
+    else
+      return FieldElt(this->pow(this->negatedExponent(n),
+                                this->ops().inv(this->element_)),
+                      this->ops(), EltNormalized());
+  }
+  FieldElt operator^(const BigUnsigned& n) const {
+    return FieldElt(this->pow(n, this->element_), this->ops(), EltNormalized());
   }
-  FieldElt operator-(const T& other) const {
-    return FieldElt(this->ops_.plus(this->element_, this->ops_.negate(other)), this->ops_);
+};
+
+/**
+ * Expression templates for RingElt and FieldElt.
+ *
+ * a * b + c * d - e does not build a wrapper (and re-run init) per
+ * operator; it builds a tree of lightweight nodes which is evaluated on the
+ * raw elements when converted to a RingElt/FieldElt (by assignment,
+ * construction, printing or comparison) or, like the elements themselves,
+ * to a raw element. A product under a sum or
+ * difference goes through the ops' timesPlus(a, b, c) = a * b + c when it
+ * has one, which saves a reduction for the integer mod N ops.
+ *
+ * Element operands that are lvalues are held by reference; temporaries and
+ * plain values (e.g. an int) are held by copy, so keeping an expression in
+ * an auto variable is safe as long as the named elements in it outlive it.
+ */
+
+template <typename Elt>
+struct EltTraits;
+template <typename Ops>
+struct EltTraits<RingElt<Ops> > {
+  typedef Ops ops;
+  typedef typename Ops::element element;
+  static const bool kField = false;
+};
+template <typename Ops>
+struct EltTraits<FieldElt<Ops> > {
+  typedef Ops ops;
+  typedef typename Ops::element element;
+  static const bool kField = true;
+};
+
+// The RingElt/FieldElt type of an operand, or void for plain values.
+template <typename X, typename = void>
+struct ExprEltOf {
+  typedef void type;
+};
+template <typename Ops>
+struct ExprEltOf<RingElt<Ops>, void> {
+  typedef RingElt<Ops> type;
+};
+template <typename Ops>
+struct ExprEltOf<FieldElt<Ops>, void> {
+  typedef FieldElt<Ops> type;
+};
+template <typename X>
+struct ExprEltOf<X, typename std::enable_if<
+    std::is_base_of<EltExprBase, X>::value>::type> {
+  typedef typename X::elt_type type;
+};
+
+template <typename Elt>
+class EltRefLeaf {
+ public:
+  static const bool kHasOps = true;
+  EltRefLeaf(const Elt& elt) : elt_(elt) {}
+  const typename EltTraits<Elt>::ops& ops() const {
+    return elt_.ops();
   }
-  FieldElt operator+(const T& other) const {
-    return FieldElt(this->ops_.plus(this->element_, other), this->ops_);
+  const typename EltTraits<Elt>::element& eval() const {
+    return elt_.element_;
   }
-  FieldElt operator*(const T& other) const {
-    return FieldElt(this->ops_.times(this->element_, other), this->ops_);
+ private:
+  const Elt& elt_;
+};
+
+template <typename Elt>
+class EltValueLeaf {
+ public:
+  static const bool kHasOps = true;
+  EltValueLeaf(const Elt& elt) : elt_(elt) {}
+  const typename EltTraits<Elt>::ops& ops() const {
+    return elt_.ops();
   }
-  FieldElt operator/(const T& other) const {
-    return FieldElt(
-        this->ops_.times(this->element_, this->ops_.inv(other)),
-        this->ops_);
+  const typename EltTraits<Elt>::element& eval() const {
+    return elt_.element_;
   }
-  FieldElt operator^(int n) const {
-    if (n >= 0)
-      return FieldElt(this->pow(n, this->element_), this->ops_);
-    else
-      return FieldElt(this->pow(-n, this->ops_.inv(this->element_)), this->ops_);
+ private:
+  Elt elt_;
+};
+
+// A plain value, e.g. the 7 in a + 7. Like the old member operators, it is
+// handed to the ops as is, without init.
+template <typename Elt>
+class EltConstLeaf {
+  typedef typename EltTraits<Elt>::element T;
+ public:
+  static const bool kHasOps = false;
+  template <typename U>
+  EltConstLeaf(const U& value) : value_(value) {}
+  const T& eval() const {
+    return value_;
+  }
+ private:
+  T value_;
+};
+
+// How an operand of type A (as forwarded) is kept in an expression.
+template <typename Elt, typename A, typename D = typename std::decay<A>::type,
+          int Kind = std::is_same<D, Elt>::value ?
+              (std::is_lvalue_reference<A>::value ? 0 : 1) :
+              (std::is_base_of<EltExprBase, D>::value ? 2 : 3)>
+struct ExprOperand;
+template <typename Elt, typename A, typename D>
+struct ExprOperand<Elt, A, D, 0> {
+  typedef EltRefLeaf<Elt> type;
+};
+template <typename Elt, typename A, typename D>
+struct ExprOperand<Elt, A, D, 1> {
+  typedef EltValueLeaf<Elt> type;
+};
+template <typename Elt, typename A, typename D>
+struct ExprOperand<Elt, A, D, 2> {
+  typedef D type;
+};
+template <typename Elt, typename A, typename D>
+struct ExprOperand<Elt, A, D, 3> {
+  typedef EltConstLeaf<Elt> type;
+};
+
+// a * b + c, through ops.timesPlus when there is one.
+template <typename Ops, typename T>
+auto fusedTimesPlus(const Ops& ops, const T& a, const T& b, const T& c, int) ->
+    decltype(ops.timesPlus(a, b, c)) {
+  return ops.timesPlus(a, b, c);
+}
+template <typename Ops, typename T>
+T fusedTimesPlus(const Ops& ops, const T& a, const T& b, const T& c, long) {
+  return ops.plus(ops.times(a, b), c);
+}
+template <typename Ops, typename T>
+T fusedTimesPlus(const Ops& ops, const T& a, const T& b, const T& c) {
+  return fusedTimesPlus(ops, a, b, c, 0);
+}
+
+template <typename Elt, typename Op, typename L, typename R>
+class BinaryEltExpr;
+
+struct ExprTimes {
+  template <typename Ops, typename L, typename R>
+  static typename Ops::element apply(const Ops& ops, const L& l, const R& r) {
+    return ops.times(l.eval(), r.eval());
   }
 };
 
+struct ExprDivide {
+  template <typename Ops, typename L, typename R>
+  static typename Ops::element apply(const Ops& ops, const L& l, const R& r) {
+    return ops.times(l.eval(), ops.inv(r.eval()));
+  }
+};
+
+// Addition is commutative, so a product on either side can be fused.
+struct ExprPlus {
+  template <typename Ops, typename L, typename R>
+  static typename Ops::element apply(const Ops& ops, const L& l, const R& r) {
+    return ops.plus(l.eval(), r.eval());
+  }
+  template <typename Ops, typename E, typename A, typename B, typename R>
+  static typename Ops::element apply(
+      const Ops& ops, const BinaryEltExpr<E, ExprTimes, A, B>& l, const R& r) {
+    return fusedTimesPlus<Ops, typename Ops::element>(
+        ops, l.l_.eval(), l.r_.eval(), r.eval());
+  }
+  template <typename Ops, typename E, typename L, typename A, typename B>
+  static typename Ops::element apply(
+      const Ops& ops, const L& l, const BinaryEltExpr<E, ExprTimes, A, B>& r) {
+    return fusedTimesPlus<Ops, typename Ops::element>(
+        ops, r.l_.eval(), r.r_.eval(), l.eval());
+  }
+  template <typename Ops, typename E, typename A, typename B,
+            typename C, typename D>
+  static typename Ops::element apply(
+      const Ops& ops, const BinaryEltExpr<E, ExprTimes, A, B>& l,
+      const BinaryEltExpr<E, ExprTimes, C, D>& r) {
+    return fusedTimesPlus<Ops, typename Ops::element>(
+        ops, l.l_.eval(), l.r_.eval(), r.eval());
+  }
+};
+
+struct ExprMinus {
+  template <typename Ops, typename L, typename R>
+  static typename Ops::element apply(const Ops& ops, const L& l, const R& r) {
+    return ops.plus(l.eval(), ops.negate(r.eval()));
+  }
+  template <typename Ops, typename E, typename A, typename B, typename R>
+  static typename Ops::element apply(
+      const Ops& ops, const BinaryEltExpr<E, ExprTimes, A, B>& l, const R& r) {
+    return fusedTimesPlus<Ops, typename Ops::element>(
+        ops, l.l_.eval(), l.r_.eval(), ops.negate(r.eval()));
+  }
+  // l - a * b = (-a) * b + l
+  template <typename Ops, typename E, typename L, typename A, typename B>
+  static typename Ops::element apply(
+      const Ops& ops, const L& l, const BinaryEltExpr<E, ExprTimes, A, B>& r) {
+    return fusedTimesPlus<Ops, typename Ops::element>(
+        ops, ops.negate(r.l_.eval()), r.r_.eval(), l.eval());
+  }
+  template <typename Ops, typename E, typename A, typename B,
+            typename C, typename D>
+  static typename Ops::element apply(
+      const Ops& ops, const BinaryEltExpr<E, ExprTimes, A, B>& l,
+      const BinaryEltExpr<E, ExprTimes, C, D>& r) {
+    return fusedTimesPlus<Ops, typename Ops::element>(
+        ops, l.l_.eval(), l.r_.eval(), ops.negate(r.eval()));
+  }
+};
+
+template <typename Elt, typename Op, typename L, typename R>
+class BinaryEltExpr : public EltExprBase {
+  typedef typename EltTraits<Elt>::ops Ops;
+  typedef typename EltTraits<Elt>::element T;
+ public:
+  typedef Elt elt_type;
+  static const bool kHasOps = true;
+
+  BinaryEltExpr(const L& l, const R& r) : l_(l), r_(r) {}
+
+  const Ops& ops() const {
+    return ops(std::integral_constant<bool, L::kHasOps>());
+  }
+
+  T eval() const {
+    return Op::apply(ops(), l_, r_);
+  }
+
+  operator T() const {
+    return eval();
+  }
+
+  L l_;
+  R r_;
+
+ private:
+  const Ops& ops(std::true_type) const {
+    return l_.ops();
+  }
+  const Ops& ops(std::false_type) const {
+    return r_.ops();
+  }
+};
+
+template <typename Elt, typename X>
+class NegateEltExpr : public EltExprBase {
+  typedef typename EltTraits<Elt>::ops Ops;
+  typedef typename EltTraits<Elt>::element T;
+ public:
+  typedef Elt elt_type;
+  static const bool kHasOps = true;
+
+  NegateEltExpr(const X& x) : x_(x) {}
+
+  const Ops& ops() const {
+    return x_.ops();
+  }
+
+  T eval() const {
+    return ops().negate(x_.eval());
+  }
+
+  operator T() const {
+    return eval();
+  }
+
+  X x_;
+};
+
+// The expression type of a op b, if at least one of them is an element or
+// expression and the other one is of the same element type or converts to
+// its raw element.
+template <typename Elt, typename X,
+          bool IsVoid = std::is_void<Elt>::value>
+struct ExprCompatible : std::false_type {};
+template <typename Elt, typename X>
+struct ExprCompatible<Elt, X, false> : std::integral_constant<bool,
+    std::is_same<typename ExprEltOf<X>::type, Elt>::value ||
+    (std::is_void<typename ExprEltOf<X>::type>::value &&
+     std::is_convertible<X, typename EltTraits<Elt>::element>::value)> {};
+
+template <typename A, typename B>
+struct ExprEltOfPair {
+  typedef typename ExprEltOf<typename std::decay<A>::type>::type EA;
+  typedef typename ExprEltOf<typename std::decay<B>::type>::type EB;
+  typedef typename std::conditional<std::is_void<EA>::value, EB, EA>::type type;
+  static const bool value =
+      ExprCompatible<type, typename std::decay<A>::type>::value &&
+      ExprCompatible<type, typename std::decay<B>::type>::value;
+};
+
+template <typename Op, typename A, typename B,
+          bool Valid = ExprEltOfPair<A, B>::value>
+struct EltBinary {};
+template <typename Op, typename A, typename B>
+struct EltBinary<Op, A, B, true> {
+  typedef typename ExprEltOfPair<A, B>::type Elt;
+  typedef BinaryEltExpr<Elt, Op, typename ExprOperand<Elt, A>::type,
+                        typename ExprOperand<Elt, B>::type> type;
+};
+
+struct ExprNoResult {};
+
+template <typename A, typename B, bool Valid = ExprEltOfPair<A, B>::value>
+struct EltDivide {};
+template <typename A, typename B>
+struct EltDivide<A, B, true> : std::conditional<
+    EltTraits<typename ExprEltOfPair<A, B>::type>::kField,
+    EltBinary<ExprDivide, A, B>, ExprNoResult>::type {};
+
+template <typename A, typename Elt = typename ExprEltOf<
+              typename std::decay<A>::type>::type>
+struct EltNegate {
+  typedef NegateEltExpr<Elt, typename ExprOperand<Elt, A>::type> type;
+};
+template <typename A>
+struct EltNegate<A, void> {};
+
+template <typename A, typename B>
+typename EltBinary<ExprPlus, A, B>::type operator+(A&& a, B&& b) {
+  return typename EltBinary<ExprPlus, A, B>::type(a, b);
+}
+template <typename A, typename B>
+typename EltBinary<ExprMinus, A, B>::type operator-(A&& a, B&& b) {
+  return typename EltBinary<ExprMinus, A, B>::type(a, b);
+}
+template <typename A, typename B>
+typename EltBinary<ExprTimes, A, B>::type operator*(A&& a, B&& b) {
+  return typename EltBinary<ExprTimes, A, B>::type(a, b);
+}
+template <typename A, typename B>
+typename EltDivide<A, B>::type operator/(A&& a, B&& b) {
+  return typename EltDivide<A, B>::type(a, b);
+}
+template <typename A>
+typename EltNegate<A>::type operator-(A&& a) {
+  return typename EltNegate<A>::type(a);
+}
+
+template <typename X>
+typename std::enable_if<std::is_base_of<EltExprBase, X>::value,
+                        std::ostream&>::type
+operator<<(std::ostream& stream, const X& expr) {
+  stream << typename X::elt_type(expr);
+  return stream;
+}
+
+// Turns the other side of a comparison with an expression into an element.
+template <typename Elt, typename X>
+Elt exprToElt(const X& x, const typename EltTraits<Elt>::ops& ops,
+              typename std::enable_if<
+                  !std::is_void<typename ExprEltOf<X>::type>::value>::type* = 0) {
+  return Elt(x);
+}
+template <typename Elt, typename X>
+Elt exprToElt(const X& x, const typename EltTraits<Elt>::ops& ops,
+              typename std::enable_if<
+                  std::is_void<typename ExprEltOf<X>::type>::value>::type* = 0) {
+  return Elt(typename EltTraits<Elt>::element(x), ops);
+}
+
+template <typename A, typename B>
+typename std::enable_if<
+    std::is_base_of<EltExprBase, A>::value && ExprEltOfPair<A, B>::value,
+    bool>::type
+operator==(const A& a, const B& b) {
+  typename A::elt_type x(a);
+  return x == exprToElt<typename A::elt_type>(b, x.ops());
+}
+template <typename A, typename B>
+typename std::enable_if<
+    !std::is_base_of<EltExprBase, A>::value &&
+    std::is_base_of<EltExprBase, B>::value && ExprEltOfPair<A, B>::value,
+    bool>::type
+operator==(const A& a, const B& b) {
+  return b == a;
+}
+template <typename A, typename B>
+typename std::enable_if<
+    (std::is_base_of<EltExprBase, A>::value ||
+     std::is_base_of<EltExprBase, B>::value) && ExprEltOfPair<A, B>::value,
+    bool>::type
+operator!=(const A& a, const B& b) {
+  return !(a == b);
+}
+
+/**
+ * Replaces each element of elts (GroupElt's or FieldElt's over the same
+ * ops) by its inverse, using the ops' batch invAll. Returns which elements
+ * were invertible; the others are set to zero.
+ */
+template <typename Elt>
+std::vector<bool> invAll(std::vector<Elt>* elts) {
+  std::vector<bool> invertible;
+  if (elts->empty()) return invertible;
+  std::vector<decltype(elts->front().element_)> values;
+  values.reserve(elts->size());
+  for (size_t i = 0; i < elts->size(); i++) {
+    values.push_back((*elts)[i].element_);
+  }
+  (*elts)[0].ops().invAll(values, &values, &invertible);
+  for (size_t i = 0; i < elts->size(); i++) {
+    (*elts)[i].element_ = values[i];
+  }
+  return invertible;
+}
+
+// multiPow's exponents: integers go to multiPower as uint64_t's, with a
+// negative one inverting its base (so only GroupElt's and FieldElt's take
+// them), and BigUnsigned's as they are.
+template <typename Elt, typename I>
+typename std::enable_if<std::is_integral<I>::value, uint64_t>::type
+multiPowExponent(I n, Elt* base) {
+  if (n >= 0) return static_cast<uint64_t>(n);
+  *base = *base ^ -1;
+  return static_cast<uint64_t>(-(n + 1)) + 1;
+}
+
+template <typename Elt>
+const BigUnsigned& multiPowExponent(const BigUnsigned& n, Elt*) {
+  return n;
+}
+
+/**
+ * bases[0]^exponents[0] * ... * bases[k-1]^exponents[k-1] for elements
+ * over the same ops, in one pass that shares the squarings between all
+ * the bases when the ops are commutative; see multiPower in power.h.
+ * Exponents are any integer type or BigUnsigned.
+ */
+template <typename Elt, typename N>
+Elt multiPow(const std::vector<Elt>& bases, const std::vector<N>& exponents) {
+  if (bases.empty() || bases.size() != exponents.size()) {
+    throw "multiPow needs one exponent per base";
+  }
+  typedef decltype(bases[0].element_) T;
+  typedef typename std::decay<
+      decltype(multiPowExponent(exponents[0], static_cast<Elt*>(0)))>::type E;
+  std::vector<T> values;
+  std::vector<E> powers;
+  values.reserve(bases.size());
+  powers.reserve(bases.size());
+  for (size_t i = 0; i < bases.size(); i++) {
+    Elt base = bases[i];
+    powers.push_back(multiPowExponent(exponents[i], &base));
+    values.push_back(std::move(base.element_));
+  }
+  return Elt(multiPower(bases[0].ops(), values, powers), bases[0].ops(),
+             EltNormalized());
+}
 
 namespace std {
   template <typename T>
@@ -0,0 +1,470 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "gemm.h"
+#include "perf.h"
+#include "strassen.h"
+
+#pragma once
+
+/**
+ * One row being reduced, row[j] = c[j] - sum of l * u[j] over the rows u
+ * subtracted from it, which is the inner loop of the triangular solves and
+ * the elimination below. For DelayedReduction ops with a modulus below 2^32
+ * the sums are kept as 64-bit integers and reduced only when they might
+ * overflow or when an entry is read; otherwise each step is a
+ * fusedTimesPlus.
+ */
+template <typename Ops, bool Delayed = DelayedReduction<Ops>::value>
+class RowAccumulator {
+  typedef typename Ops::element T;
+ public:
+  RowAccumulator(const Ops& ops, int width) :
+      ops_(ops), width_(width), zero_(ops.zero()) {}
+
+  // Starts over with row = c[0, width).
+  void load(const T* c) {
+    row_.assign(c, c + width_);
+  }
+
+  // row[j] -= l * u[j] for j in [begin, width).
+  void subtract(const T& l, const T* u, int begin) {
+    if (l == zero_) return;
+    T negated = ops_.negate(l);
+    for (int j = begin; j < width_; j++) {
+      row_[j] = fusedTimesPlus(ops_, negated, u[j], row_[j]);
+    }
+  }
+
+  T get(int j) const {
+    return row_[j];
+  }
+
+  // out[j] = row[j] for j in [begin, width).
+  void store(T* out, int begin) const {
+    std::copy(row_.begin() + begin, row_.end(), out + begin);
+  }
+
+ private:
+  const Ops& ops_;
+  int width_;
+  T zero_;
+  std::vector<T> row_;
+};
+
+template <typename Ops>
+class RowAccumulator<Ops, true> {
+  typedef typename Ops::element T;
+ public:
+  RowAccumulator(const Ops& ops, int width) :
+      ops_(ops), width_(width), modulus_(ops.modulus()), chunk_(0),
+      count_(0), generic_(ops, width) {
+    if (modulus_ >> 32 != 0) return;
+    // Same bound as WordGemm: a reduced sum plus chunk products must fit.
+    chunk_ = ~0ULL;
+    if (modulus_ > 1) {
+      uint64_t square = (modulus_ - 1) * (modulus_ - 1);
+      chunk_ = (~0ULL - (modulus_ - 1)) / square;
+    }
+  }
+
+  void load(const T* c) {
+    if (!chunk_) return generic_.load(c);
+    values_.resize(width_);
+    sums_.assign(width_, 0);
+    count_ = 0;
+    for (int j = 0; j < width_; j++) {
+      values_[j] = ops_.value(c[j]);
+    }
+  }
+
+  void subtract(const T& l, const T* u, int begin) {
+    if (!chunk_) return generic_.subtract(l, u, begin);
+    uint64_t factor = ops_.value(l);
+    if (factor == 0) return;
+    if (count_ == chunk_) {
+      for (int j = 0; j < width_; j++) {
+        sums_[j] = ops_.reduceSum(sums_[j]);
+      }
+      count_ = 0;
+    }
+    count_++;
+    for (int j = begin; j < width_; j++) {
+      sums_[j] += factor * ops_.value(u[j]);
+    }
+  }
+
+  T get(int j) const {
+    if (!chunk_) return generic_.get(j);
+    uint64_t sum = ops_.reduceSum(sums_[j]);
+    uint64_t value = values_[j];
+    return ops_.fromValue(value >= sum ? value - sum : value + modulus_ - sum);
+  }
+
+  void store(T* out, int begin) const {
+    if (!chunk_) return generic_.store(out, begin);
+    for (int j = begin; j < width_; j++) {
+      out[j] = get(j);
+    }
+  }
+
+ private:
+  const Ops& ops_;
+  int width_;
+  uint64_t modulus_;
+  uint64_t chunk_;
+  uint64_t count_;
+  std::vector<uint64_t> values_;
+  std::vector<uint64_t> sums_;
+  RowAccumulator<Ops, false> generic_;
+};
+
+// Blocks with at most this many rows (columns, for the factorization) are
+// eliminated row by row; bigger ones are split in two, so that most of the
+// work is in matrix products.
+static const int kEliminationBlock = 32;
+
+// c -= a * b for the m x k a and k x n b, by matrixProduct(), so that big
+// blocks get the fast multiply.
+template <typename Ops, typename A, typename B, typename C>
+static void subtractProduct(const Ops& ops, int m, int n, int k, const A& a,
+                            const B& b, const C& c) {
+  typedef typename Ops::element T;
+  if (m == 0 || n == 0 || k == 0) return;
+  std::vector<T> negated;
+  negated.reserve(static_cast<size_t>(m) * k);
+  for (int i = 0; i < m; i++)
+    for (int p = 0; p < k; p++)
+      negated.push_back(ops.negate(a(i, p)));
+  matrixProduct(ops, m, n, k, RawView<const T>(negated.data(), k), b, c, true);
+}
+
+// b = l^-1 * b, for the r x r unit lower triangular l (whatever is on and
+// above its diagonal is ignored) and the r x k b.
+template <typename Ops, typename L, typename B>
+static void solveLowerUnit(const Ops& ops, int r, int k, const L& l, const B& b) {
+  if (k == 0) return;
+  if (r <= kEliminationBlock) {
+    RowAccumulator<Ops> row(ops, k);
+    for (int i = 1; i < r; i++) {
+      row.load(&b(i, 0));
+      for (int p = 0; p < i; p++) {
+        row.subtract(l(i, p), &b(p, 0), 0);
+      }
+      row.store(&b(i, 0), 0);
+    }
+    return;
+  }
+  int half = r / 2;
+  solveLowerUnit(ops, half, k, l, b);
+  subtractProduct(ops, r - half, k, half, l.block(half, 0), b, b.block(half, 0));
+  solveLowerUnit(ops, r - half, k, l.block(half, half), b.block(half, 0));
+}
+
+// b = u^-1 * b, for the r x r upper triangular u (whatever is below its
+// diagonal is ignored) whose diagonal entries have the inverses given,
+// and the r x k b.
+template <typename Ops, typename U, typename B>
+static void solveUpper(const Ops& ops, int r, int k, const U& u,
+                       const typename Ops::element* inverses, const B& b) {
+  if (k == 0) return;
+  if (r <= kEliminationBlock) {
+    RowAccumulator<Ops> row(ops, k);
+    for (int i = r; i-- > 0; ) {
+      row.load(&b(i, 0));
+      for (int p = i + 1; p < r; p++) {
+        row.subtract(u(i, p), &b(p, 0), 0);
+      }
+      row.store(&b(i, 0), 0);
+      for (int j = 0; j < k; j++) {
+        b(i, j) = ops.times(b(i, j), inverses[i]);
+      }
+    }
+    return;
+  }
+  int half = r / 2;
+  solveUpper(ops, r - half, k, u.block(half, half), inverses + half, b.block(half, 0));
+  subtractProduct(ops, half, k, r - half, u.block(0, half), b.block(half, 0), b);
+  solveUpper(ops, half, k, u, inverses, b);
+}
+
+static inline bool oddPermutation(const std::vector<int>& permutation) {
+  std::vector<bool> seen(permutation.size(), false);
+  bool odd = false;
+  for (size_t i = 0; i < permutation.size(); i++) {
+    size_t length = 0;
+    for (size_t j = i; !seen[j]; j = permutation[j]) {
+      seen[j] = true;
+      length++;
+    }
+    if (length && length % 2 == 0) odd = !odd;
+  }
+  return odd;
+}
+
+/**
+ * Gaussian elimination over a field: factors the rows x columns matrix A
+ * (row by row in values) as P A Q = L U, where P and Q permute rows and
+ * columns, L is rows x rank with ones on its diagonal and U is rank x
+ * columns, upper triangular with an invertible diagonal. Ops needs inv and
+ * negate besides the ring operations, and inv has to succeed on every
+ * nonzero element.
+ *
+ * The columns are split in two and the halves are factored one after the
+ * other, the second after subtracting the first half's contribution from
+ * it, with Q moving the pivot columns to the front, down to blocks of
+ * kEliminationBlock columns which are eliminated a row at a time (with
+ * RowAccumulator, so mod small primes the sums are only reduced at the
+ * end). Nearly all of the work is then in the matrix products of the
+ * updates and the triangular solves, which go through matrixProduct(), so
+ * they get gemm()'s kernels and threads, and Strassen-Winograd when big.
+ *
+ * Each pivot is inverted once, when it is found, and kept for the solves.
+ */
+template <typename Ops>
+class Pluq {
+  typedef typename Ops::element T;
+ public:
+  Pluq(const Ops& ops, int rows, int columns, std::vector<T> values) :
+      ops_(ops), rows_(rows), columns_(columns), rank_(0),
+      lu_(std::move(values)), pivot_inverses_(std::min(rows, columns)) {
+    ALGEBRA_PERF_REGION("Pluq::Pluq");
+    if (lu_.size() != static_cast<size_t>(rows) * columns) throw "Size mismatch";
+    for (int i = 0; i < rows; i++) row_permutation_.push_back(i);
+    for (int j = 0; j < columns; j++) column_permutation_.push_back(j);
+    if (rows && columns) rank_ = factor(0, 0, rows, columns);
+  }
+
+  int rows() const {
+    return rows_;
+  }
+  int columns() const {
+    return columns_;
+  }
+  int rank() const {
+    return rank_;
+  }
+
+  // Row i of P A is row rowPermutation()[i] of A, and column j of A Q is
+  // column columnPermutation()[j] of A.
+  const std::vector<int>& rowPermutation() const {
+    return row_permutation_;
+  }
+  const std::vector<int>& columnPermutation() const {
+    return column_permutation_;
+  }
+  // L below the diagonal and U on and above it, row by row; the entries
+  // past the rank'th row and column are all zero.
+  const std::vector<T>& lu() const {
+    return lu_;
+  }
+
+  T det() const {
+    if (rows_ != columns_) throw "Size mismatch";
+    if (rank_ < rows_) return ops_.zero();
+    T ret = ops_.id();
+    for (int i = 0; i < rows_; i++) {
+      ret = ops_.times(ret, lu_[static_cast<size_t>(i) * columns_ + i]);
+    }
+    if (oddPermutation(row_permutation_) != oddPermutation(column_permutation_)) {
+      ret = ops_.negate(ret);
+    }
+    return ret;
+  }
+
+  // A solution x (columns x k, row by row) of A x = b for the rows x k b,
+  // the one that is zero in the non-pivot columns' entries.
+  std::vector<T> solve(int k, const std::vector<T>& b) const {
+    if (b.size() != static_cast<size_t>(rows_) * k) throw "Size mismatch";
+    std::vector<T> y;
+    y.reserve(b.size());
+    for (int i = 0; i < rows_; i++) {
+      auto row = b.begin() + static_cast<size_t>(row_permutation_[i]) * k;
+      y.insert(y.end(), row, row + k);
+    }
+    RawView<const T> lu(lu_.data(), columns_);
+    RawView<T> view(y.data(), k);
+    if (rank_ > 0) {
+      solveLowerUnit(ops_, rank_, k, lu, view);
+    }
+    if (rank_ < rows_) {
+      subtractProduct(ops_, rows_ - rank_, k, rank_, lu.block(rank_, 0), view,
+                      view.block(rank_, 0));
+      T zero = ops_.zero();
+      for (size_t i = static_cast<size_t>(rank_) * k; i < y.size(); i++) {
+        if (y[i] != zero) throw "Inconsistent system";
+      }
+    }
+    if (rank_ > 0) {
+      solveUpper(ops_, rank_, k, lu, pivot_inverses_.data(), view);
+    }
+    std::vector<T> x(static_cast<size_t>(columns_) * k, ops_.zero());
+    for (int j = 0; j < rank_; j++) {
+      std::copy(y.begin() + static_cast<size_t>(j) * k,
+                y.begin() + static_cast<size_t>(j + 1) * k,
+                x.begin() + static_cast<size_t>(column_permutation_[j]) * k);
+    }
+    return x;
+  }
+
+  std::vector<T> inverse() const {
+    if (rows_ != columns_) throw "Size mismatch";
+    if (rank_ < rows_) throw "Singular matrix";
+    std::vector<T> identity(static_cast<size_t>(rows_) * rows_, ops_.zero());
+    for (int i = 0; i < rows_; i++) {
+      identity[static_cast<size_t>(i) * rows_ + i] = ops_.id();
+    }
+    return solve(rows_, identity);
+  }
+
+  // A basis of the x with A x = 0, as the columns of a columns x
+  // (columns - rank) matrix, row by row.
+  std::vector<T> nullspace() const {
+    int free = columns_ - rank_;
+    std::vector<T> ret(static_cast<size_t>(columns_) * free, ops_.zero());
+    if (free == 0) return ret;
+    // x = Q [-U1^-1 U2; I] for U = [U1 U2].
+    std::vector<T> z;
+    z.reserve(static_cast<size_t>(rank_) * free);
+    for (int i = 0; i < rank_; i++) {
+      auto row = lu_.begin() + static_cast<size_t>(i) * columns_;
+      z.insert(z.end(), row + rank_, row + columns_);
+    }
+    if (rank_ > 0) {
+      solveUpper(ops_, rank_, free, RawView<const T>(lu_.data(), columns_),
+                 pivot_inverses_.data(), RawView<T>(z.data(), free));
+    }
+    for (int j = 0; j < rank_; j++) {
+      for (int f = 0; f < free; f++) {
+        ret[static_cast<size_t>(column_permutation_[j]) * free + f] =
+            ops_.negate(z[static_cast<size_t>(j) * free + f]);
+      }
+    }
+    for (int f = 0; f < free; f++) {
+      ret[static_cast<size_t>(column_permutation_[rank_ + f]) * free + f] = ops_.id();
+    }
+    return ret;
+  }
+
+ private:
+  RawView<T> view() {
+    return RawView<T>(lu_.data(), columns_);
+  }
+
+  // Factors the m x n block at (row0, col0), all of whose rows and columns
+  // are past the pivots found so far, and returns its rank. Rows are
+  // swapped whole, and columns all the way up, so that the L to the left
+  // and the U above stay in step.
+  int factor(int row0, int col0, int m, int n) {
+    if (n <= kEliminationBlock) return factorRows(row0, col0, m, n);
+    RawView<T> a = view();
+    int left = n / 2;
+    int r1 = factor(row0, col0, m, left);
+    if (r1 > 0) {
+      solveLowerUnit(ops_, r1, n - left, a.block(row0, col0), a.block(row0, col0 + left));
+    }
+    if (r1 > 0 && r1 < m) {
+      subtractProduct(ops_, m - r1, n - left, r1, a.block(row0 + r1, col0),
+                      a.block(row0, col0 + left), a.block(row0 + r1, col0 + left));
+    }
+    int r2 = r1 < m ? factor(row0 + r1, col0 + left, m - r1, n - left) : 0;
+    // The left half's non-pivot columns are zero below its U, so moving
+    // the right half's pivot columns in front of them keeps L and U in
+    // shape.
+    if (r2 > 0 && r1 < left) {
+      rotateColumns(col0 + r1, col0 + left, col0 + left + r2);
+    }
+    return r1 + r2;
+  }
+
+  // factor() a row at a time: each row is reduced by the pivot rows found
+  // so far, which leaves its L entries, and its first nonzero entry past
+  // them, if any, becomes the next pivot.
+  int factorRows(int row0, int col0, int m, int n) {
+    RawView<T> a = view();
+    RowAccumulator<Ops> row(ops_, n);
+    T zero = ops_.zero();
+    int r = 0;
+    for (int i = 0; i < m; i++) {
+      row.load(&a(row0 + i, col0));
+      for (int p = 0; p < r; p++) {
+        T l = ops_.times(row.get(p), pivot_inverses_[row0 + p]);
+        a(row0 + i, col0 + p) = l;
+        row.subtract(l, &a(row0 + p, col0), p + 1);
+      }
+      if (r == n) continue;
+      row.store(&a(row0 + i, col0), r);
+      int pivot = r;
+      while (pivot < n && a(row0 + i, col0 + pivot) == zero) pivot++;
+      if (pivot == n) continue;
+      swapRows(row0 + r, row0 + i);
+      swapColumns(col0 + r, col0 + pivot);
+      pivot_inverses_[row0 + r] = ops_.inv(a(row0 + r, col0 + r));
+      r++;
+    }
+    return r;
+  }
+
+  void swapRows(int i, int j) {
+    if (i == j) return;
+    std::swap_ranges(lu_.begin() + static_cast<size_t>(i) * columns_,
+                     lu_.begin() + static_cast<size_t>(i + 1) * columns_,
+                     lu_.begin() + static_cast<size_t>(j) * columns_);
+    std::swap(row_permutation_[i], row_permutation_[j]);
+  }
+
+  void swapColumns(int i, int j) {
+    if (i == j) return;
+    for (int row = 0; row < rows_; row++) {
+      std::swap(lu_[static_cast<size_t>(row) * columns_ + i],
+                lu_[static_cast<size_t>(row) * columns_ + j]);
+    }
+    std::swap(column_permutation_[i], column_permutation_[j]);
+  }
+
+  // Moves columns [middle, last) in front of [first, middle).
+  void rotateColumns(int first, int middle, int last) {
+    for (int row = 0; row < rows_; row++) {
+      auto begin = lu_.begin() + static_cast<size_t>(row) * columns_;
+      std::rotate(begin + first, begin + middle, begin + last);
+    }
+    std::rotate(column_permutation_.begin() + first,
+                column_permutation_.begin() + middle,
+                column_permutation_.begin() + last);
+  }
+
+  const Ops& ops_;
+  int rows_;
+  int columns_;
+  int rank_;
+  std::vector<T> lu_;
+  std::vector<T> pivot_inverses_;
+  std::vector<int> row_permutation_;
+  std::vector<int> column_permutation_;
+};
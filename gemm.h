@@ -0,0 +1,459 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "batch.h"
+#include "elements.h"
+#include "threadpool.h"
+
+#pragma once
+
+/**
+ * Row-major views of a matrix's entries, which is what gemm() reads and
+ * writes: RawView over plain elements, EltView over the element wrappers
+ * (GroupElt, RingElt, ...) that DenseMatrix stores. T and Elt may be
+ * const.
+ */
+template <typename T>
+class RawView {
+ public:
+  RawView(T* data, size_t stride) : data_(data), stride_(stride) {}
+
+  T& operator()(int i, int j) const {
+    return data_[i * stride_ + j];
+  }
+
+  RawView block(int i, int j) const {
+    return RawView(&(*this)(i, j), stride_);
+  }
+
+ private:
+  T* data_;
+  size_t stride_;
+};
+
+template <typename Elt>
+class EltView {
+ public:
+  EltView(Elt* data, size_t stride) : data_(data), stride_(stride) {}
+
+  auto operator()(int i, int j) const -> decltype((std::declval<Elt&>().element_)) {
+    return data_[i * stride_ + j].element_;
+  }
+
+  EltView block(int i, int j) const {
+    return EltView(&data_[i * stride_ + j], stride_);
+  }
+
+ private:
+  Elt* data_;
+  size_t stride_;
+};
+
+/**
+ * A scratch vector for the kernels, borrowed from the calling thread's
+ * free list for as long as it's in scope and then given back, so that
+ * products don't allocate once a thread has done one of the same size.
+ * Borrowing rather than keeping one per thread means a product that runs
+ * inside another one's ops, or its wait (see TaskGroup), gets its own.
+ */
+template <typename T>
+class GemmBuffer {
+ public:
+  GemmBuffer() {
+    std::vector<std::unique_ptr<std::vector<T> > >& free = freeList();
+    if (free.empty()) {
+      buffer_.reset(new std::vector<T>());
+    } else {
+      buffer_ = std::move(free.back());
+      free.pop_back();
+    }
+  }
+  ~GemmBuffer() {
+    freeList().push_back(std::move(buffer_));
+  }
+
+  std::vector<T>& operator*() const {
+    return *buffer_;
+  }
+  std::vector<T>* operator->() const {
+    return buffer_.get();
+  }
+
+ private:
+  GemmBuffer(const GemmBuffer&) = delete;
+  void operator=(const GemmBuffer&) = delete;
+
+  static std::vector<std::unique_ptr<std::vector<T> > >& freeList() {
+    static thread_local std::vector<std::unique_ptr<std::vector<T> > > free;
+    return free;
+  }
+
+  std::unique_ptr<std::vector<T> > buffer_;
+};
+
+/**
+ * Ops whose elements are integers mod some N below 2^32 can have matrix
+ * products add up many products in 64 bits before reducing, by providing
+ *
+ *   uint64_t modulus() const;
+ *   uint64_t value(const element& a) const;    // a as an integer in [0, N)
+ *   element fromValue(uint64_t value) const;   // for value in [0, N)
+ *   uint64_t reduceSum(uint64_t sum) const;    // sum mod N, for any sum
+ *
+ * as the integer mod N ops do. (Larger moduli are allowed, and just don't
+ * get the fast path.)
+ */
+template <typename Ops, typename = void>
+struct DelayedReduction : std::false_type {};
+template <typename Ops>
+struct DelayedReduction<Ops, decltype(void(std::declval<const Ops&>().reduceSum(0)))> :
+    std::true_type {};
+
+/**
+ * Blocked matrix multiplication over the values of DelayedReduction ops.
+ * Blocks of a and b are packed as 64-bit values into panels that suit the
+ * microkernel, which keeps a kMR x kNR tile of 64-bit sums in registers and
+ * only reduces it every chunk steps, as many as can be added without
+ * overflowing. The block sizes keep a packed b panel in L1 and a packed a
+ * block in L2.
+ */
+class WordGemm {
+ public:
+  static const int kMR = 4;
+  static const int kNR = 8;
+  static const int kKC = 256;
+  static const int kMC = 128;
+  static const int kNC = 2048;
+
+  // c = a * b, or c += a * b if accumulate.
+  template <typename Ops, typename A, typename B, typename C>
+  static void multiply(const Ops& ops, int m, int n, int k, const A& a, const B& b,
+                       const C& c, bool accumulate) {
+    uint64_t modulus = ops.modulus();
+    // (modulus - 1) + chunk * (modulus - 1)^2 must fit in 64 bits.
+    uint64_t chunk = kKC;
+    if (modulus > 1) {
+      uint64_t square = (modulus - 1) * (modulus - 1);
+      chunk = std::min<uint64_t>(chunk, (~0ULL - (modulus - 1)) / square);
+    }
+    GemmBuffer<uint32_t> sum_buffer;
+    std::vector<uint32_t>& sums = *sum_buffer;
+    sums.assign(static_cast<size_t>(m) * n, 0);
+    if (accumulate) {
+      for (int i = 0; i < m; i++)
+        for (int j = 0; j < n; j++)
+          sums[static_cast<size_t>(i) * n + j] = ops.value(c(i, j));
+    }
+    GemmBuffer<uint64_t> a_buffer, b_buffer;
+    std::vector<uint64_t>& a_panel = *a_buffer;
+    std::vector<uint64_t>& b_panel = *b_buffer;
+    for (int jc = 0; jc < n; jc += kNC) {
+      int nc = std::min(kNC, n - jc);
+      for (int pc = 0; pc < k; pc += kKC) {
+        int kc = std::min(kKC, k - pc);
+        pack(ops, b, pc, jc, kc, nc, &b_panel);
+        for (int ic = 0; ic < m; ic += kMC) {
+          int mc = std::min(kMC, m - ic);
+          packTransposed(ops, a, ic, pc, mc, kc, &a_panel);
+          for (int jr = 0; jr < nc; jr += kNR) {
+            for (int ir = 0; ir < mc; ir += kMR) {
+              tile(ops, kc, static_cast<int>(chunk), &a_panel[ir * kc], &b_panel[jr * kc],
+                   &sums[static_cast<size_t>(ic + ir) * n + jc + jr], n,
+                   std::min(kMR, mc - ir), std::min(kNR, nc - jr));
+            }
+          }
+        }
+      }
+    }
+    for (int i = 0; i < m; i++)
+      for (int j = 0; j < n; j++)
+        c(i, j) = ops.fromValue(sums[static_cast<size_t>(i) * n + j]);
+  }
+
+ private:
+  // The kc x nc block of b at (pc, jc), as kNR-wide column strips, each
+  // stored row after row and padded with zeros.
+  template <typename Ops, typename B>
+  static void pack(const Ops& ops, const B& b, int pc, int jc, int kc, int nc,
+                   std::vector<uint64_t>* panel) {
+    int strips = (nc + kNR - 1) / kNR;
+    panel->resize(static_cast<size_t>(strips) * kNR * kc);
+    uint64_t* out = panel->data();
+    for (int s = 0; s < strips; s++) {
+      int width = std::min(kNR, nc - s * kNR);
+      for (int p = 0; p < kc; p++) {
+        for (int j = 0; j < width; j++) out[j] = ops.value(b(pc + p, jc + s * kNR + j));
+        for (int j = width; j < kNR; j++) out[j] = 0;
+        out += kNR;
+      }
+    }
+  }
+
+  // The mc x kc block of a at (ic, pc), as kMR-tall row strips, each
+  // stored column after column and padded with zeros.
+  template <typename Ops, typename A>
+  static void packTransposed(const Ops& ops, const A& a, int ic, int pc, int mc, int kc,
+                             std::vector<uint64_t>* panel) {
+    int strips = (mc + kMR - 1) / kMR;
+    panel->resize(static_cast<size_t>(strips) * kMR * kc);
+    uint64_t* out = panel->data();
+    for (int s = 0; s < strips; s++) {
+      int height = std::min(kMR, mc - s * kMR);
+      for (int p = 0; p < kc; p++) {
+        for (int i = 0; i < height; i++) out[i] = ops.value(a(ic + s * kMR + i, pc + p));
+        for (int i = height; i < kMR; i++) out[i] = 0;
+        out += kMR;
+      }
+    }
+  }
+
+  // sums[rows x cols] += a_strip * b_strip over kc steps.
+  template <typename Ops>
+  static void tile(const Ops& ops, int kc, int chunk, const uint64_t* a, const uint64_t* b,
+                   uint32_t* sums, int stride, int rows, int cols) {
+    uint64_t acc[kMR * kNR] = {0};
+    for (int i = 0; i < rows; i++)
+      for (int j = 0; j < cols; j++)
+        acc[i * kNR + j] = sums[i * stride + j];
+    for (int p = 0; p < kc; p += chunk) {
+      int steps = std::min(chunk, kc - p);
+#ifdef ALGEBRA_BATCH_X86
+      if (ResidueBatch::bestIsa() != ResidueBatch::kScalar) {
+        kernelAvx2(steps, a + p * kMR, b + p * kNR, acc);
+      } else {
+        kernel(steps, a + p * kMR, b + p * kNR, acc);
+      }
+#else
+      kernel(steps, a + p * kMR, b + p * kNR, acc);
+#endif
+      for (int i = 0; i < kMR * kNR; i++) acc[i] = ops.reduceSum(acc[i]);
+    }
+    for (int i = 0; i < rows; i++)
+      for (int j = 0; j < cols; j++)
+        sums[i * stride + j] = static_cast<uint32_t>(acc[i * kNR + j]);
+  }
+
+  static void kernel(int steps, const uint64_t* a, const uint64_t* b, uint64_t* acc) {
+    for (int p = 0; p < steps; p++, a += kMR, b += kNR) {
+      for (int i = 0; i < kMR; i++)
+        for (int j = 0; j < kNR; j++)
+          acc[i * kNR + j] += a[i] * b[j];
+    }
+  }
+
+#ifdef ALGEBRA_BATCH_X86
+  // The same, with each row of the tile in two registers of four sums.
+  // Values are below 2^32, so vpmuludq's 32 x 32 bit products are exact.
+  __attribute__((target("avx2")))
+  static void kernelAvx2(int steps, const uint64_t* a, const uint64_t* b, uint64_t* acc) {
+    __m256i* out = reinterpret_cast<__m256i*>(acc);
+    __m256i c00 = _mm256_loadu_si256(out + 0), c01 = _mm256_loadu_si256(out + 1);
+    __m256i c10 = _mm256_loadu_si256(out + 2), c11 = _mm256_loadu_si256(out + 3);
+    __m256i c20 = _mm256_loadu_si256(out + 4), c21 = _mm256_loadu_si256(out + 5);
+    __m256i c30 = _mm256_loadu_si256(out + 6), c31 = _mm256_loadu_si256(out + 7);
+    for (int p = 0; p < steps; p++, a += kMR, b += kNR) {
+      __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+      __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + 4));
+      __m256i a0 = _mm256_set1_epi64x(a[0]);
+      c00 = _mm256_add_epi64(c00, _mm256_mul_epu32(a0, b0));
+      c01 = _mm256_add_epi64(c01, _mm256_mul_epu32(a0, b1));
+      __m256i a1 = _mm256_set1_epi64x(a[1]);
+      c10 = _mm256_add_epi64(c10, _mm256_mul_epu32(a1, b0));
+      c11 = _mm256_add_epi64(c11, _mm256_mul_epu32(a1, b1));
+      __m256i a2 = _mm256_set1_epi64x(a[2]);
+      c20 = _mm256_add_epi64(c20, _mm256_mul_epu32(a2, b0));
+      c21 = _mm256_add_epi64(c21, _mm256_mul_epu32(a2, b1));
+      __m256i a3 = _mm256_set1_epi64x(a[3]);
+      c30 = _mm256_add_epi64(c30, _mm256_mul_epu32(a3, b0));
+      c31 = _mm256_add_epi64(c31, _mm256_mul_epu32(a3, b1));
+    }
+    _mm256_storeu_si256(out + 0, c00);
+    _mm256_storeu_si256(out + 1, c01);
+    _mm256_storeu_si256(out + 2, c10);
+    _mm256_storeu_si256(out + 3, c11);
+    _mm256_storeu_si256(out + 4, c20);
+    _mm256_storeu_si256(out + 5, c21);
+    _mm256_storeu_si256(out + 6, c30);
+    _mm256_storeu_si256(out + 7, c31);
+  }
+#endif
+};
+
+/**
+ * Blocked matrix multiplication over any ops: blocks of a and b are copied
+ * into contiguous panels, and each entry of c is built up with
+ * fusedTimesPlus, adding the products in order of the inner index (so the
+ * ring doesn't need to be commutative, or its addition associative).
+ */
+class GenericGemm {
+ public:
+  static const int kMR = 4;
+  static const int kNR = 4;
+  static const int kKC = 128;
+  static const int kMC = 64;
+
+  template <typename Ops, typename A, typename B, typename C>
+  static void multiply(const Ops& ops, int m, int n, int k, const A& a, const B& b,
+                       const C& c, bool accumulate) {
+    typedef typename Ops::element T;
+    if (!accumulate) {
+      for (int i = 0; i < m; i++)
+        for (int j = 0; j < n; j++)
+          c(i, j) = ops.zero();
+    }
+    GemmBuffer<T> a_buffer, b_buffer;
+    std::vector<T>& a_panel = *a_buffer;
+    std::vector<T>& b_panel = *b_buffer;
+    for (int pc = 0; pc < k; pc += kKC) {
+      int kc = std::min(kKC, k - pc);
+      // All of b's rows pc..pc+kc, kNR columns at a time.
+      b_panel.clear();
+      for (int jr = 0; jr < n; jr += kNR)
+        for (int p = 0; p < kc; p++)
+          for (int j = jr; j < std::min(n, jr + kNR); j++)
+            b_panel.push_back(b(pc + p, j));
+      for (int ic = 0; ic < m; ic += kMC) {
+        int mc = std::min(kMC, m - ic);
+        a_panel.clear();
+        for (int ir = 0; ir < mc; ir += kMR)
+          for (int p = 0; p < kc; p++)
+            for (int i = ir; i < std::min(mc, ir + kMR); i++)
+              a_panel.push_back(a(ic + i, pc + p));
+        for (int jr = 0; jr < n; jr += kNR) {
+          int cols = std::min(kNR, n - jr);
+          const T* b_strip = &b_panel[static_cast<size_t>(jr) * kc];
+          for (int ir = 0; ir < mc; ir += kMR) {
+            int rows = std::min(kMR, mc - ir);
+            const T* a_strip = &a_panel[static_cast<size_t>(ir) * kc];
+            for (int i = 0; i < rows; i++) {
+              for (int j = 0; j < cols; j++) {
+                T& sum = c(ic + ir + i, jr + j);
+                for (int p = 0; p < kc; p++) {
+                  sum = fusedTimesPlus(ops, a_strip[p * rows + i], b_strip[p * cols + j], sum);
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+};
+
+// Below this many multiplies, packing costs more than it saves.
+static const uint64_t kGemmDirectLimit = 16 * 16 * 16;
+
+template <typename Ops, typename A, typename B, typename C>
+static void gemmDirect(const Ops& ops, int m, int n, int k, const A& a, const B& b,
+                       const C& c, bool accumulate) {
+  for (int i = 0; i < m; i++) {
+    for (int j = 0; j < n; j++) {
+      typename Ops::element sum = accumulate ? c(i, j) : ops.zero();
+      for (int p = 0; p < k; p++) {
+        sum = fusedTimesPlus(ops, a(i, p), b(p, j), sum);
+      }
+      c(i, j) = std::move(sum);
+    }
+  }
+}
+
+template <typename Ops, typename A, typename B, typename C>
+static void gemmSerial(const Ops& ops, int m, int n, int k, const A& a, const B& b,
+                       const C& c, bool accumulate, std::true_type) {
+  if (ops.modulus() >> 32 == 0) {
+    WordGemm::multiply(ops, m, n, k, a, b, c, accumulate);
+  } else {
+    GenericGemm::multiply(ops, m, n, k, a, b, c, accumulate);
+  }
+}
+
+template <typename Ops, typename A, typename B, typename C>
+static void gemmSerial(const Ops& ops, int m, int n, int k, const A& a, const B& b,
+                       const C& c, bool accumulate, std::false_type) {
+  GenericGemm::multiply(ops, m, n, k, a, b, c, accumulate);
+}
+
+template <typename Ops, typename A, typename B, typename C>
+static void gemmSerial(const Ops& ops, int m, int n, int k, const A& a, const B& b,
+                       const C& c, bool accumulate) {
+  if (static_cast<uint64_t>(m) * n * k <= kGemmDirectLimit) {
+    gemmDirect(ops, m, n, k, a, b, c, accumulate);
+  } else {
+    gemmSerial(ops, m, n, k, a, b, c, accumulate, DelayedReduction<Ops>());
+  }
+}
+
+/**
+ * c = a * b (or c += a * b, if accumulate) for the m x k matrix a and the
+ * k x n matrix b, given as views (RawView, EltView). c must not overlap
+ * a or b.
+ *
+ * Big products are split into a grid of tiles of c, as many as options
+ * allow, shaped to keep down the repacking of a and b that each tile does,
+ * and the tiles are multiplied in parallel. Every entry of c is still
+ * summed in the same order, so the result is the same for any number of
+ * threads.
+ */
+template <typename Ops, typename A, typename B, typename C>
+static void gemm(const Ops& ops, int m, int n, int k, const A& a, const B& b,
+                 const C& c, bool accumulate = false,
+                 const ParallelOptions& options = ParallelOptions::defaults()) {
+  uint64_t work = static_cast<uint64_t>(m) * n * k;
+  int pieces = work <= kGemmDirectLimit ? 1 : options.pieces(work);
+  if (pieces <= 1) {
+    gemmSerial(ops, m, n, k, a, b, c, accumulate);
+    return;
+  }
+  int row_pieces = static_cast<int>(sqrt(static_cast<double>(pieces) * m / n) + 0.5);
+  row_pieces = std::max(1, std::min(pieces, row_pieces));
+  int col_pieces = std::max(1, pieces / row_pieces);
+  int rows = ((m + row_pieces - 1) / row_pieces + WordGemm::kMR - 1) /
+      WordGemm::kMR * WordGemm::kMR;
+  int cols = ((n + col_pieces - 1) / col_pieces + WordGemm::kNR - 1) /
+      WordGemm::kNR * WordGemm::kNR;
+  TaskGroup group(options.threadPool());
+  for (int i = 0; i < m; i += rows) {
+    for (int j = 0; j < n; j += cols) {
+      int height = std::min(rows, m - i), width = std::min(cols, n - j);
+      auto tile = [&, i, j, height, width]() {
+        gemmSerial(ops, height, width, k, a.block(i, 0), b.block(0, j),
+                   c.block(i, j), accumulate);
+      };
+      if (i + rows < m || j + cols < n) {
+        group.run(tile);
+      } else {
+        tile();
+      }
+    }
+  }
+  group.wait();
+}
@@ -0,0 +1,379 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "elements.h"
+
+#pragma once
+
+// Build with -DALGEBRA_INSTRUMENT=0 to compile the counting out of
+// InstrumentedOps, which then just forwards to the ops it wraps.
+#ifndef ALGEBRA_INSTRUMENT
+#define ALGEBRA_INSTRUMENT 1
+#endif
+
+enum InstrumentedOp {
+  kOpInit,
+  kOpZero,
+  kOpId,
+  kOpNegate,
+  kOpPlus,
+  kOpTimes,
+  kOpTimesPlus,
+  kOpInv,
+  kOpPow,
+  kOpCount
+};
+
+static inline const char* instrumentedOpName(int op) {
+  static const char* names[kOpCount] = {
+    "init", "zero", "id", "negate", "plus", "times", "timesPlus", "inv", "pow"
+  };
+  return names[op];
+}
+
+/**
+ * Call counts, and optionally sampled latencies, for each operation of an
+ * InstrumentedOps. Each thread counts into its own slot, which it finds
+ * through a one-entry thread_local cache, so counting is a couple of
+ * plain loads and stores; total() adds the slots up.
+ *
+ * With setSampling(n), every nth call of each operation is timed into a
+ * histogram of power-of-two nanosecond buckets. The times include reading
+ * the clock, a few tens of ns, so they overstate cheap operations.
+ */
+class OpStats {
+ public:
+  static const int kBuckets = 32;
+
+  struct Counts {
+    uint64_t calls[kOpCount];
+    uint64_t sampled[kOpCount];
+    uint64_t nanos[kOpCount];
+    // histogram[op][b] counts samples of at most 2^b ns.
+    uint64_t histogram[kOpCount][kBuckets];
+  };
+
+  explicit OpStats(const std::string& name) :
+      name_(name), id_(nextId()), sampling_(0) {}
+
+  const std::string& name() const {
+    return name_;
+  }
+
+  // Time one call in every (0 turns timing off).
+  void setSampling(uint32_t every) {
+    sampling_.store(every, std::memory_order_relaxed);
+  }
+
+  // Counts a call of op, and returns whether to time it.
+  bool count(int op) {
+    Slot& slot = local();
+    uint64_t calls = slot.calls[op].load(std::memory_order_relaxed) + 1;
+    slot.calls[op].store(calls, std::memory_order_relaxed);
+    uint32_t every = sampling_.load(std::memory_order_relaxed);
+    return every != 0 && calls % every == 0;
+  }
+
+  void record(int op, std::chrono::steady_clock::duration elapsed) {
+    Slot& slot = local();
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        elapsed).count();
+    int bucket = ns <= 1 ? 0 : 64 - __builtin_clzll(ns - 1);
+    if (bucket >= kBuckets) bucket = kBuckets - 1;
+    bump(&slot.sampled[op], 1);
+    bump(&slot.nanos[op], ns);
+    bump(&slot.histogram[op][bucket], 1);
+  }
+
+  Counts total() const {
+    Counts ret = Counts();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = slots_.begin(); it != slots_.end(); ++it) {
+      const Slot& slot = *it->second;
+      for (int op = 0; op < kOpCount; op++) {
+        ret.calls[op] += slot.calls[op].load(std::memory_order_relaxed);
+        ret.sampled[op] += slot.sampled[op].load(std::memory_order_relaxed);
+        ret.nanos[op] += slot.nanos[op].load(std::memory_order_relaxed);
+        for (int b = 0; b < kBuckets; b++) {
+          ret.histogram[op][b] += slot.histogram[op][b].load(std::memory_order_relaxed);
+        }
+      }
+    }
+    return ret;
+  }
+
+  // Not safe against threads still counting.
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = slots_.begin(); it != slots_.end(); ++it) {
+      Slot& slot = *it->second;
+      for (int op = 0; op < kOpCount; op++) {
+        slot.calls[op] = 0;
+        slot.sampled[op] = 0;
+        slot.nanos[op] = 0;
+        for (int b = 0; b < kBuckets; b++) slot.histogram[op][b] = 0;
+      }
+    }
+  }
+
+  /**
+   * One line per operation that was called: the count, and from the
+   * samples, the mean and the median and 99th percentile buckets, plus
+   * the estimated total time (mean * calls).
+   */
+  void report(std::ostream& stream) const {
+    Counts counts = total();
+    stream << "ops " << name_ << ":" << std::endl;
+    char line[160];
+    snprintf(line, sizeof(line), "  %-10s %14s %10s %10s %10s %12s",
+             "op", "calls", "mean ns", "p50 ns", "p99 ns", "total ms");
+    stream << line << std::endl;
+    for (int op = 0; op < kOpCount; op++) {
+      if (counts.calls[op] == 0) continue;
+      if (counts.sampled[op] == 0) {
+        snprintf(line, sizeof(line), "  %-10s %14llu", instrumentedOpName(op),
+                 static_cast<unsigned long long>(counts.calls[op]));
+      } else {
+        double mean = static_cast<double>(counts.nanos[op]) / counts.sampled[op];
+        snprintf(line, sizeof(line),
+                 "  %-10s %14llu %10.1f %10s %10s %12.3f",
+                 instrumentedOpName(op),
+                 static_cast<unsigned long long>(counts.calls[op]), mean,
+                 percentile(counts, op, 0.5).c_str(),
+                 percentile(counts, op, 0.99).c_str(),
+                 mean * counts.calls[op] / 1e6);
+      }
+      stream << line << std::endl;
+    }
+  }
+
+ private:
+  struct Slot {
+    Slot() {
+      for (int op = 0; op < kOpCount; op++) {
+        calls[op] = 0;
+        sampled[op] = 0;
+        nanos[op] = 0;
+        for (int b = 0; b < kBuckets; b++) histogram[op][b] = 0;
+      }
+    }
+    // Only the owning thread writes, so these need no atomic increments;
+    // they are atomics so that total() can read them meanwhile.
+    std::atomic<uint64_t> calls[kOpCount];
+    std::atomic<uint64_t> sampled[kOpCount];
+    std::atomic<uint64_t> nanos[kOpCount];
+    std::atomic<uint64_t> histogram[kOpCount][kBuckets];
+  };
+
+  // A thread's slots in the OpStats it has used, by id_, with the last one
+  // looked up in front.
+  struct Cache {
+    uint64_t last_id = 0;
+    Slot* last_slot = NULL;
+    std::unordered_map<uint64_t, Slot*> slots;
+  };
+
+  // Past this many entries, most of them are for OpStats that are gone;
+  // the cache starts over, and the live ones are looked up again.
+  static const size_t kMaxCached = 64;
+
+  OpStats(const OpStats&) = delete;
+  void operator=(const OpStats&) = delete;
+
+  static uint64_t nextId() {
+    static std::atomic<uint64_t> id(0);
+    return ++id;
+  }
+
+  static void bump(std::atomic<uint64_t>* counter, uint64_t by) {
+    counter->store(counter->load(std::memory_order_relaxed) + by,
+                   std::memory_order_relaxed);
+  }
+
+  // The calling thread's slot. The cache is keyed on id_ rather than this,
+  // which a later OpStats could reuse, and holds every instance the thread
+  // uses, so that alternating between two doesn't take the lock each time.
+  Slot& local() {
+    static thread_local Cache cache;
+    if (cache.last_id == id_) return *cache.last_slot;
+    auto found = cache.slots.find(id_);
+    Slot* slot;
+    if (found != cache.slots.end()) {
+      slot = found->second;
+    } else {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::unique_ptr<Slot>& owned = slots_[std::this_thread::get_id()];
+        if (!owned) owned.reset(new Slot());
+        slot = owned.get();
+      }
+      if (cache.slots.size() >= kMaxCached) cache.slots.clear();
+      cache.slots[id_] = slot;
+    }
+    cache.last_id = id_;
+    cache.last_slot = slot;
+    return *slot;
+  }
+
+  static std::string percentile(const Counts& counts, int op, double fraction) {
+    uint64_t target = static_cast<uint64_t>(fraction * counts.sampled[op]);
+    uint64_t seen = 0;
+    int b = 0;
+    for (; b < kBuckets - 1; b++) {
+      seen += counts.histogram[op][b];
+      if (seen > target) break;
+    }
+    return "<=" + std::to_string(1ULL << b);
+  }
+
+  std::string name_;
+  uint64_t id_;
+  std::atomic<uint32_t> sampling_;
+  mutable std::mutex mutex_;
+  std::map<std::thread::id, std::unique_ptr<Slot> > slots_;
+};
+
+/**
+ * Wraps an ops structure and counts (and, with sampling, times) every
+ * operation made through it, e.g.
+ *
+ *   InstrumentedOps<IntegerModOps<> > counted(mod13, "mod13");
+ *   DenseMatrixNSpace<3, InstrumentedOps<IntegerModOps<> > > space(counted);
+ *   ... space.times(a, b) ...
+ *   counted.stats().report(std::cout);
+ *
+ * It can go anywhere the wrapped ops can; copies share their stats. The
+ * wrapped ops must outlive it. timesPlus and pow are only offered when the
+ * wrapped ops have them, so that elements pick the same code paths with
+ * and without the wrapper.
+ */
+template <typename Ops>
+class InstrumentedOps {
+ public:
+  InstrumentedOps(const Ops& ops, const std::string& name = "ops") :
+      ops_(ops)
+#if ALGEBRA_INSTRUMENT
+      , stats_(std::make_shared<OpStats>(name))
+#endif
+  {}
+
+  typedef typename Ops::element element;
+  typedef SemigroupElt<InstrumentedOps<Ops> > semigroup;
+  typedef MonoidElt<InstrumentedOps<Ops> > monoid;
+  typedef GroupElt<InstrumentedOps<Ops> > group;
+  typedef RingElt<InstrumentedOps<Ops> > ring;
+  typedef FieldElt<InstrumentedOps<Ops> > field;
+
+  static const bool kCommutative = CommutativeOps<Ops>::value;
+
+  void init(element& a) const {
+#if ALGEBRA_INSTRUMENT
+    if (stats_->count(kOpInit)) {
+      auto start = std::chrono::steady_clock::now();
+      ops_.init(a);
+      stats_->record(kOpInit, std::chrono::steady_clock::now() - start);
+      return;
+    }
+#endif
+    ops_.init(a);
+  }
+
+  element zero() const {
+    return run(kOpZero, [&]() { return ops_.zero(); });
+  }
+
+  element id() const {
+    return run(kOpId, [&]() { return ops_.id(); });
+  }
+
+  element negate(const element& a) const {
+    return run(kOpNegate, [&]() { return ops_.negate(a); });
+  }
+
+  element plus(const element& a, const element& b) const {
+    return run(kOpPlus, [&]() { return ops_.plus(a, b); });
+  }
+
+  element times(const element& a, const element& b) const {
+    return run(kOpTimes, [&]() { return ops_.times(a, b); });
+  }
+
+  element inv(const element& a) const {
+    return run(kOpInv, [&]() { return ops_.inv(a); });
+  }
+
+  template <typename O = Ops>
+  auto timesPlus(const element& a, const element& b, const element& c) const ->
+      decltype(std::declval<const O&>().timesPlus(a, b, c)) {
+    return run(kOpTimesPlus, [&]() { return ops_.timesPlus(a, b, c); });
+  }
+
+  template <typename N, typename O = Ops>
+  auto pow(const element& a, const N& n) const ->
+      decltype(std::declval<const O&>().pow(a, n)) {
+    return run(kOpPow, [&]() { return ops_.pow(a, n); });
+  }
+
+  const Ops& ops() const {
+    return ops_;
+  }
+
+#if ALGEBRA_INSTRUMENT
+  OpStats& stats() const {
+    return *stats_;
+  }
+#endif
+
+ private:
+  template <typename F>
+  element run(InstrumentedOp op, const F& f) const {
+#if ALGEBRA_INSTRUMENT
+    if (stats_->count(op)) {
+      auto start = std::chrono::steady_clock::now();
+      element ret = f();
+      stats_->record(op, std::chrono::steady_clock::now() - start);
+      return ret;
+    }
+#endif
+    return f();
+  }
+
+  const Ops& ops_;
+#if ALGEBRA_INSTRUMENT
+  std::shared_ptr<OpStats> stats_;
+#endif
+};
@@ -0,0 +1,328 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bigint.h"
+#include "math.h"
+
+#pragma once
+
+/**
+ * Discrete log and antilog tables for a prime p: log(a) is the k with
+ * g^k == a for a fixed primitive root g, and exp(k) == g^k.
+ *
+ * log(0) is stored as 2(p-1) and the exp table runs to 4(p-1) with zeros
+ * past 2(p-1), so a product of two table entries needs no zero check:
+ * exp(log(a) + log(b)) is 0 as soon as either side is.
+ *
+ * Tables are immutable once built. forPrime() builds each one once per
+ * process and hands out shared copies; save() writes one to a file that
+ * map() can later mmap read-only, so worker processes can share the pages
+ * instead of rebuilding.
+ */
+class DiscreteLogTable {
+ public:
+  ~DiscreteLogTable() {
+    if (mapping_ != NULL) {
+      munmap(mapping_, mapping_size_);
+    }
+  }
+
+  static std::shared_ptr<const DiscreteLogTable> forPrime(uint32_t p) {
+    static std::mutex mutex;
+    static std::map<uint32_t, std::shared_ptr<const DiscreteLogTable> > tables;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<const DiscreteLogTable>& table = tables[p];
+    if (!table) {
+      table.reset(new DiscreteLogTable(p));
+    }
+    return table;
+  }
+
+  static std::shared_ptr<const DiscreteLogTable> map(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      throw "Cannot open log table";
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+      close(fd);
+      throw "Cannot read log table";
+    }
+    void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+      throw "Cannot map log table";
+    }
+    const Header* header = static_cast<const Header*>(mapping);
+    if (memcmp(header->magic, magic(), sizeof(header->magic)) != 0 ||
+        static_cast<size_t>(st.st_size) != fileSize(header->p)) {
+      munmap(mapping, st.st_size);
+      throw "Not a log table";
+    }
+    std::shared_ptr<DiscreteLogTable> table(new DiscreteLogTable());
+    table->mapping_ = mapping;
+    table->mapping_size_ = st.st_size;
+    table->p_ = header->p;
+    table->generator_ = header->generator;
+    table->log_ = reinterpret_cast<const uint32_t*>(header + 1);
+    table->exp_ = table->log_ + header->p;
+    return table;
+  }
+
+  void save(const char* path) const {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+      throw "Cannot create log table";
+    }
+    Header header;
+    memcpy(header.magic, magic(), sizeof(header.magic));
+    header.p = p_;
+    header.generator = generator_;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(log_, sizeof(uint32_t), p_, file) == p_ &&
+        fwrite(exp_, sizeof(uint32_t), expSize(p_), file) == expSize(p_);
+    if (fclose(file) != 0 || !ok) {
+      throw "Cannot write log table";
+    }
+  }
+
+  uint32_t p() const {
+    return p_;
+  }
+
+  uint32_t generator() const {
+    return generator_;
+  }
+
+  // log(0) is the 2(p-1) sentinel described above.
+  uint32_t log(uint32_t a) const {
+    return log_[a];
+  }
+
+  // Valid for k <= 4(p-1).
+  uint32_t exp(uint32_t k) const {
+    return exp_[k];
+  }
+
+ private:
+  // The tables get to be 20 bytes per element: 4 for log_, 16 for exp_.
+  static const uint32_t kMaxPrime = 1 << 24;
+
+  struct Header {
+    char magic[8];
+    uint32_t p;
+    uint32_t generator;
+  };
+
+  static const char* magic() {
+    return "ALGDLOG1";
+  }
+
+  static size_t expSize(uint32_t p) {
+    return 4 * static_cast<size_t>(p - 1) + 1;
+  }
+
+  static size_t fileSize(uint32_t p) {
+    return sizeof(Header) + sizeof(uint32_t) * (p + expSize(p));
+  }
+
+  DiscreteLogTable(const DiscreteLogTable&) = delete;
+  void operator=(const DiscreteLogTable&) = delete;
+
+  DiscreteLogTable() : mapping_(NULL), mapping_size_(0), log_(NULL), exp_(NULL) {}
+
+  explicit DiscreteLogTable(uint32_t p) : mapping_(NULL), mapping_size_(0), p_(p) {
+    if (p < 3 || p >= kMaxPrime) {
+      throw "Log table prime out of range";
+    }
+    for (uint32_t d = 2; d * d <= p; d++) {
+      if (p % d == 0) throw "Log table modulus is not prime";
+    }
+    generator_ = primitiveRoot(p);
+    storage_.resize(p + expSize(p), 0);
+    uint32_t* log = storage_.data();
+    uint32_t* exp = log + p;
+    uint64_t x = 1;
+    for (uint32_t k = 0; k < p - 1; k++) {
+      exp[k] = exp[k + p - 1] = static_cast<uint32_t>(x);
+      log[x] = k;
+      x = x * generator_ % p;
+    }
+    log[0] = 2 * (p - 1);
+    log_ = log;
+    exp_ = exp;
+  }
+
+  static uint32_t powMod(uint64_t base, uint32_t e, uint32_t p) {
+    uint64_t result = 1;
+    for (; e > 0; e >>= 1) {
+      if (e & 1) result = result * base % p;
+      base = base * base % p;
+    }
+    return static_cast<uint32_t>(result);
+  }
+
+  static uint32_t primitiveRoot(uint32_t p) {
+    std::vector<uint32_t> factors;
+    uint32_t n = p - 1;
+    for (uint32_t d = 2; d * d <= n; d++) {
+      if (n % d == 0) {
+        factors.push_back(d);
+        while (n % d == 0) n /= d;
+      }
+    }
+    if (n > 1) factors.push_back(n);
+    for (uint32_t g = 2; ; g++) {
+      size_t i = 0;
+      while (i < factors.size() && powMod(g, (p - 1) / factors[i], p) != 1) i++;
+      if (i == factors.size()) return g;
+    }
+  }
+
+  void* mapping_;
+  size_t mapping_size_;
+  std::vector<uint32_t> storage_;
+  uint32_t p_;
+  uint32_t generator_;
+  const uint32_t* log_;
+  const uint32_t* exp_;
+};
+
+/**
+ * Integer operations mod a small prime p, given in the constructor, with
+ * times, inv and pow served from a shared DiscreteLogTable: a product is
+ * two log lookups, an add and an antilog lookup. Elements are ordinary
+ * residues in [0, p), so plus and negate are a conditional subtract.
+ */
+template <typename T=int>
+class DiscreteLogModOps {
+ public:
+  DiscreteLogModOps(int p) : DiscreteLogModOps(DiscreteLogTable::forPrime(p)) {}
+  DiscreteLogModOps(const std::shared_ptr<const DiscreteLogTable>& table) :
+      N(table->p()), table_(table), reducer_(N) {}
+
+  typedef T element;
+  typedef RingElt<DiscreteLogModOps<T> > ring;
+  typedef GroupElt<DiscreteLogModOps<T> > group;
+  typedef FieldElt<DiscreteLogModOps<T> > field;
+
+  static const bool kCommutative = true;
+
+  void init(T& a) const {
+    if (a < 0 || a >= N) {
+      a = static_cast<T>(reducer_.reduce(static_cast<int64_t>(a)));
+    }
+  }
+
+  T zero() const {
+    return 0;
+  }
+
+  T id() const {
+    return 1;
+  }
+
+  T negate(const T& a) const {
+    return a == 0 ? 0 : N - a;
+  }
+
+  T plus(const T& a, const T& b) const {
+    T sum = a + b;
+    return sum >= N ? sum - N : sum;
+  }
+
+  T times(const T& a, const T& b) const {
+    return table_->exp(table_->log(a) + table_->log(b));
+  }
+
+  T inv(const T& a) const {
+    T ret;
+    if (!tryInv(a, &ret)) {
+      throw "Attempt to invert non-invertible int";
+    }
+    return ret;
+  }
+
+  bool tryInv(const T& a, T* ret) const {
+    if (a == 0) return false;
+    *ret = table_->exp(N - 1 - table_->log(a));
+    return true;
+  }
+
+  // Inverts all of a, with the same conventions as batchInverse in
+  // batch.h. An inverse here is two lookups, cheaper than the three
+  // multiplies per element batchInverse would spend to save them.
+  // out may be the same vector as a.
+  void invAll(const std::vector<T>& a, std::vector<T>* out,
+              std::vector<bool>* invertible) const {
+    size_t count = a.size();
+    invertible->assign(count, true);
+    out->resize(count);
+    for (size_t i = 0; i < count; i++) {
+      if (!tryInv(a[i], &(*out)[i])) {
+        (*invertible)[i] = false;
+        (*out)[i] = 0;
+      }
+    }
+  }
+
+  // a^n as a multiply of the log by n; SemigroupElt::pow defers to these.
+  // (Negative powers invert first.)
+  T pow(const T& a, uint64_t n) const {
+    if (n == 0) return 1;
+    if (a == 0) return 0;
+    uint64_t k = static_cast<uint64_t>(table_->log(a)) * (n % (N - 1)) % (N - 1);
+    return table_->exp(static_cast<uint32_t>(k));
+  }
+
+  T pow(const T& a, const BigUnsigned& n) const {
+    if (n.isZero()) return 1;
+    if (a == 0) return 0;
+    uint64_t k = static_cast<uint64_t>(table_->log(a)) * n.mod(N - 1) % (N - 1);
+    return table_->exp(static_cast<uint32_t>(k));
+  }
+
+  const DiscreteLogTable& table() const {
+    return *table_;
+  }
+
+  int N;
+
+ private:
+  std::shared_ptr<const DiscreteLogTable> table_;
+  BarrettReducer reducer_;
+};
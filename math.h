@@ -24,6 +24,11 @@
 
 #pragma once
 
+#include <cstdint>
+#include <type_traits>
+
+#include "perf.h"
+
 template <typename T>
 static T abs(T x) {
   if (x >= 0) return x;
@@ -42,8 +47,98 @@ static T max(T x, T y) {
   return y;
 }
 
+static inline int countTrailingZeros(unsigned int x) {
+  return __builtin_ctz(x);
+}
+
+static inline int countTrailingZeros(unsigned long x) {
+  return __builtin_ctzl(x);
+}
+
+static inline int countTrailingZeros(unsigned long long x) {
+  return __builtin_ctzll(x);
+}
+
+static inline int countTrailingZeros(unsigned __int128 x) {
+  uint64_t low = static_cast<uint64_t>(x);
+  if (low != 0) return __builtin_ctzll(low);
+  return 64 + __builtin_ctzll(static_cast<uint64_t>(x >> 64));
+}
+
+static inline int bitLength(unsigned __int128 x) {
+  uint64_t high = static_cast<uint64_t>(x >> 64);
+  if (high != 0) return 128 - __builtin_clzll(high);
+  uint64_t low = static_cast<uint64_t>(x);
+  return low == 0 ? 0 : 64 - __builtin_clzll(low);
+}
+
+/**
+ * Stein's binary GCD: only shifts, compares and subtracts, with the
+ * powers of two stripped by count-trailing-zeros instead of one at a time.
+ */
+template <typename U>
+static U binaryGcd(U u, U v) {
+  if (u == 0) return v;
+  if (v == 0) return u;
+  int shift = countTrailingZeros(static_cast<U>(u | v));
+  u >>= countTrailingZeros(u);
+  v >>= countTrailingZeros(v);
+  // Both odd from here on. Written with selects rather than a swap so the
+  // compiler emits cmov instead of a hard-to-predict branch.
+  while (u != v) {
+    U low = u < v ? u : v;
+    U diff = u < v ? v - u : u - v;
+    u = low;
+    v = diff >> countTrailingZeros(diff);
+  }
+  return u << shift;
+}
+
+/**
+ * Lehmer's GCD for double-word (128-bit) values. Each outer step runs
+ * Euclid on the leading 32 bits only, accumulating the cofactors, and
+ * then applies them to the full-width values in one go, so most quotient
+ * steps never touch 128-bit arithmetic. Once both values fit in a single
+ * word it finishes with binaryGcd.
+ */
+static inline unsigned __int128 lehmerGcd(unsigned __int128 u, unsigned __int128 v) {
+  typedef unsigned __int128 wide;
+  if (u < v) {
+    wide tmp = u;
+    u = v;
+    v = tmp;
+  }
+  while (v != 0 && (u >> 64) != 0) {
+    int shift = bitLength(u) - 32;
+    int64_t uh = static_cast<int64_t>(u >> shift);
+    int64_t vh = static_cast<int64_t>(v >> shift);
+    int64_t a = 1, b = 0, c = 0, d = 1;
+    // Knuth's Algorithm L: keep going while the quotient is certain.
+    while (vh + c != 0 && vh + d != 0) {
+      int64_t q = (uh + a) / (vh + c);
+      if (q != (uh + b) / (vh + d)) break;
+      int64_t t = a - q * c; a = c; c = t;
+      t = b - q * d; b = d; d = t;
+      t = uh - q * vh; uh = vh; vh = t;
+    }
+    if (b == 0) {
+      wide t = u % v;
+      u = v;
+      v = t;
+    } else {
+      // The exact results fit in 128 bits, so wrapping arithmetic is fine.
+      wide t = static_cast<wide>(a) * u + static_cast<wide>(b) * v;
+      wide w = static_cast<wide>(c) * u + static_cast<wide>(d) * v;
+      u = t;
+      v = w;
+    }
+  }
+  if (v == 0) return u;
+  return binaryGcd(static_cast<uint64_t>(u), static_cast<uint64_t>(v));
+}
+
 template <typename T>
-static T gcd(T x, T y) {
+static T gcd(T x, T y, std::false_type) {
   x = abs(x);
   y = abs(y);
   T a = min(x, y);
@@ -58,18 +153,30 @@ static T gcd(T x, T y) {
 }
 
 template <typename T>
-static T mod(T a, T b) {
-  while (a < 0) a += b;
-  return a % b;
+static T gcd(T x, T y, std::true_type) {
+  typedef typename std::make_unsigned<T>::type U;
+  // Negating in the unsigned type keeps the most negative value intact.
+  U u = x < 0 ? U(0) - static_cast<U>(x) : static_cast<U>(x);
+  U v = y < 0 ? U(0) - static_cast<U>(y) : static_cast<U>(y);
+  return static_cast<T>(binaryGcd(u, v));
 }
 
 template <typename T>
-static void fixSign(T* vals) {
-  if (vals[0] < 0) {
-    vals[0] *= -1;
-    vals[1] *= -1;
-    vals[2] *= -1;
-  }
+static T gcd(T x, T y) {
+  return gcd(x, y, std::is_integral<T>());
+}
+
+static inline unsigned __int128 gcd(unsigned __int128 x, unsigned __int128 y) {
+  return lehmerGcd(x, y);
+}
+
+/**
+ * Returns a mod b in [0, b) for b > 0, whatever the sign of a.
+ */
+template <typename T>
+static T mod(T a, T b) {
+  T r = a % b;
+  return r < 0 ? r + b : r;
 }
 
 /**
@@ -78,33 +185,53 @@ static void fixSign(T* vals) {
  */
 template <typename T>
 static void extendedGcd(T x, T y, T* ret) {
-  if (x > y) {
-    extendedGcd(y, x, ret);
-    T tmp = ret[1];
-    ret[1] = ret[2];
-    ret[2] = tmp;
-    fixSign(ret);
-    return;
+  ALGEBRA_PERF_REGION("extendedGcd");
+  T r0 = x, r1 = y;
+  T s0 = 1, s1 = 0;
+  T t0 = 0, t1 = 1;
+  while (r1 != 0) {
+    T q = r0 / r1;
+    T tmp = r0 - q * r1; r0 = r1; r1 = tmp;
+    tmp = s0 - q * s1; s0 = s1; s1 = tmp;
+    tmp = t0 - q * t1; t0 = t1; t1 = tmp;
+  }
+  if (r0 < 0) {
+    r0 = -r0;
+    s0 = -s0;
+    t0 = -t0;
+  }
+  ret[0] = r0;
+  ret[1] = s0;
+  ret[2] = t0;
+}
+
+/**
+ * Reduces 64-bit values by a modulus fixed at runtime without a hardware
+ * divide. The reciprocal floor(2^64 / n) is computed once; reduce() is then
+ * a multiply-high, a multiply-low and at most one correction.
+ */
+class BarrettReducer {
+ public:
+  BarrettReducer() : n_(1), m_(~0ULL) {}
+  BarrettReducer(uint64_t n) : n_(n),
+      m_(n > 1 ? static_cast<uint64_t>(
+          (static_cast<unsigned __int128>(1) << 64) / n) : ~0ULL) {}
+
+  uint64_t reduce(uint64_t x) const {
+    uint64_t q = static_cast<uint64_t>(
+        (static_cast<unsigned __int128>(x) * m_) >> 64);
+    uint64_t r = x - q * n_;
+    return r >= n_ ? r - n_ : r;
   }
 
-  if (x == 0) {
-    ret[0] = y;
-    ret[1] = 0;
-    ret[2] = 1;
-    fixSign(ret);
-    return;
-  } else if (y == 0) {
-    ret[0] = x;
-    ret[1] = 1;
-    ret[2] = 0;
-    fixSign(ret);
-    return;
+  // Same as mod(x, n), for any sign of x.
+  uint64_t reduce(int64_t x) const {
+    if (x >= 0) return reduce(static_cast<uint64_t>(x));
+    uint64_t r = reduce(0 - static_cast<uint64_t>(x));
+    return r == 0 ? 0 : n_ - r;
   }
 
-  extendedGcd(mod(y, x), x, ret);
-  T k = y / x;
-  T tmp = ret[2] - k * ret[1];
-  ret[2] = ret[1];
-  ret[1] = tmp;
-  fixSign(ret);
-}
+ private:
+  uint64_t n_;
+  uint64_t m_;
+};
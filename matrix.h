@@ -27,6 +27,10 @@
 #include <initializer_list>
 #include <vector>
 
+#include "elimination.h"
+#include "perf.h"
+#include "strassen.h"
+
 #pragma once
 
 template <typename Ops>
@@ -38,14 +42,17 @@ class DenseMatrix {
       width_(width), height_(height), default_(def) {
     elements_.resize(width * height, def);
   }
-  DenseMatrix(const DenseMatrix<Ops>& other) :
-      width_(other.width_), height_(other.height_),
-      elements_(other.elements_), default_(other.default_) {}
-  void operator=(const DenseMatrix<Ops>& other) {
-    width_ = other.width_;
-    height_ = other.height_;
-    elements_ = other.elements_;
-    default_ = other.default_;
+  DenseMatrix(const DenseMatrix<Ops>& other) = default;
+  DenseMatrix(DenseMatrix<Ops>&& other) = default;
+  DenseMatrix& operator=(const DenseMatrix<Ops>& other) = default;
+  DenseMatrix& operator=(DenseMatrix<Ops>&& other) = default;
+
+  bool operator==(const DenseMatrix<Ops>& other) const {
+    return width_ == other.width_ && height_ == other.height_ &&
+        elements_ == other.elements_;
+  }
+  bool operator!=(const DenseMatrix<Ops>& other) const {
+    return !(*this == other);
   }
 
   // Someone can do matrix[a][b] and have it work as an L-value
@@ -61,38 +68,41 @@ class DenseMatrix {
     *this = *this * other;
     return *this;
   }
+  // Multiplies the raw elements with matrixProduct() (see strassen.h and
+  // gemm.h), in parallel as ParallelOptions::defaults() allow.
   DenseMatrix operator*(const DenseMatrix<Ops>& other) const {
+    ALGEBRA_PERF_REGION("DenseMatrix::operator*");
     if (width_ != other.height_) throw "Size mismatch";
     DenseMatrix<Ops> ret(other.width_, height_, default_.zero());
-    for (int i = 0; i < other.width_; i++) {
-      for (int j = 0; j < height_; j++) {
-        element elt = default_.zero();
-        for (int n = 0; n < width_; n++) {
-          elt = elt + (*this)[j][n] * other[n][i];
-        }
-        ret[j][i] = elt;
-      }
-    }
+    matrixProduct(default_.ops(), height_, other.width_, width_,
+         EltView<const element>(elements_.data(), width_),
+         EltView<const element>(other.elements_.data(), other.width_),
+         EltView<element>(ret.elements_.data(), ret.width_));
     return ret;
   }
 
+  // These run in parallel as ParallelOptions::defaults() allow.
   DenseMatrix& operator+=(const DenseMatrix<Ops>& other) {
     if (width_ != other.width_ || height_ != other.height_) throw "Size mismatch";
-    for (int i = 0; i < height_; i++) {
-      for (int j = 0; j < width_; j++) {
-        (*this)[i][j] += other[i][j];
+    parallelFor(elements_.size(), 1, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        elements_[i] = elements_[i] + other.elements_[i];
       }
-    }
+    });
     return *this;
   }
   DenseMatrix operator+(const DenseMatrix<Ops>& other) {
-    return DenseMatrix(*this) += other;
+    DenseMatrix ret(*this);
+    ret += other;
+    return ret;
   }
 
   DenseMatrix& operator*=(const element& other) {
-    for (int i = 0; i < height_; i++)
-      for (int j = 0; j < width_; j++)
-        (*this)[i][j] = (*this)[i][j] * other;
+    parallelFor(elements_.size(), 1, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        elements_[i] = elements_[i] * other;
+      }
+    });
     return *this;
   }
 
@@ -101,6 +111,19 @@ class DenseMatrix {
   std::vector<element> elements_;
   element default_;
 };
+namespace std {
+  template <typename Ops>
+  struct hash<DenseMatrix<Ops> > {
+    size_t operator()(const DenseMatrix<Ops>& matrix) const {
+      size_t ret = matrix.width_ * 31 + matrix.height_;
+      for (auto it = matrix.elements_.begin(); it != matrix.elements_.end(); ++it) {
+        ret *= 31;
+        ret += hash<typename Ops::ring>()(*it);
+      }
+      return ret;
+    }
+  };
+}
 
 template <typename Ops>
 std::ostream& operator<<(std::ostream& stream, const DenseMatrix<Ops>& matrix) {
@@ -113,20 +136,91 @@ std::ostream& operator<<(std::ostream& stream, const DenseMatrix<Ops>& matrix) {
   return stream;
 }
 
+/**
+ * Gaussian elimination on DenseMatrix's over a field, by Pluq
+ * (elimination.h); Ops needs inv and negate. solve(a, b) returns an x with
+ * a * x = b, and throws if there is none; nullspace(a) returns a matrix
+ * whose columns are a basis of the x with a * x = 0.
+ */
+template <typename Ops>
+Pluq<Ops> pluq(const DenseMatrix<Ops>& a) {
+  std::vector<typename Ops::element> values;
+  values.reserve(a.elements_.size());
+  for (auto it = a.elements_.begin(); it != a.elements_.end(); ++it) {
+    values.push_back(it->element_);
+  }
+  return Pluq<Ops>(a.default_.ops(), a.height_, a.width_, std::move(values));
+}
+
+// A width x height matrix of values, row by row, each brought into
+// normal form by ops' init as any element is.
+template <typename Ops>
+DenseMatrix<Ops> denseMatrix(const Ops& ops, int width, int height,
+                             const std::vector<typename Ops::element>& values) {
+  typedef typename Ops::ring ring;
+  DenseMatrix<Ops> ret(width, height, ring(ops.zero(), ops, EltNormalized()));
+  for (size_t i = 0; i < values.size(); i++) {
+    ret.elements_[i] = ring(values[i], ops);
+  }
+  return ret;
+}
+
+// The same for values that are already normalized, like Pluq's results.
+template <typename Ops>
+DenseMatrix<Ops> normalizedMatrix(const Ops& ops, int width, int height,
+                                  const std::vector<typename Ops::element>& values) {
+  typedef typename Ops::ring ring;
+  DenseMatrix<Ops> ret(width, height, ring(ops.zero(), ops, EltNormalized()));
+  for (size_t i = 0; i < values.size(); i++) {
+    ret.elements_[i] = ring(values[i], ops, EltNormalized());
+  }
+  return ret;
+}
+
+template <typename Ops>
+int matrixRank(const DenseMatrix<Ops>& a) {
+  return pluq(a).rank();
+}
+
+template <typename Ops>
+typename Ops::ring det(const DenseMatrix<Ops>& a) {
+  const Ops& ops = a.default_.ops();
+  return typename Ops::ring(pluq(a).det(), ops, EltNormalized());
+}
+
+template <typename Ops>
+DenseMatrix<Ops> solve(const DenseMatrix<Ops>& a, const DenseMatrix<Ops>& b) {
+  if (a.height_ != b.height_) throw "Size mismatch";
+  std::vector<typename Ops::element> values;
+  values.reserve(b.elements_.size());
+  for (auto it = b.elements_.begin(); it != b.elements_.end(); ++it) {
+    values.push_back(it->element_);
+  }
+  return normalizedMatrix(a.default_.ops(), b.width_, a.width_,
+                          pluq(a).solve(b.width_, values));
+}
+
+template <typename Ops>
+DenseMatrix<Ops> inverse(const DenseMatrix<Ops>& a) {
+  return normalizedMatrix(a.default_.ops(), a.width_, a.height_, pluq(a).inverse());
+}
+
+template <typename Ops>
+DenseMatrix<Ops> nullspace(const DenseMatrix<Ops>& a) {
+  Pluq<Ops> factors = pluq(a);
+  return normalizedMatrix(a.default_.ops(), a.width_ - factors.rank(), a.width_,
+                          factors.nullspace());
+}
+
 template <typename E>
 class SparseMatrix {
  public:
   SparseMatrix(int width, int height, const E& def) :
       width_(width), height_(height), default_(def) {}
-  SparseMatrix(const SparseMatrix<E>& other) :
-      width_(other.width_), height_(other.height_), default_(other.default_),
-      elements_(other.elements_) {}
-  void operator=(const SparseMatrix<E>& other) {
-    width_ = other.width_;
-    height_ = other.height_;
-    default_ = other.default_;
-    elements_ = other.elements_;
-  }
+  SparseMatrix(const SparseMatrix<E>& other) = default;
+  SparseMatrix(SparseMatrix<E>&& other) = default;
+  SparseMatrix& operator=(const SparseMatrix<E>& other) = default;
+  SparseMatrix& operator=(SparseMatrix<E>&& other) = default;
 
   struct iterator {
     iterator(int index) : index1(index) {}
@@ -192,15 +286,18 @@ class DenseMatrixNSpace : public DenseMatrixOps<Ops> {
   typedef GroupElt<DenseMatrixNSpace<N, Ops> > group;
 
   DenseMatrix<Ops> id() const {
-    DenseMatrix<Ops> ret(N, N, this->elt_ops_.zero());
+    typedef typename Ops::ring ring;
+    DenseMatrix<Ops> ret(N, N, ring(this->elt_ops_.zero(), this->elt_ops_));
     for (int i = 0; i < N; i++) {
-      ret[i][i] = this->elt_ops_.id();
+      ret[i][i] = ring(this->elt_ops_.id(), this->elt_ops_);
     }
     return ret;
   }
 
-  // TODO: inv
-
+  // Throws for singular matrices, see Pluq in elimination.h.
+  DenseMatrix<Ops> inv(const DenseMatrix<Ops>& a) const {
+    return inverse(a);
+  }
 };
 template <int N, typename Ops>
 DenseMatrixNSpace<N, Ops> DenseMatrixNSpace<N, Ops>::instance;
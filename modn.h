@@ -24,10 +24,259 @@
 
 #pragma once
 
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+#include "batch.h"
 #include "math.h"
 
-template <int N, typename T=int>
+// The narrowest unsigned type that holds every residue mod N.
+template <unsigned long long N>
+struct ResidueStorage {
+  typedef typename std::conditional<(N <= 0x100ULL), uint8_t,
+      typename std::conditional<(N <= 0x10000ULL), uint16_t,
+      typename std::conditional<(N <= 0x100000000ULL), uint32_t,
+      uint64_t>::type>::type>::type type;
+};
+
+/**
+ * An integer mod N in [0, N), stored in S. Any integer converts into it
+ * (reducing mod N, so negative values work as with mod()), and it
+ * converts back to S, so it can be used where a plain integer was.
+ */
+template <unsigned long long N, typename S = typename ResidueStorage<N>::type>
+class Residue {
+ public:
+  Residue() : value_(0) {}
+  template <typename I>
+  Residue(I value, typename std::enable_if<std::is_integral<I>::value>::type* = 0) :
+      value_(reduce(value)) {}
+
+  static Residue fromReduced(uint64_t value) {
+    Residue ret;
+    ret.value_ = static_cast<S>(value);
+    return ret;
+  }
+
+  operator S() const {
+    return value_;
+  }
+
+  S value_;
+
+ private:
+  template <typename I>
+  static S reduce(I value) {
+    if (value >= 0) {
+      return static_cast<S>(static_cast<unsigned long long>(value) % N);
+    }
+    unsigned long long r = (0ULL - static_cast<unsigned long long>(value)) % N;
+    return static_cast<S>(r == 0 ? 0 : N - r);
+  }
+};
+namespace std {
+  template <unsigned long long N, typename S>
+  struct hash<Residue<N, S> > {
+    size_t operator()(const Residue<N, S>& r) const {
+      return hash<S>()(r.value_);
+    }
+  };
+}
+
+template <unsigned long long N, typename S>
+std::ostream& operator<<(std::ostream& stream, const Residue<N, S>& r) {
+  // Widened so that 8-bit storage does not print as a character.
+  stream << static_cast<unsigned long long>(r.value_);
+  return stream;
+}
+
+// 32-bit residues can go straight through the ResidueBatch kernels.
+template <unsigned long long N>
+struct BatchWord<Residue<N, uint32_t> > : std::true_type {};
+
+// How IntegerModNOps<N> multiplies and inverts, picked from N alone.
+enum ModNStrategy {
+  kModNPowerOfTwo,  // reduce by masking
+  kModNTable,       // N <= 256: multiplication and inverse tables
+  kModNDivide,      // N <= 2^32: 64-bit % by a constant, which the
+                    // compiler turns into a multiply-high
+  kModNMontgomery,  // odd N > 2^32: two Montgomery steps per product
+  kModNWide,        // even N > 2^32: 128-bit %
+};
+
+template <unsigned long long N>
+struct ModNTraits {
+  static const ModNStrategy strategy =
+      (N & (N - 1)) == 0 ? kModNPowerOfTwo :
+      N <= 0x100ULL ? kModNTable :
+      N <= 0x100000000ULL ? kModNDivide :
+      N % 2 == 1 ? kModNMontgomery : kModNWide;
+};
+
+template <unsigned long long N>
+static bool tryInvModN(uint64_t a, uint64_t* ret) {
+  long long extgcd[3] = {0};
+  extendedGcd<long long>(a, N, extgcd);
+  if (extgcd[0] != 1) {
+    return false;
+  }
+  *ret = mod<long long>(extgcd[1], N);
+  return true;
+}
+
+// Multiplication and inversion of reduced values mod N.
+template <unsigned long long N, ModNStrategy Strategy = ModNTraits<N>::strategy>
+struct ModNArithmetic;
+
+template <unsigned long long N>
+struct ModNArithmetic<N, kModNPowerOfTwo> {
+  static uint64_t times(uint64_t a, uint64_t b) {
+    // Wrapping mod 2^64 does not change the value mod N.
+    return (a * b) & (N - 1);
+  }
+  static uint64_t timesPlus(uint64_t a, uint64_t b, uint64_t c) {
+    return (a * b + c) & (N - 1);
+  }
+  static bool tryInv(uint64_t a, uint64_t* ret) {
+    return tryInvModN<N>(a, ret);
+  }
+};
+
+template <unsigned long long N>
+struct ModNArithmetic<N, kModNTable> {
+  struct Tables {
+    Tables() {
+      for (unsigned a = 0; a < N; a++) {
+        uint64_t inv;
+        inverse_[a] = tryInvModN<N>(a, &inv) ? static_cast<uint8_t>(inv) : 0;
+        for (unsigned b = 0; b < N; b++) {
+          product_[a][b] = static_cast<uint8_t>(a * b % N);
+        }
+      }
+    }
+    uint8_t product_[N][N];
+    // 0 marks elements without an inverse.
+    uint8_t inverse_[N];
+  };
+  static const Tables& tables() {
+    static const Tables tables;
+    return tables;
+  }
+
+  static uint64_t times(uint64_t a, uint64_t b) {
+    return tables().product_[a][b];
+  }
+  static uint64_t timesPlus(uint64_t a, uint64_t b, uint64_t c) {
+    uint64_t sum = tables().product_[a][b] + c;
+    return sum >= N ? sum - N : sum;
+  }
+  static bool tryInv(uint64_t a, uint64_t* ret) {
+    *ret = tables().inverse_[a];
+    return *ret != 0;
+  }
+};
+
+template <unsigned long long N>
+struct ModNArithmetic<N, kModNDivide> {
+  static uint64_t times(uint64_t a, uint64_t b) {
+    return (a * b) % N;
+  }
+  static uint64_t timesPlus(uint64_t a, uint64_t b, uint64_t c) {
+    // At most (2^32 - 1)^2 + 2^32 - 1, so still no overflow.
+    return (a * b + c) % N;
+  }
+  static bool tryInv(uint64_t a, uint64_t* ret) {
+    return tryInvModN<N>(a, ret);
+  }
+};
+
+template <unsigned long long N>
+struct ModNArithmetic<N, kModNMontgomery> {
+  typedef unsigned __int128 wide;
+
+  static constexpr uint64_t inverse(uint64_t x, int steps) {
+    return steps == 0 ? x : inverse(x * (2 - N * x), steps - 1);
+  }
+  // -N^-1 mod 2^64 and 2^128 mod N, for R = 2^64.
+  static constexpr uint64_t kNegInv = 0 - inverse(N, 5);
+  static constexpr uint64_t kR2 = static_cast<uint64_t>(
+      static_cast<wide>((0 - N) % N) * ((0 - N) % N) % N);
+
+  static uint64_t redc(wide t) {
+    uint64_t m = static_cast<uint64_t>(t) * kNegInv;
+    uint64_t ret = static_cast<uint64_t>((t + static_cast<wide>(m) * N) >> 64);
+    return ret >= N ? ret - N : ret;
+  }
+
+  static uint64_t times(uint64_t a, uint64_t b) {
+    // a * b * R^-1, then times R^2 * R^-1 to land back on a * b, all
+    // without leaving the canonical representation.
+    return redc(static_cast<wide>(redc(static_cast<wide>(a) * b)) * kR2);
+  }
+  static uint64_t timesPlus(uint64_t a, uint64_t b, uint64_t c) {
+    // a * b + c < N^2 + N, still within what redc takes.
+    return redc(static_cast<wide>(redc(static_cast<wide>(a) * b + c)) * kR2);
+  }
+  static bool tryInv(uint64_t a, uint64_t* ret) {
+    return tryInvModN<N>(a, ret);
+  }
+};
+template <unsigned long long N>
+constexpr uint64_t ModNArithmetic<N, kModNMontgomery>::kNegInv;
+template <unsigned long long N>
+constexpr uint64_t ModNArithmetic<N, kModNMontgomery>::kR2;
+
+template <unsigned long long N>
+struct ModNArithmetic<N, kModNWide> {
+  static uint64_t times(uint64_t a, uint64_t b) {
+    return static_cast<uint64_t>(static_cast<unsigned __int128>(a) * b % N);
+  }
+  static uint64_t timesPlus(uint64_t a, uint64_t b, uint64_t c) {
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(a) * b + c) % N);
+  }
+  static bool tryInv(uint64_t a, uint64_t* ret) {
+    return tryInvModN<N>(a, ret);
+  }
+};
+
+// Moves values between an element type and reduced uint64_t's. Plain
+// integer elements may hold anything, so they are reduced on the way in.
+template <unsigned long long N, typename T>
+struct ModNElement {
+  static uint64_t value(const T& a) {
+    if (static_cast<unsigned long long>(a) < N && a >= 0) return a;
+    return mod<long long>(a, N);
+  }
+  static T make(uint64_t value) {
+    return static_cast<T>(value);
+  }
+};
+
+template <unsigned long long N, typename S>
+struct ModNElement<N, Residue<N, S> > {
+  static uint64_t value(const Residue<N, S>& a) {
+    return a.value_;
+  }
+  static Residue<N, S> make(uint64_t value) {
+    return Residue<N, S>::fromReduced(value);
+  }
+};
+
+/**
+ * Integer operations mod N, with N (below 2^63) given at compile time. By
+ * default elements are Residue<N>, stored in the narrowest type that fits,
+ * and products are reduced by ModNArithmetic<N>. A plain integer type can
+ * still be given as T.
+ */
+template <unsigned long long N, typename T=Residue<N> >
 class IntegerModNOps {
+  static_assert(N > 0 && N >> 63 == 0, "modulus must be in [1, 2^63)");
+  typedef ModNElement<N, T> E;
+  typedef ModNArithmetic<N> A;
+
  public:
   IntegerModNOps() {}
 
@@ -36,55 +285,195 @@ class IntegerModNOps {
   typedef T element;
   typedef RingElt<IntegerModNOps<N, T> > ring;
   typedef GroupElt<IntegerModNOps<N, T> > group;
+  typedef FieldElt<IntegerModNOps<N, T> > field;
+
+  static const bool kCommutative = true;
 
   void init(T& a) const {
-    a = mod(a, N);
+    a = E::make(E::value(a));
   }
 
   T zero() const {
-    return 0;
+    return E::make(0);
   }
 
   T id() const {
-    return 1;
+    return E::make(1 % N);
   }
 
   T negate(const T& a) const {
-    return (N - a) % N;
+    uint64_t v = E::value(a);
+    return E::make(v == 0 ? 0 : N - v);
   }
 
   T plus(const T& a, const T& b) const {
-    return (a + b) % N;
+    uint64_t sum = E::value(a) + E::value(b);
+    return E::make(sum >= N ? sum - N : sum);
   }
 
   T times(const T& a, const T& b) const {
-    return (a * b) % N;
+    return E::make(A::times(E::value(a), E::value(b)));
+  }
+
+  // a * b + c with a single reduction; used for fused ring expressions.
+  T timesPlus(const T& a, const T& b, const T& c) const {
+    return E::make(A::timesPlus(E::value(a), E::value(b), E::value(c)));
   }
 
   // This only works for prime N, in groups, when there are no zeroes
   T inv(const T& a) const {
-    T extgcd[3] = {0};
-    extendedGcd(a, N, extgcd);
-    if (extgcd[0] != 1) {
+    T ret;
+    if (!tryInv(a, &ret)) {
       throw "Attempt to invert non-invertible int";
     }
-    return mod(extgcd[1], N);
+    return ret;
+  }
+
+  // Same as inv, but reports a non-invertible a by returning false.
+  bool tryInv(const T& a, T* ret) const {
+    uint64_t inv;
+    if (!A::tryInv(E::value(a), &inv)) {
+      return false;
+    }
+    *ret = E::make(inv);
+    return true;
+  }
+
+  // Inverts all of a at once, see batchInverse in batch.h.
+  void invAll(const std::vector<T>& a, std::vector<T>* out,
+              std::vector<bool>* invertible) const {
+    batchInverse(*this, a, out, invertible);
+  }
+
+  // Element-wise bulk versions of plus and times, plus a dot product. See
+  // ResidueBatch in batch.h; moduli too large for it use plain loops.
+  // Plain integer elements are reduced first, as the scalar ops would.
+  void plusAll(const std::vector<T>& a, const std::vector<T>& b,
+               std::vector<T>* out) const {
+    if (kBatched) {
+      std::vector<T> ra, rb;
+      batch().plus(reduced(a, &ra), reduced(b, &rb), out);
+      return;
+    }
+    if (a.size() != b.size()) throw "Size mismatch";
+    out->resize(a.size());
+    for (size_t i = 0; i < a.size(); i++) (*out)[i] = plus(a[i], b[i]);
+  }
+
+  void timesAll(const std::vector<T>& a, const std::vector<T>& b,
+                std::vector<T>* out) const {
+    if (kBatched) {
+      std::vector<T> ra, rb;
+      batch().times(reduced(a, &ra), reduced(b, &rb), out);
+      return;
+    }
+    if (a.size() != b.size()) throw "Size mismatch";
+    out->resize(a.size());
+    for (size_t i = 0; i < a.size(); i++) (*out)[i] = times(a[i], b[i]);
+  }
+
+  // acc[i] += a[i] * b[i]
+  void timesPlusAll(const std::vector<T>& a, const std::vector<T>& b,
+                    std::vector<T>* acc) const {
+    if (kBatched) {
+      std::vector<T> ra, rb;
+      for (size_t i = 0; i < acc->size(); i++) (*acc)[i] = E::make(E::value((*acc)[i]));
+      batch().timesPlus(reduced(a, &ra), reduced(b, &rb), acc);
+      return;
+    }
+    if (a.size() != b.size() || a.size() != acc->size()) throw "Size mismatch";
+    for (size_t i = 0; i < a.size(); i++) {
+      (*acc)[i] = plus((*acc)[i], times(a[i], b[i]));
+    }
+  }
+
+  void scaleAll(const T& s, const std::vector<T>& a, std::vector<T>* out) const {
+    if (kBatched) {
+      std::vector<T> ra;
+      batch().scale(E::make(E::value(s)), reduced(a, &ra), out);
+      return;
+    }
+    out->resize(a.size());
+    for (size_t i = 0; i < a.size(); i++) (*out)[i] = times(s, a[i]);
+  }
+
+  T dot(const std::vector<T>& a, const std::vector<T>& b) const {
+    if (kBatched) {
+      std::vector<T> ra, rb;
+      return batch().dot(reduced(a, &ra), reduced(b, &rb));
+    }
+    if (a.size() != b.size()) throw "Size mismatch";
+    T ret = zero();
+    for (size_t i = 0; i < a.size(); i++) ret = plus(ret, times(a[i], b[i]));
+    return ret;
+  }
+
+  // Lets matrix products sum in 64 bits and reduce late, see
+  // DelayedReduction in gemm.h.
+  uint64_t modulus() const {
+    return N;
+  }
+
+  uint64_t value(const T& a) const {
+    return E::value(a);
+  }
+
+  T fromValue(uint64_t value) const {
+    return E::make(value);
+  }
+
+  uint64_t reduceSum(uint64_t sum) const {
+    return sum % N;
+  }
+
+ private:
+  static const bool kBatched = N < (1ULL << 31);
+
+  // a itself, unless it holds plain integers outside [0, N), in which case
+  // a reduced copy of it in *scratch. Residue's are always reduced.
+  static const std::vector<T>& reduced(const std::vector<T>& a, std::vector<T>* scratch) {
+    return reduced(a, scratch, std::is_integral<T>());
+  }
+
+  static const std::vector<T>& reduced(const std::vector<T>& a, std::vector<T>*,
+                                       std::false_type) {
+    return a;
+  }
+
+  static const std::vector<T>& reduced(const std::vector<T>& a, std::vector<T>* scratch,
+                                       std::true_type) {
+    size_t i = 0;
+    while (i < a.size() && a[i] >= 0 && static_cast<unsigned long long>(a[i]) < N) i++;
+    if (i == a.size()) return a;
+    scratch->reserve(a.size());
+    for (size_t j = 0; j < a.size(); j++) {
+      scratch->push_back(E::make(E::value(a[j])));
+    }
+    return *scratch;
+  }
+
+  static const ResidueBatch& batch() {
+    static const ResidueBatch batch(kBatched ? N : 1);
+    return batch;
   }
 };
-template <int N, typename T>
+template <unsigned long long N, typename T>
 IntegerModNOps<N, T> IntegerModNOps<N, T>::instance;
 
 template <typename T=int>
 class IntegerModOps {
  public:
-  IntegerModOps(int N) : N(N) {}
+  IntegerModOps(int N) : N(N), reducer_(N), batch_(N) {}
 
   typedef T element;
   typedef RingElt<IntegerModOps<T> > ring;
   typedef GroupElt<IntegerModOps<T> > group;
+  typedef FieldElt<IntegerModOps<T> > field;
+
+  static const bool kCommutative = true;
 
   void init(T& a) const {
-    a = mod(a, N);
+    a = reduce(a);
   }
 
   T zero() const {
@@ -92,30 +481,135 @@ class IntegerModOps {
   }
 
   T id() const {
-    return 1;
+    return 1 % N;
   }
 
   T negate(const T& a) const {
-    return (N - a) % N;
+    return reduce(static_cast<int64_t>(N) - a);
   }
 
   T plus(const T& a, const T& b) const {
-    return (a + b) % N;
+    int64_t sum = static_cast<int64_t>(a) + b;
+    // Both operands are normally reduced already, in which case a single
+    // conditional subtract is enough.
+    if (static_cast<uint64_t>(sum) < 2 * static_cast<uint64_t>(N)) {
+      return static_cast<T>(sum >= N ? sum - N : sum);
+    }
+    return reduce(sum);
   }
 
   T times(const T& a, const T& b) const {
-    return (a * b) % N;
+    return reduce(static_cast<int64_t>(a) * b);
+  }
+
+  // a * b + c with a single reduction; used for fused ring expressions.
+  T timesPlus(const T& a, const T& b, const T& c) const {
+    return reduce(static_cast<int64_t>(a) * b + c);
   }
 
   // This only works for prime N, in groups, when there are no zeroes
   T inv(const T& a) const {
+    T ret;
+    if (!tryInv(a, &ret)) {
+      throw "Attempt to invert non-invertible int";
+    }
+    return ret;
+  }
+
+  // Same as inv, but reports a non-invertible a by returning false.
+  bool tryInv(const T& a, T* ret) const {
     T extgcd[3] = {0};
-    extendedGcd(a, N, extgcd);
+    extendedGcd(a, static_cast<T>(N), extgcd);
     if (extgcd[0] != 1) {
-      throw "Attempt to invert non-invertible int";
+      return false;
+    }
+    *ret = reduce(extgcd[1]);
+    return true;
+  }
+
+  // Inverts all of a at once, see batchInverse in batch.h.
+  void invAll(const std::vector<T>& a, std::vector<T>* out,
+              std::vector<bool>* invertible) const {
+    batchInverse(*this, a, out, invertible);
+  }
+
+  // Element-wise bulk versions of plus and times, plus a dot product. See
+  // ResidueBatch in batch.h; its kernels want elements in [0, N), so
+  // anything else is reduced first, the way the scalar ops would.
+  void plusAll(const std::vector<T>& a, const std::vector<T>& b,
+               std::vector<T>* out) const {
+    std::vector<T> ra, rb;
+    batch_.plus(reduced(a, &ra), reduced(b, &rb), out);
+  }
+
+  void timesAll(const std::vector<T>& a, const std::vector<T>& b,
+                std::vector<T>* out) const {
+    std::vector<T> ra, rb;
+    batch_.times(reduced(a, &ra), reduced(b, &rb), out);
+  }
+
+  // acc[i] += a[i] * b[i]
+  void timesPlusAll(const std::vector<T>& a, const std::vector<T>& b,
+                    std::vector<T>* acc) const {
+    std::vector<T> ra, rb;
+    for (size_t i = 0; i < acc->size(); i++) {
+      (*acc)[i] = reduce((*acc)[i]);
     }
-    return mod(extgcd[1], N);
+    batch_.timesPlus(reduced(a, &ra), reduced(b, &rb), acc);
   }
 
+  void scaleAll(const T& s, const std::vector<T>& a, std::vector<T>* out) const {
+    std::vector<T> ra;
+    batch_.scale(reduce(s), reduced(a, &ra), out);
+  }
+
+  T dot(const std::vector<T>& a, const std::vector<T>& b) const {
+    std::vector<T> ra, rb;
+    return batch_.dot(reduced(a, &ra), reduced(b, &rb));
+  }
+
+  // Lets matrix products sum in 64 bits and reduce late, see
+  // DelayedReduction in gemm.h.
+  uint64_t modulus() const {
+    return N;
+  }
+
+  uint64_t value(const T& a) const {
+    return static_cast<uint64_t>(reduce(a));
+  }
+
+  T fromValue(uint64_t value) const {
+    return static_cast<T>(value);
+  }
+
+  uint64_t reduceSum(uint64_t sum) const {
+    return reducer_.reduce(sum);
+  }
+
+  // N must not be changed after construction, the reducer is built from it.
   int N;
+
+ private:
+  T reduce(int64_t a) const {
+    if (static_cast<uint64_t>(a) < static_cast<uint64_t>(N)) {
+      return static_cast<T>(a);
+    }
+    return static_cast<T>(reducer_.reduce(a));
+  }
+
+  // a itself when it is already reduced, which is the usual case, and
+  // otherwise a reduced copy of it in *scratch.
+  const std::vector<T>& reduced(const std::vector<T>& a, std::vector<T>* scratch) const {
+    size_t i = 0;
+    while (i < a.size() && static_cast<uint64_t>(a[i]) < static_cast<uint64_t>(N)) i++;
+    if (i == a.size()) return a;
+    scratch->reserve(a.size());
+    for (size_t j = 0; j < a.size(); j++) {
+      scratch->push_back(reduce(a[j]));
+    }
+    return *scratch;
+  }
+
+  BarrettReducer reducer_;
+  ResidueBatch batch_;
 };
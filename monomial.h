@@ -32,15 +32,15 @@ template <typename T>
 class Monomial {
  public:
   Monomial() {}
-  Monomial(const Monomial<T>& other) : exponents_(other.exponents_) {}
+  Monomial(const Monomial<T>& other) = default;
+  Monomial(Monomial<T>&& other) = default;
   Monomial(std::initializer_list<T> init) {
     for (auto it = init.begin(); it != init.end(); ++it) {
       *this << *it;
     }
   }
-  void operator=(const Monomial<T>& other) {
-    exponents_ = other.exponents_;
-  }
+  Monomial& operator=(const Monomial<T>& other) = default;
+  Monomial& operator=(Monomial<T>&& other) = default;
 
   bool operator==(const Monomial<T>& other) const {
     if (exponents_.size() != other.exponents_.size()) {
@@ -66,7 +66,9 @@ class Monomial {
     return *this;
   }
   Monomial operator*(const Monomial<T>& other) const {
-    return Monomial(*this) *= other;
+    Monomial ret(*this);
+    ret *= other;
+    return ret;
   }
 
   Monomial& operator<<(const T& term) {
@@ -130,6 +132,8 @@ class MonomialOps {
   typedef SemigroupElt<MonomialOps<T> > semigroup;
   typedef MonoidElt<MonomialOps<T> > monoid;
 
+  static const bool kCommutative = true;
+
   void init(element& a) const {
   }
 
@@ -0,0 +1,205 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <ostream>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+#include "batch.h"
+#include "elements.h"
+#include "math.h"
+
+#pragma once
+
+// A residue kept in Montgomery form, i.e. value_ == x * 2^64 (mod N).
+//
+// Residues built from a plain integer remember that they have not been
+// converted yet; MontgomeryModOps::init converts them exactly once, so
+// re-running init on an already converted value is a no-op.
+class MontgomeryResidue {
+ public:
+  MontgomeryResidue() : value_(0), form_(kMontgomery) {}
+  template <typename I>
+  MontgomeryResidue(I value,
+                    typename std::enable_if<std::is_integral<I>::value>::type* = 0) :
+      value_(static_cast<uint64_t>(value)),
+      form_(std::is_signed<I>::value && value < 0 ? kNegative : kPlain) {}
+
+  static MontgomeryResidue fromMontgomery(uint64_t value) {
+    MontgomeryResidue ret;
+    ret.value_ = value;
+    return ret;
+  }
+
+  bool operator==(const MontgomeryResidue& other) const {
+    return value_ == other.value_ && form_ == other.form_;
+  }
+  bool operator!=(const MontgomeryResidue& other) const {
+    return !(*this == other);
+  }
+
+  enum Form { kMontgomery, kPlain, kNegative };
+
+  uint64_t value_;
+  Form form_;
+};
+namespace std {
+  template <>
+  struct hash<MontgomeryResidue> {
+    size_t operator()(const MontgomeryResidue& r) const {
+      return hash<uint64_t>()(r.value_);
+    }
+  };
+}
+
+// Integer operations mod an odd N < 2^63, given in the constructor. All
+// arithmetic stays in Montgomery form: times is a 64x64->128 multiply
+// followed by a REDC step, and plus/negate are a conditional subtract, so
+// none of them divide. Conversion in happens in init, conversion out in
+// get() (which is what printing uses).
+class MontgomeryModOps {
+ public:
+  typedef unsigned __int128 wide;
+
+  MontgomeryModOps(uint64_t N) : N(N) {
+    if (N % 2 == 0 || N < 3 || N >> 63) {
+      throw "Montgomery modulus must be odd and below 2^63";
+    }
+    // Newton iteration for N^-1 mod 2^64, each step doubles the
+    // number of correct low bits (N * N == 1 mod 8 to start).
+    uint64_t inv = N;
+    for (int i = 0; i < 5; i++) {
+      inv *= 2 - N * inv;
+    }
+    ninv_ = -inv;
+    r1_ = (0 - N) % N;
+    r2_ = static_cast<uint64_t>(static_cast<wide>(r1_) * r1_ % N);
+  }
+
+  typedef MontgomeryResidue element;
+  typedef RingElt<MontgomeryModOps> ring;
+  typedef GroupElt<MontgomeryModOps> group;
+  typedef FieldElt<MontgomeryModOps> field;
+
+  static const bool kCommutative = true;
+
+  void init(element& a) const {
+    a = convert(a);
+  }
+
+  element zero() const {
+    return element::fromMontgomery(0);
+  }
+
+  element id() const {
+    return element::fromMontgomery(r1_);
+  }
+
+  element negate(const element& a) const {
+    uint64_t v = value(a);
+    return element::fromMontgomery(v == 0 ? 0 : N - v);
+  }
+
+  element plus(const element& a, const element& b) const {
+    uint64_t sum = value(a) + value(b);
+    return element::fromMontgomery(sum >= N ? sum - N : sum);
+  }
+
+  element times(const element& a, const element& b) const {
+    return element::fromMontgomery(
+        redc(static_cast<wide>(value(a)) * value(b)));
+  }
+
+  // This only works for prime N, in groups, when there are no zeroes
+  element inv(const element& a) const {
+    element ret;
+    if (!tryInv(a, &ret)) {
+      throw "Attempt to invert non-invertible int";
+    }
+    return ret;
+  }
+
+  // Same as inv, but reports a non-invertible a by returning false.
+  bool tryInv(const element& a, element* ret) const {
+    long long extgcd[3] = {0};
+    extendedGcd<long long>(get(a), N, extgcd);
+    if (extgcd[0] != 1) {
+      return false;
+    }
+    *ret = convert(mod<long long>(extgcd[1], N));
+    return true;
+  }
+
+  // Inverts all of a at once, see batchInverse in batch.h.
+  void invAll(const std::vector<element>& a, std::vector<element>* out,
+              std::vector<bool>* invertible) const {
+    batchInverse(*this, a, out, invertible);
+  }
+
+  // Returns the canonical representative in [0, N).
+  uint64_t get(const element& a) const {
+    return redc(value(a));
+  }
+
+  uint64_t N;
+
+ private:
+  // Computes t * 2^-64 mod N for t < N * 2^64.
+  uint64_t redc(wide t) const {
+    uint64_t m = static_cast<uint64_t>(t) * ninv_;
+    uint64_t ret = static_cast<uint64_t>((t + static_cast<wide>(m) * N) >> 64);
+    return ret >= N ? ret - N : ret;
+  }
+
+  element convert(const element& a) const {
+    if (a.form_ == element::kMontgomery) return a;
+    uint64_t plain;
+    if (a.form_ == element::kNegative) {
+      plain = N - (0 - a.value_) % N;
+      if (plain == N) plain = 0;
+    } else {
+      plain = a.value_ % N;
+    }
+    return element::fromMontgomery(redc(static_cast<wide>(plain) * r2_));
+  }
+
+  // Operands normally arrive already converted; plain integers mixed
+  // into an expression (ring + 5) are converted on the spot.
+  uint64_t value(const element& a) const {
+    if (a.form_ == element::kMontgomery) return a.value_;
+    return convert(a).value_;
+  }
+
+  uint64_t ninv_;
+  uint64_t r1_;
+  uint64_t r2_;
+};
+
+inline std::ostream& operator<<(std::ostream& stream,
+                                const SemigroupElt<MontgomeryModOps>& elt) {
+  stream << elt.ops().get(elt.element_);
+  return stream;
+}
@@ -0,0 +1,370 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#pragma once
+
+// Build with -DALGEBRA_PERF=1 to measure the regions marked with
+// ALGEBRA_PERF_REGION in the library's kernels (matrix and polynomial
+// multiplication, extendedGcd, pow). Otherwise the marks compile to
+// nothing; PerfRegion can still be used directly.
+#ifndef ALGEBRA_PERF
+#define ALGEBRA_PERF 0
+#endif
+
+#define ALGEBRA_PERF_CONCAT2(a, b) a##b
+#define ALGEBRA_PERF_CONCAT(a, b) ALGEBRA_PERF_CONCAT2(a, b)
+#if ALGEBRA_PERF
+#define ALGEBRA_PERF_REGION(name) \
+  static PerfSite ALGEBRA_PERF_CONCAT(perf_site_, __LINE__)(name); \
+  PerfRegion ALGEBRA_PERF_CONCAT(perf_region_, __LINE__)( \
+      ALGEBRA_PERF_CONCAT(perf_site_, __LINE__))
+#else
+#define ALGEBRA_PERF_REGION(name)
+#endif
+
+enum PerfCounter {
+  kPerfCycles,
+  kPerfInstructions,
+  kPerfCacheMisses,
+  kPerfBranchMisses,
+  kPerfCounterCount
+};
+
+static inline const char* perfCounterName(int counter) {
+  static const char* names[kPerfCounterCount] = {
+    "cycles", "instructions", "cache_misses", "branch_misses"
+  };
+  return names[counter];
+}
+
+/**
+ * The calling thread's hardware counters, opened on first use as one
+ * perf_event group so that a single read() gets all of them. Counters the
+ * kernel refuses (no PMU in a VM, perf_event_paranoid, seccomp) are left
+ * out; if even cycles can't be opened, only wall-clock time is measured.
+ * Only user-space events are counted.
+ */
+class PerfCounters {
+ public:
+  static PerfCounters& local() {
+    static thread_local PerfCounters counters;
+    return counters;
+  }
+
+  bool available() const {
+    return leader_ >= 0;
+  }
+
+  bool has(int counter) const {
+    return index_[counter] >= 0;
+  }
+
+  // Current values, 0 for counters that aren't available.
+  void read(uint64_t* values) const {
+    memset(values, 0, sizeof(uint64_t) * kPerfCounterCount);
+#ifdef __linux__
+    if (leader_ < 0) return;
+    uint64_t buf[1 + kPerfCounterCount];
+    ssize_t size = ::read(leader_, buf, sizeof(buf));
+    if (size < static_cast<ssize_t>(sizeof(uint64_t))) return;
+    for (int c = 0; c < kPerfCounterCount; c++) {
+      if (index_[c] >= 0 && static_cast<uint64_t>(index_[c]) < buf[0]) {
+        values[c] = buf[1 + index_[c]];
+      }
+    }
+#endif
+  }
+
+  ~PerfCounters() {
+#ifdef __linux__
+    for (size_t i = 0; i < fds_.size(); i++) close(fds_[i]);
+#endif
+  }
+
+ private:
+  PerfCounters() : leader_(-1) {
+    for (int c = 0; c < kPerfCounterCount; c++) index_[c] = -1;
+#ifdef __linux__
+    static const uint64_t configs[kPerfCounterCount] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    if (getenv("ALGEBRA_PERF_WALL_CLOCK")) return;
+    for (int c = 0; c < kPerfCounterCount; c++) {
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = configs[c];
+      attr.read_format = PERF_FORMAT_GROUP;
+      attr.disabled = leader_ < 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      int fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader_, 0);
+      if (fd < 0) {
+        if (leader_ < 0) return;
+        continue;
+      }
+      if (leader_ < 0) leader_ = fd;
+      index_[c] = fds_.size();
+      fds_.push_back(fd);
+    }
+    ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  void operator=(const PerfCounters&) = delete;
+
+  int leader_;
+  int index_[kPerfCounterCount];
+  std::vector<int> fds_;
+};
+
+/**
+ * Totals for every named region, per thread. Regions with the same name
+ * (e.g. from different template instantiations) are added together.
+ *
+ * If ALGEBRA_PERF_JSON names a file, the totals are written to it as JSON
+ * when the program exits.
+ */
+class PerfRegistry {
+ public:
+  struct Totals {
+    uint64_t calls;
+    uint64_t nanos;
+    // calls made with hardware counters running, and their counts.
+    uint64_t counted;
+    uint64_t counters[kPerfCounterCount];
+  };
+
+  // Never destroyed, so that regions can still report during exit.
+  static PerfRegistry& instance() {
+    static PerfRegistry* registry = new PerfRegistry();
+    return *registry;
+  }
+
+  int region(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = ids_.find(name);
+    if (it != ids_.end()) return it->second;
+    int id = names_.size();
+    names_.push_back(name);
+    ids_[name] = id;
+    return id;
+  }
+
+  Totals& local(int region) {
+    ThreadSlots& slots = threadSlots();
+    if (static_cast<size_t>(region) < slots.totals.size() &&
+        slots.totals[region]) {
+      return *slots.totals[region];
+    }
+    PerfCounters& counters = PerfCounters::local();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int c = 0; c < kPerfCounterCount; c++) {
+      if (counters.has(c)) available_ |= 1 << c;
+    }
+    if (slots.totals.size() <= static_cast<size_t>(region)) {
+      slots.totals.resize(region + 1, NULL);
+    }
+    std::unique_ptr<Totals> totals(new Totals());
+    slots.totals[region] = totals.get();
+    threads_[std::make_pair(region, slots.thread)] = std::move(totals);
+    return *slots.totals[region];
+  }
+
+  // Not safe against threads still measuring.
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = threads_.begin(); it != threads_.end(); ++it) {
+      *it->second = Totals();
+    }
+  }
+
+  /**
+   * {"counters": [...], "regions": [{"name": ..., "calls": ..., "ns": ...,
+   *  "cycles": ..., ..., "threads": [{"thread": 0, ...}, ...]}, ...]}
+   *
+   * "counters" lists the hardware counters some thread could open; counts
+   * only cover the "counted" calls, those made on threads with counters.
+   * Like reset(), this is meant for once the measuring is done.
+   */
+  void writeJson(std::ostream& stream) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stream << "{\"counters\": [";
+    const char* sep = "";
+    for (int c = 0; c < kPerfCounterCount; c++) {
+      if (available_ & (1 << c)) {
+        stream << sep << "\"" << perfCounterName(c) << "\"";
+        sep = ", ";
+      }
+    }
+    stream << "], \"regions\": [";
+    for (size_t region = 0; region < names_.size(); region++) {
+      Totals sum = Totals();
+      std::vector<std::pair<int, const Totals*> > threads;
+      for (auto it = threads_.lower_bound(std::make_pair(region, 0));
+           it != threads_.end() && it->first.first == static_cast<int>(region);
+           ++it) {
+        add(&sum, *it->second);
+        threads.push_back(std::make_pair(it->first.second, it->second.get()));
+      }
+      stream << (region ? ", " : "") << "{\"name\": \"" << names_[region] << "\", ";
+      writeTotals(stream, sum);
+      stream << ", \"threads\": [";
+      for (size_t i = 0; i < threads.size(); i++) {
+        stream << (i ? ", " : "") << "{\"thread\": " << threads[i].first << ", ";
+        writeTotals(stream, *threads[i].second);
+        stream << "}";
+      }
+      stream << "]}";
+    }
+    stream << "]}" << std::endl;
+  }
+
+ private:
+  struct ThreadSlots {
+    int thread;
+    std::vector<Totals*> totals;
+  };
+
+  PerfRegistry() : next_thread_(0), available_(0) {
+    if (getenv("ALGEBRA_PERF_JSON")) atexit(writeAtExit);
+  }
+
+  static void writeAtExit() {
+    std::ofstream out(getenv("ALGEBRA_PERF_JSON"));
+    instance().writeJson(out);
+  }
+
+  ThreadSlots& threadSlots() {
+    static thread_local ThreadSlots slots = {-1, std::vector<Totals*>()};
+    if (slots.thread < 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      slots.thread = next_thread_++;
+    }
+    return slots;
+  }
+
+  static void add(Totals* sum, const Totals& totals) {
+    sum->calls += totals.calls;
+    sum->nanos += totals.nanos;
+    sum->counted += totals.counted;
+    for (int c = 0; c < kPerfCounterCount; c++) {
+      sum->counters[c] += totals.counters[c];
+    }
+  }
+
+  static void writeTotals(std::ostream& stream, const Totals& totals) {
+    stream << "\"calls\": " << totals.calls << ", \"ns\": " << totals.nanos
+           << ", \"counted\": " << totals.counted;
+    for (int c = 0; c < kPerfCounterCount; c++) {
+      stream << ", \"" << perfCounterName(c) << "\": " << totals.counters[c];
+    }
+  }
+
+  std::mutex mutex_;
+  std::vector<std::string> names_;
+  std::map<std::string, int> ids_;
+  // Keyed on (region, thread).
+  std::map<std::pair<int, int>, std::unique_ptr<Totals> > threads_;
+  int next_thread_;
+  // Bit c is set once a thread has had counter c.
+  int available_;
+};
+
+// Where a region is measured; resolves its name once.
+class PerfSite {
+ public:
+  explicit PerfSite(const char* name) :
+      region_(PerfRegistry::instance().region(name)) {}
+
+  int region() const {
+    return region_;
+  }
+
+ private:
+  int region_;
+};
+
+/**
+ * Measures from construction to destruction: wall-clock time, and the
+ * hardware counters when the thread has them, added to the site's region.
+ * Nested regions are included in the ones around them. Reading the
+ * counters is a system call, so regions belong around kernels that take
+ * microseconds, not single element operations.
+ */
+class PerfRegion {
+ public:
+  explicit PerfRegion(const PerfSite& site) :
+      totals_(PerfRegistry::instance().local(site.region())),
+      counters_(PerfCounters::local()) {
+    counters_.read(start_counters_);
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  ~PerfRegion() {
+    auto end = std::chrono::steady_clock::now();
+    uint64_t end_counters[kPerfCounterCount];
+    counters_.read(end_counters);
+    totals_.calls++;
+    totals_.nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        end - start_).count();
+    if (counters_.available()) {
+      totals_.counted++;
+      for (int c = 0; c < kPerfCounterCount; c++) {
+        totals_.counters[c] += end_counters[c] - start_counters_[c];
+      }
+    }
+  }
+
+ private:
+  PerfRegion(const PerfRegion&) = delete;
+  void operator=(const PerfRegion&) = delete;
+
+  PerfRegistry::Totals& totals_;
+  PerfCounters& counters_;
+  std::chrono::steady_clock::time_point start_;
+  uint64_t start_counters_[kPerfCounterCount];
+};
@@ -26,15 +26,33 @@
 #include <unordered_map>
 #include <initializer_list>
 
+#include "perf.h"
+
 #pragma once
 
 template <typename R, typename S>
 class Polynomial {
  public:
   Polynomial() {}
-  Polynomial(const Polynomial<R, S>& other) : components_(other.components_) {}
-  void operator=(const Polynomial<R, S>& other) {
-    components_ = other.components_;
+  Polynomial(const Polynomial<R, S>& other) = default;
+  Polynomial(Polynomial<R, S>&& other) = default;
+  Polynomial& operator=(const Polynomial<R, S>& other) = default;
+  Polynomial& operator=(Polynomial<R, S>&& other) = default;
+
+  // Zero terms are never stored, so equal polynomials have the same terms.
+  bool operator==(const Polynomial<R, S>& other) const {
+    if (components_.size() != other.components_.size()) {
+      return false;
+    }
+    for (auto it = components_.begin(); it != components_.end(); ++it) {
+      auto other_it = other.components_.find(it->first);
+      if (other_it == other.components_.end() || other_it->second != it->second)
+        return false;
+    }
+    return true;
+  }
+  bool operator!=(const Polynomial<R, S>& other) const {
+    return !(*this == other);
   }
 
   Polynomial& operator<<(
@@ -61,7 +79,9 @@ class Polynomial {
     return *this;
   }
   Polynomial operator+(const Polynomial<R, S>& other) const {
-    return Polynomial(*this) += other;
+    Polynomial ret(*this);
+    ret += other;
+    return ret;
   }
 
   Polynomial& operator*=(const Polynomial<R, S>& other) {
@@ -69,6 +89,7 @@ class Polynomial {
     return *this;
   }
   Polynomial operator*(const Polynomial<R, S>& other) const {
+    ALGEBRA_PERF_REGION("Polynomial::operator*");
     // zip([a*b for a in r1 for b in r2],
     //     ["".join(sorted(a+b)) for a in s1 for b in s2])
     //
@@ -108,6 +129,22 @@ class Polynomial {
 
   std::unordered_map<typename S::monoid, typename R::ring> components_;
 };
+namespace std {
+  template <typename R, typename S>
+  struct hash<Polynomial<R, S> > {
+    // Terms come in no particular order, so they are hashed separately
+    // and added up.
+    size_t operator()(const Polynomial<R, S>& poly) const {
+      size_t ret = 0;
+      for (auto it = poly.components_.begin(); it != poly.components_.end(); ++it) {
+        size_t term = hash<typename S::monoid>()(it->first) * 31 +
+            hash<typename R::ring>()(it->second);
+        ret += term * 0x9e3779b97f4a7c15ULL;
+      }
+      return ret;
+    }
+  };
+}
 
 template <typename R, typename S>
 std::ostream& operator<<(std::ostream& stream, const Polynomial<R, S>& poly) {
@@ -133,6 +170,9 @@ class PolynomialOps {
   typedef Polynomial<R, S> element;
   typedef RingElt<PolynomialOps<R, S> > ring;
 
+  static const bool kCommutative =
+      CommutativeOps<R>::value && CommutativeOps<S>::value;
+
   void init(element& a) const {
   }
 
@@ -141,7 +181,11 @@ class PolynomialOps {
   }
 
   element id() const {
-    return element() << std::make_pair(ring_ops_.id(), semigroup_ops_.id());
+    element ret;
+    ret << std::make_pair(
+        typename R::ring(ring_ops_.id(), ring_ops_),
+        typename S::monoid(semigroup_ops_.id(), semigroup_ops_));
+    return ret;
   }
 
   element plus(const element& a, const element& b) const {
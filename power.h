@@ -0,0 +1,493 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "bigint.h"
+
+#pragma once
+
+/**
+ * Exponentiation in any ops structure with times() and id() (and inv()
+ * for the signed variants):
+ *
+ *  - power(ops, base, n): left-to-right sliding window over the bits of n,
+ *    with the window picked from the size of n. It never squares the
+ *    identity, and for small exponents it is plain square-and-multiply.
+ *  - powSigned(ops, base, n): the same over the width-w non-adjacent form
+ *    of n, which has fewer nonzero digits; worth it when inv() is cheap.
+ *  - FixedBasePower: precomputed tables for many powers of one base, so
+ *    that each power costs about bits / window multiplies and no squares.
+ *  - multiPower(ops, bases, exponents): the product of many powers, with
+ *    the squarings shared between all the bases when times() commutes.
+ *
+ * Exponents are uint64_t or BigUnsigned.
+ */
+
+// Whether Ops::times is commutative, which ops declare with a static const
+// bool kCommutative = true. (plus always is.) Reductions over
+// non-commutative ops keep their operands in order.
+template <typename Ops, typename = void>
+struct CommutativeOps : std::false_type {};
+template <typename Ops>
+struct CommutativeOps<Ops, decltype(void(Ops::kCommutative))> :
+    std::integral_constant<bool, Ops::kCommutative> {};
+
+// Read-only bit access to an exponent, as little-endian 32-bit limbs.
+class ExponentBits {
+ public:
+  ExponentBits(uint64_t n) : limbs_(small_), size_(0) {
+    small_[0] = static_cast<uint32_t>(n);
+    small_[1] = static_cast<uint32_t>(n >> 32);
+    size_ = small_[1] ? 2 : small_[0] ? 1 : 0;
+  }
+  ExponentBits(const BigUnsigned& n) :
+      limbs_(n.limbs().data()), size_(n.limbs().size()) {}
+  ExponentBits(const ExponentBits& other) :
+      limbs_(other.limbs_), size_(other.size_) {
+    small_[0] = other.small_[0];
+    small_[1] = other.small_[1];
+    if (other.limbs_ == other.small_) limbs_ = small_;
+  }
+  void operator=(const ExponentBits&) = delete;
+
+  size_t bitLength() const {
+    if (size_ == 0) return 0;
+    return 32 * size_ - __builtin_clz(limbs_[size_ - 1]);
+  }
+
+  bool bit(size_t i) const {
+    return i / 32 < size_ && (limbs_[i / 32] >> (i % 32)) & 1;
+  }
+
+  // Bits [lo, lo + count) as a number, count <= 31.
+  uint32_t bits(size_t lo, int count) const {
+    return static_cast<uint32_t>(word(lo)) & ((1u << count) - 1);
+  }
+
+  // Bits [lo, lo + 64).
+  uint64_t word(size_t lo) const {
+    size_t limb = lo / 32;
+    int shift = lo % 32;
+    uint64_t ret = limb < size_ ? limbs_[limb] : 0;
+    if (limb + 1 < size_) ret |= static_cast<uint64_t>(limbs_[limb + 1]) << 32;
+    ret >>= shift;
+    if (shift && limb + 2 < size_) {
+      ret |= static_cast<uint64_t>(limbs_[limb + 2]) << (64 - shift);
+    }
+    return ret;
+  }
+
+  // Bits [end - 64, end), with zeros for the ones below bit 0; end > 0.
+  uint64_t wordBelow(size_t end) const {
+    return end >= 64 ? word(end - 64) : word(0) << (64 - end);
+  }
+
+ private:
+  uint32_t small_[2];
+  const uint32_t* limbs_;
+  size_t size_;
+};
+
+// The window size that minimizes precomputation plus multiplies for an
+// exponent of the given size.
+static inline int powerWindow(size_t bits) {
+  return bits <= 8 ? 1 : bits <= 24 ? 2 : bits <= 80 ? 3 :
+      bits <= 240 ? 4 : bits <= 672 ? 5 : 6;
+}
+
+// base, base^3, ..., base^(2^window - 1)
+template <typename Ops>
+std::vector<typename Ops::element> oddPowers(
+    const Ops& ops, const typename Ops::element& base, int window) {
+  std::vector<typename Ops::element> ret;
+  size_t count = static_cast<size_t>(1) << (window - 1);
+  ret.reserve(count);
+  ret.push_back(base);
+  if (count > 1) {
+    typename Ops::element square = ops.times(base, base);
+    for (size_t i = 1; i < count; i++) {
+      ret.push_back(ops.times(ret[i - 1], square));
+    }
+  }
+  return ret;
+}
+
+// Calls f(low, value) for each window of the sliding window decomposition
+// of n, from the top down: value is odd, below 2^window, and is bits
+// [low, low + window) of n, with only zero bits in between windows.
+template <typename F>
+void forEachWindow(const ExponentBits& n, int window, F f) {
+  size_t end = n.bitLength();
+  while (end > 0) {
+    uint64_t top = n.wordBelow(end);
+    if (top == 0) {
+      end = end > 64 ? end - 64 : 0;
+      continue;
+    }
+    // Skip to the top set bit, then take the window below it.
+    end -= __builtin_clzll(top);
+    int width = end >= static_cast<size_t>(window) ? window : static_cast<int>(end);
+    uint32_t value = static_cast<uint32_t>(
+        (top << __builtin_clzll(top)) >> (64 - width));
+    int zeros = __builtin_ctz(value);
+    end -= width - zeros;
+    f(end, value >> zeros);
+  }
+}
+
+template <typename Ops>
+typename Ops::element powerWindowed(
+    const Ops& ops, const typename Ops::element& base,
+    const ExponentBits& n, int window) {
+  typedef typename Ops::element T;
+  size_t bits = n.bitLength();
+  if (bits == 0) return ops.id();
+  if (window <= 0) window = powerWindow(bits);
+  std::vector<T> odd = oddPowers(ops, base, window);
+
+  T result = ops.id();
+  bool started = false;
+  size_t last = 0;
+  forEachWindow(n, window, [&](size_t low, uint32_t value) {
+    if (started) {
+      for (size_t k = low; k < last; k++) result = ops.times(result, result);
+      result = ops.times(result, odd[value >> 1]);
+    } else {
+      result = odd[value >> 1];
+      started = true;
+    }
+    last = low;
+  });
+  for (size_t k = 0; k < last; k++) result = ops.times(result, result);
+  return result;
+}
+
+template <typename Ops>
+typename Ops::element power(const Ops& ops, const typename Ops::element& base,
+                            uint64_t n, int window = 0) {
+  return powerWindowed(ops, base, ExponentBits(n), window);
+}
+
+template <typename Ops>
+typename Ops::element power(const Ops& ops, const typename Ops::element& base,
+                            const BigUnsigned& n, int window = 0) {
+  return powerWindowed(ops, base, ExponentBits(n), window);
+}
+
+/**
+ * Width-w non-adjacent form of n: digits d[i] that are 0 or odd with
+ * |d[i]| < 2^(w-1), at most one nonzero in any w consecutive ones, and
+ * n = sum(d[i] * 2^i).
+ */
+static inline std::vector<int32_t> signedDigits(const ExponentBits& n, int window) {
+  std::vector<int32_t> digits;
+  size_t bits = n.bitLength();
+  digits.reserve(bits + 1);
+  // What remains to be recoded is (n >> i) + carry.
+  uint32_t carry = 0;
+  for (size_t i = 0; i < bits || carry; ) {
+    if (((n.bit(i) ? 1 : 0) + carry) % 2 == 0) {
+      carry = ((n.bit(i) ? 1 : 0) + carry) / 2;
+      digits.push_back(0);
+      i++;
+      continue;
+    }
+    int64_t low = static_cast<int64_t>(n.bits(i, window)) + carry;
+    int64_t digit = low & ((1 << window) - 1);
+    if (digit >= (1 << (window - 1))) digit -= 1 << window;
+    carry = static_cast<uint32_t>((low - digit) >> window);
+    digits.push_back(static_cast<int32_t>(digit));
+    for (int k = 1; k < window; k++) digits.push_back(0);
+    i += window;
+  }
+  return digits;
+}
+
+template <typename Ops>
+typename Ops::element powerSignedWindowed(
+    const Ops& ops, const typename Ops::element& base,
+    const ExponentBits& n, int window) {
+  typedef typename Ops::element T;
+  size_t bits = n.bitLength();
+  if (bits == 0) return ops.id();
+  if (window <= 0) window = powerWindow(bits) + 1;
+  if (window < 2) window = 2;
+  std::vector<int32_t> digits = signedDigits(n, window);
+  std::vector<T> odd = oddPowers(ops, base, window - 1);
+  std::vector<T> odd_inv = oddPowers(ops, ops.inv(base), window - 1);
+
+  T result = ops.id();
+  bool started = false;
+  for (size_t i = digits.size(); i-- > 0;) {
+    if (started) result = ops.times(result, result);
+    int32_t d = digits[i];
+    if (d == 0) continue;
+    const T& factor = d > 0 ? odd[d >> 1] : odd_inv[(-d) >> 1];
+    if (started) {
+      result = ops.times(result, factor);
+    } else {
+      result = factor;
+      started = true;
+    }
+  }
+  return result;
+}
+
+template <typename Ops>
+typename Ops::element powSigned(const Ops& ops, const typename Ops::element& base,
+                                uint64_t n, int window = 0) {
+  return powerSignedWindowed(ops, base, ExponentBits(n), window);
+}
+
+template <typename Ops>
+typename Ops::element powSigned(const Ops& ops, const typename Ops::element& base,
+                                const BigUnsigned& n, int window = 0) {
+  return powerSignedWindowed(ops, base, ExponentBits(n), window);
+}
+
+/**
+ * All powers of one base with exponents below 2^max_bits, by a fixed-base
+ * comb: table[i][d] = base^(d * 2^(window * i)), so base^n is the product
+ * of one table entry per window-bit digit of n. Costs
+ * (2^window - 1) * max_bits / window elements; the ops must outlive it.
+ */
+template <typename Ops>
+class FixedBasePower {
+  typedef typename Ops::element T;
+ public:
+  FixedBasePower(const Ops& ops, const T& base, size_t max_bits = 64,
+                 int window = 4) :
+      ops_(ops), window_(window), max_bits_(max_bits) {
+    if (window < 1 || window > 16) throw "Bad FixedBasePower window";
+    size_t digits = (static_cast<size_t>(1) << window) - 1;
+    size_t blocks = (max_bits + window - 1) / window;
+    table_.reserve(digits * blocks);
+    T block_base = base;
+    for (size_t i = 0; i < blocks; i++) {
+      table_.push_back(block_base);
+      for (size_t d = 1; d < digits; d++) {
+        table_.push_back(ops.times(table_.back(), block_base));
+      }
+      if (i + 1 < blocks) block_base = ops.times(table_.back(), block_base);
+    }
+  }
+
+  T pow(uint64_t n) const {
+    return pow(ExponentBits(n));
+  }
+
+  T pow(const BigUnsigned& n) const {
+    return pow(ExponentBits(n));
+  }
+
+ private:
+  T pow(const ExponentBits& n) const {
+    size_t bits = n.bitLength();
+    if (bits > max_bits_) throw "Exponent too large for FixedBasePower";
+    size_t digits = (static_cast<size_t>(1) << window_) - 1;
+    T result = ops_.id();
+    bool started = false;
+    for (size_t i = 0; i * window_ < bits; i++) {
+      uint32_t d = n.bits(i * window_, window_);
+      if (d == 0) continue;
+      const T& factor = table_[i * digits + d - 1];
+      if (started) {
+        result = ops_.times(result, factor);
+      } else {
+        result = factor;
+        started = true;
+      }
+    }
+    return result;
+  }
+
+  const Ops& ops_;
+  int window_;
+  size_t max_bits_;
+  std::vector<T> table_;
+};
+
+// The fixed window for Straus over exponents of the given size, which
+// minimizes the table size plus the multiplies per base.
+static inline int strausWindow(size_t bits) {
+  int best = 1;
+  for (int w = 2; w <= 8; w++) {
+    if ((1 << w) - 2 + (bits + w - 1) / w <
+        static_cast<size_t>((1 << best) - 2) + (bits + best - 1) / best) {
+      best = w;
+    }
+  }
+  return best;
+}
+
+// Straus: a table of base^1 ... base^(2^w - 1) per base, and one walk
+// down the exponents w bits at a time, so that every base shares the one
+// chain of squarings. (Fixed rather than sliding windows: finding the
+// sliding windows costs more than the multiplies it saves when the
+// elements are small.)
+template <typename Ops>
+typename Ops::element multiPowerStraus(
+    const Ops& ops, const std::vector<typename Ops::element>& bases,
+    const std::vector<ExponentBits>& exponents, size_t max_bits) {
+  typedef typename Ops::element T;
+  int window = strausWindow(max_bits);
+  size_t digits = (static_cast<size_t>(1) << window) - 1;
+  std::vector<T> table;
+  table.reserve(bases.size() * digits);
+  for (size_t i = 0; i < bases.size(); i++) {
+    table.push_back(bases[i]);
+    for (size_t d = 1; d < digits; d++) {
+      table.push_back(ops.times(table.back(), bases[i]));
+    }
+  }
+
+  T result = ops.id();
+  bool started = false;
+  for (size_t w = (max_bits + window - 1) / window; w-- > 0;) {
+    if (started) {
+      for (int s = 0; s < window; s++) result = ops.times(result, result);
+    }
+    for (size_t i = 0; i < bases.size(); i++) {
+      uint32_t d = exponents[i].bits(w * window, window);
+      if (d == 0) continue;
+      const T& factor = table[i * digits + d - 1];
+      if (started) {
+        result = ops.times(result, factor);
+      } else {
+        result = factor;
+        started = true;
+      }
+    }
+  }
+  return result;
+}
+
+// Pippenger: per window of c bits, drop each base into the bucket for its
+// digit, then the product of bucket[d]^d is a running product of running
+// products, 2^(c+1) multiplies however many bases there are.
+template <typename Ops>
+typename Ops::element multiPowerPippenger(
+    const Ops& ops, const std::vector<typename Ops::element>& bases,
+    const std::vector<ExponentBits>& exponents, size_t max_bits, int c) {
+  typedef typename Ops::element T;
+  size_t count = (static_cast<size_t>(1) << c) - 1;
+  std::vector<T> buckets(count, ops.id());
+  std::vector<char> filled(count);
+
+  T result = ops.id();
+  bool started = false;
+  for (size_t w = (max_bits + c - 1) / c; w-- > 0;) {
+    if (started) {
+      for (int s = 0; s < c; s++) result = ops.times(result, result);
+    }
+    std::fill(filled.begin(), filled.end(), 0);
+    for (size_t i = 0; i < bases.size(); i++) {
+      uint32_t d = exponents[i].bits(w * c, c);
+      if (d == 0) continue;
+      if (filled[d - 1]) {
+        buckets[d - 1] = ops.times(buckets[d - 1], bases[i]);
+      } else {
+        buckets[d - 1] = bases[i];
+        filled[d - 1] = 1;
+      }
+    }
+    // running = bucket[d] * ... * bucket[top], and the window's product
+    // collects one running per d.
+    T running = ops.id(), sum = ops.id();
+    bool have_running = false, have_sum = false;
+    for (size_t d = count; d > 0; d--) {
+      if (filled[d - 1]) {
+        running = have_running ? ops.times(running, buckets[d - 1]) : buckets[d - 1];
+        have_running = true;
+      }
+      if (have_running) {
+        sum = have_sum ? ops.times(sum, running) : running;
+        have_sum = true;
+      }
+    }
+    if (have_sum) {
+      result = started ? ops.times(result, sum) : sum;
+      started = true;
+    }
+  }
+  return result;
+}
+
+// The Pippenger window for k bases and exponents of the given size, or 0
+// for Straus. Straus's multiplies count double: they all feed the one
+// result, where Pippenger's bucket products are independent and overlap.
+static inline int pippengerWindow(size_t k, size_t bits) {
+  int window = strausWindow(bits);
+  double windows = static_cast<double>((bits + window - 1) / window);
+  double best = 2.0 * (static_cast<double>(bits) +
+      static_cast<double>(k) * ((1 << window) - 2 + windows));
+  int ret = 0;
+  for (int c = 2; c <= 16; c++) {
+    windows = static_cast<double>((bits + c - 1) / c);
+    double cost = static_cast<double>(bits) +
+        windows * (static_cast<double>(k) + 2.0 * (1 << c));
+    if (cost < best) {
+      best = cost;
+      ret = c;
+    }
+  }
+  return ret;
+}
+
+/**
+ * bases[0]^exponents[0] * ... * bases[k-1]^exponents[k-1], by Straus
+ * interleaving for a few bases and Pippenger's buckets for many. Both
+ * reorder the product, so ops that are not CommutativeOps get one power()
+ * per base instead, multiplied in order. Exponents are uint64_t or
+ * BigUnsigned.
+ */
+template <typename Ops, typename N>
+typename Ops::element multiPower(const Ops& ops,
+                                 const std::vector<typename Ops::element>& bases,
+                                 const std::vector<N>& exponents) {
+  if (bases.size() != exponents.size()) throw "multiPower size mismatch";
+  if (!CommutativeOps<Ops>::value) {
+    if (bases.empty()) return ops.id();
+    typename Ops::element result = power(ops, bases[0], exponents[0]);
+    for (size_t i = 1; i < bases.size(); i++) {
+      result = ops.times(result, power(ops, bases[i], exponents[i]));
+    }
+    return result;
+  }
+  std::vector<ExponentBits> bits;
+  bits.reserve(exponents.size());
+  size_t max_bits = 0;
+  for (size_t i = 0; i < exponents.size(); i++) {
+    bits.emplace_back(exponents[i]);
+    max_bits = std::max(max_bits, bits.back().bitLength());
+  }
+  if (max_bits == 0) return ops.id();
+  int c = pippengerWindow(bases.size(), max_bits);
+  if (c > 0) return multiPowerPippenger(ops, bases, bits, max_bits, c);
+  return multiPowerStraus(ops, bases, bits, max_bits);
+}
@@ -34,15 +34,14 @@ class Rational {
     if (denom == 0) throw "div by zero";
     normalize_();
   }
-  Rational(const Rational<T>& other) :
-      numerator_(other.numerator_), denominator_(other.denominator_) {}
-  void operator=(const Rational<T>& other) {
-    numerator_ = other.numerator_;
-    denominator_ = other.denominator_;
-  }
-  void operator=(const T& num) {
+  Rational(const Rational<T>& other) = default;
+  Rational(Rational<T>&& other) = default;
+  Rational& operator=(const Rational<T>& other) = default;
+  Rational& operator=(Rational<T>&& other) = default;
+  Rational& operator=(const T& num) {
     numerator_ = num;
     denominator_ = 1;
+    return *this;
   }
 
   bool operator==(const Rational<T>& other) const {
@@ -70,7 +69,7 @@ class Rational {
     return Rational(*this) *= other;
   }
 
-  Rational<T> operator-() {
+  Rational<T> operator-() const {
     return Rational(-numerator_, denominator_);
   }
 
@@ -0,0 +1,156 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "elements.h"
+#include "threadpool.h"
+
+#pragma once
+
+/**
+ * product(begin, end) and sum(begin, end) over a random access range of
+ * elements (GroupElt's, RingElt's, ...), computed as a balanced tree on a
+ * ThreadPool rather than a left fold. The tree also keeps the operands of
+ * each step of similar size, where a fold drags an ever bigger result
+ * along: summing n polynomials copies O(n log n) terms instead of O(n^2).
+ *
+ * Products over ops that are not CommutativeOps keep the order: the range
+ * is split in halves recursively, and each half's result is combined with
+ * its sibling's. Sums, and products over commutative ops, instead combine
+ * each chunk's result with whichever other partial result of the same
+ * size is already done, so no thread waits on a slow sibling.
+ *
+ * Empty ranges throw, since there is no ops to take the identity from.
+ */
+
+// The balanced tree over [begin, begin + count) on the calling thread.
+template <typename Elt, typename Iter, typename Combine>
+Elt reduceSerial(Iter begin, size_t count, const Combine& combine) {
+  if (count == 1) return *begin;
+  size_t half = count / 2;
+  Elt left = reduceSerial<Elt>(begin, half, combine);
+  Elt right = reduceSerial<Elt>(begin + half, count - half, combine);
+  return combine(left, right);
+}
+
+template <typename Elt, typename Iter, typename Combine>
+Elt reduceOrdered(Iter begin, size_t count, size_t grain,
+                  const Combine& combine, ThreadPool& pool) {
+  if (count <= grain) return reduceSerial<Elt>(begin, count, combine);
+  size_t half = count / 2;
+  std::unique_ptr<Elt> left;
+  TaskGroup group(pool);
+  group.run([&]() {
+    left.reset(new Elt(reduceOrdered<Elt>(begin, half, grain, combine, pool)));
+  });
+  Elt right = reduceOrdered<Elt>(begin + half, count - half, grain, combine, pool);
+  group.wait();
+  return combine(*left, right);
+}
+
+template <typename Elt, typename Iter, typename Combine>
+Elt reduceUnordered(Iter begin, size_t count, size_t grain,
+                    const Combine& combine, ThreadPool& pool) {
+  // Finished partial results wait in waiting[level], one per level, where
+  // a partial at level l covers 2^l chunks: a chunk that finishes takes
+  // the partial of its own level if there is one, combines, and moves up
+  // a level, until it finds its level free and leaves its result there.
+  // So only partials of about the same size are combined, as in a
+  // balanced tree, like carries in a binary counter.
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Elt> > waiting(64);
+  TaskGroup group(pool);
+  for (size_t start = 0; start < count; start += grain) {
+    size_t size = std::min(grain, count - start);
+    group.run([&, start, size]() {
+      std::unique_ptr<Elt> result(
+          new Elt(reduceSerial<Elt>(begin + start, size, combine)));
+      for (size_t level = 0; ; level++) {
+        std::unique_ptr<Elt> other;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!waiting[level]) {
+            waiting[level] = std::move(result);
+            return;
+          }
+          other = std::move(waiting[level]);
+        }
+        result.reset(new Elt(combine(*other, *result)));
+      }
+    });
+  }
+  group.wait();
+  // What's left is at most one partial per level, smallest first.
+  std::unique_ptr<Elt> ret;
+  for (size_t level = 0; level < waiting.size(); level++) {
+    if (!waiting[level]) continue;
+    if (!ret) {
+      ret = std::move(waiting[level]);
+    } else {
+      ret.reset(new Elt(combine(*waiting[level], *ret)));
+    }
+  }
+  return std::move(*ret);
+}
+
+template <typename Iter, typename Combine>
+typename std::iterator_traits<Iter>::value_type
+reduceRange(Iter begin, Iter end, bool commutative, const Combine& combine,
+            ThreadPool& pool) {
+  typedef typename std::iterator_traits<Iter>::value_type Elt;
+  if (begin == end) throw "Reduction of an empty range";
+  size_t count = end - begin;
+  // A few chunks per thread (counting the caller, which helps), for the
+  // stealing to even out.
+  size_t grain = count / (4 * (pool.size() + 1));
+  if (grain < 1) grain = 1;
+  if (commutative) return reduceUnordered<Elt>(begin, count, grain, combine, pool);
+  return reduceOrdered<Elt>(begin, count, grain, combine, pool);
+}
+
+template <typename Iter>
+typename std::iterator_traits<Iter>::value_type
+product(Iter begin, Iter end, ThreadPool& pool = ThreadPool::shared()) {
+  typedef typename std::iterator_traits<Iter>::value_type Elt;
+  typedef typename std::decay<decltype(begin->ops())>::type Ops;
+  return reduceRange(begin, end, CommutativeOps<Ops>::value,
+                     [](const Elt& a, const Elt& b) -> Elt { return a * b; },
+                     pool);
+}
+
+template <typename Iter>
+typename std::iterator_traits<Iter>::value_type
+sum(Iter begin, Iter end, ThreadPool& pool = ThreadPool::shared()) {
+  typedef typename std::iterator_traits<Iter>::value_type Elt;
+  return reduceRange(begin, end, true,
+                     [](const Elt& a, const Elt& b) -> Elt { return a + b; },
+                     pool);
+}
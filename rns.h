@@ -0,0 +1,312 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "batch.h"
+#include "bigint.h"
+#include "crt.h"
+#include "elements.h"
+#include "math.h"
+#include "threadpool.h"
+
+#pragma once
+
+// A number as its residues mod each of K moduli.
+template <int K>
+struct RnsNumber {
+  bool operator==(const RnsNumber<K>& other) const {
+    for (int i = 0; i < K; i++) {
+      if (residues_[i] != other.residues_[i]) return false;
+    }
+    return true;
+  }
+  bool operator!=(const RnsNumber<K>& other) const {
+    return !(*this == other);
+  }
+
+  uint32_t residues_[K];
+};
+namespace std {
+  template <int K>
+  struct hash<RnsNumber<K> > {
+    size_t operator()(const RnsNumber<K>& n) const {
+      size_t ret = 0;
+      for (int i = 0; i < K; i++) {
+        ret *= 31;
+        ret += hash<uint32_t>()(n.residues_[i]);
+      }
+      return ret;
+    }
+  };
+}
+
+static inline std::string wideToString(unsigned __int128 x) {
+  std::string digits;
+  do {
+    digits.insert(digits.begin(), static_cast<char>('0' + static_cast<int>(x % 10)));
+    x /= 10;
+  } while (x != 0);
+  return digits;
+}
+
+/**
+ * K pairwise coprime moduli, each below 2^32: a CrtBasis (crt.h) with the
+ * size fixed at compile time, so it has everything CRT needs precomputed.
+ */
+template <int K>
+class RnsBasis {
+ public:
+  RnsBasis(std::initializer_list<uint32_t> moduli) : crt_(checkSize(moduli)) {}
+
+  uint32_t modulus(int i) const {
+    return crt_.modulus(i);
+  }
+
+  const BarrettReducer& reducer(int i) const {
+    return crt_.reducer(i);
+  }
+
+  // Whether the product of the moduli, and so every reconstruction, fits
+  // in 128 bits.
+  bool fitsWide() const {
+    return crt_.fitsWide();
+  }
+
+  const BigUnsigned& product() const {
+    return crt_.product();
+  }
+
+  // The number in [0, product()) with the given residues; requires
+  // fitsWide().
+  unsigned __int128 reconstruct(const uint32_t* residues) const {
+    return crt_.reconstructWide(residues);
+  }
+
+  BigUnsigned reconstructBig(const uint32_t* residues) const {
+    return crt_.reconstruct(residues);
+  }
+
+  const CrtBasis& crt() const {
+    return crt_;
+  }
+
+ private:
+  static std::vector<uint32_t> checkSize(std::initializer_list<uint32_t> moduli) {
+    if (moduli.size() != K) throw "Wrong number of RNS moduli";
+    return std::vector<uint32_t>(moduli);
+  }
+
+  CrtBasis crt_;
+};
+
+/**
+ * The ring Z/(m[0] * ... * m[K-1]) in residue number system form: every
+ * operation works on each channel independently, with no carries between
+ * them, and CRT reconstruction only happens when a value is asked for
+ * (get() or getBig(), or printing).
+ *
+ * Elements are built with encode() or fromResidues(), since a plain
+ * integer cannot be reduced without the basis.
+ */
+template <int K>
+class RnsOps {
+ public:
+  RnsOps(std::initializer_list<uint32_t> moduli) : basis_(moduli) {
+    initBatches();
+  }
+  RnsOps(const RnsBasis<K>& basis) : basis_(basis) {
+    initBatches();
+  }
+
+  typedef RnsNumber<K> element;
+  typedef RingElt<RnsOps<K> > ring;
+
+  static const bool kCommutative = true;
+
+  void init(element& a) const {
+  }
+
+  element encode(long long x) const {
+    element ret;
+    for (int i = 0; i < K; i++) {
+      ret.residues_[i] = static_cast<uint32_t>(basis_.reducer(i).reduce(
+          static_cast<int64_t>(x)));
+    }
+    return ret;
+  }
+
+  element fromResidues(std::initializer_list<uint32_t> residues) const {
+    if (residues.size() != K) throw "Wrong number of residues";
+    element ret;
+    int i = 0;
+    for (auto it = residues.begin(); it != residues.end(); ++it, i++) {
+      ret.residues_[i] = static_cast<uint32_t>(
+          basis_.reducer(i).reduce(static_cast<uint64_t>(*it)));
+    }
+    return ret;
+  }
+
+  element zero() const {
+    return encode(0);
+  }
+
+  element id() const {
+    return encode(1);
+  }
+
+  element negate(const element& a) const {
+    element ret;
+    for (int i = 0; i < K; i++) {
+      uint32_t m = basis_.modulus(i);
+      ret.residues_[i] = a.residues_[i] == 0 ? 0 : m - a.residues_[i];
+    }
+    return ret;
+  }
+
+  element plus(const element& a, const element& b) const {
+    element ret;
+    for (int i = 0; i < K; i++) {
+      ret.residues_[i] = plusChannel(i, a.residues_[i], b.residues_[i]);
+    }
+    return ret;
+  }
+
+  element times(const element& a, const element& b) const {
+    element ret;
+    for (int i = 0; i < K; i++) {
+      ret.residues_[i] = timesChannel(i, a.residues_[i], b.residues_[i]);
+    }
+    return ret;
+  }
+
+  // Element-wise bulk versions of plus and times. Each channel of a block
+  // of elements is gathered into an array and run through that modulus'
+  // ResidueBatch kernel (batch.h), AVX2 or AVX-512 where the CPU has
+  // them; moduli of 2^31 and up, which ResidueBatch doesn't take, use the
+  // scalar loop. Blocks are split over threads as options allow.
+  void plusAll(const std::vector<element>& a, const std::vector<element>& b,
+               std::vector<element>* out,
+               const ParallelOptions& options = ParallelOptions::defaults()) const {
+    apply(a, b, out, &ResidueBatch::plus, &RnsOps<K>::plusChannel, options);
+  }
+
+  void timesAll(const std::vector<element>& a, const std::vector<element>& b,
+                std::vector<element>* out,
+                const ParallelOptions& options = ParallelOptions::defaults()) const {
+    apply(a, b, out, &ResidueBatch::times, &RnsOps<K>::timesChannel, options);
+  }
+
+  unsigned __int128 get(const element& a) const {
+    return basis_.reconstruct(a.residues_);
+  }
+
+  BigUnsigned getBig(const element& a) const {
+    return basis_.reconstructBig(a.residues_);
+  }
+
+  const RnsBasis<K>& basis() const {
+    return basis_;
+  }
+
+ private:
+  typedef void (ResidueBatch::*Kernel)(const uint32_t*, const uint32_t*, uint32_t*,
+                                       size_t) const;
+  typedef uint32_t (RnsOps<K>::*Channel)(int, uint32_t, uint32_t) const;
+
+  // Elements per gathered block: a few KB of residues per channel.
+  static const size_t kBlock = 512;
+
+  void initBatches() {
+    for (int i = 0; i < K; i++) {
+      if (basis_.modulus(i) >> 31 == 0) {
+        batches_[i] = std::make_shared<const ResidueBatch>(basis_.modulus(i));
+      }
+    }
+  }
+
+  uint32_t plusChannel(int i, uint32_t x, uint32_t y) const {
+    uint64_t sum = static_cast<uint64_t>(x) + y;
+    uint32_t m = basis_.modulus(i);
+    return static_cast<uint32_t>(sum >= m ? sum - m : sum);
+  }
+
+  uint32_t timesChannel(int i, uint32_t x, uint32_t y) const {
+    return static_cast<uint32_t>(basis_.reducer(i).reduce(static_cast<uint64_t>(x) * y));
+  }
+
+  void apply(const std::vector<element>& a, const std::vector<element>& b,
+             std::vector<element>* out, Kernel kernel, Channel channel,
+             const ParallelOptions& options) const {
+    if (a.size() != b.size()) throw "Size mismatch";
+    size_t count = a.size();
+    out->resize(count);
+    size_t blocks = (count + kBlock - 1) / kBlock;
+    parallelFor(blocks, kBlock * K, [&](size_t first, size_t last) {
+      uint32_t xs[kBlock], ys[kBlock], zs[kBlock];
+      for (size_t block = first; block < last; block++) {
+        size_t begin = block * kBlock;
+        size_t size = count - begin;
+        if (size > kBlock) size = kBlock;
+        for (int i = 0; i < K; i++) {
+          if (!batches_[i]) {
+            for (size_t j = 0; j < size; j++) {
+              (*out)[begin + j].residues_[i] = (this->*channel)(
+                  i, a[begin + j].residues_[i], b[begin + j].residues_[i]);
+            }
+            continue;
+          }
+          for (size_t j = 0; j < size; j++) {
+            xs[j] = a[begin + j].residues_[i];
+            ys[j] = b[begin + j].residues_[i];
+          }
+          ((*batches_[i]).*kernel)(xs, ys, zs, size);
+          for (size_t j = 0; j < size; j++) {
+            (*out)[begin + j].residues_[i] = zs[j];
+          }
+        }
+      }
+    }, options);
+  }
+
+  RnsBasis<K> basis_;
+  // A kernel per channel, null for moduli ResidueBatch doesn't take.
+  std::shared_ptr<const ResidueBatch> batches_[K];
+};
+
+template <int K>
+std::ostream& operator<<(std::ostream& stream, const SemigroupElt<RnsOps<K> >& elt) {
+  if (elt.ops().basis().fitsWide()) {
+    stream << wideToString(elt.ops().get(elt.element_));
+  } else {
+    stream << elt.ops().getBig(elt.element_);
+  }
+  return stream;
+}
@@ -0,0 +1,265 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "gemm.h"
+
+#pragma once
+
+/**
+ * Scratch space for strassen(), a stack frame per level of the recursion.
+ * It is sized for the whole recursion before it starts, and only ever
+ * grows, so once it has been used for a size, products of that size don't
+ * allocate.
+ */
+template <typename T>
+class StrassenWorkspace {
+ public:
+  void reserve(size_t count, const T& zero) {
+    if (buffer_.size() < count) buffer_.resize(count, zero);
+  }
+
+  T* at(size_t offset) {
+    return buffer_.data() + offset;
+  }
+
+  // Workspaces for threads to borrow, so that a strassen() that runs
+  // inside another one's wait (see TaskGroup) gets its own.
+  static std::unique_ptr<StrassenWorkspace> acquire() {
+    std::vector<std::unique_ptr<StrassenWorkspace> >& free = freeList();
+    if (free.empty()) return std::unique_ptr<StrassenWorkspace>(new StrassenWorkspace());
+    std::unique_ptr<StrassenWorkspace> ret = std::move(free.back());
+    free.pop_back();
+    return ret;
+  }
+
+  static void release(std::unique_ptr<StrassenWorkspace> workspace) {
+    freeList().push_back(std::move(workspace));
+  }
+
+ private:
+  static std::vector<std::unique_ptr<StrassenWorkspace> >& freeList() {
+    static thread_local std::vector<std::unique_ptr<StrassenWorkspace> > free;
+    return free;
+  }
+
+  std::vector<T> buffer_;
+};
+
+// out = x + y, or x - y, over rows x cols views.
+template <typename Ops, typename X, typename Y, typename Out>
+static void addBlocks(const Ops& ops, int rows, int cols, const X& x, const Y& y,
+                      const Out& out) {
+  for (int i = 0; i < rows; i++)
+    for (int j = 0; j < cols; j++)
+      out(i, j) = ops.plus(x(i, j), y(i, j));
+}
+
+template <typename Ops, typename X, typename Y, typename Out>
+static void subtractBlocks(const Ops& ops, int rows, int cols, const X& x, const Y& y,
+                           const Out& out) {
+  for (int i = 0; i < rows; i++)
+    for (int j = 0; j < cols; j++)
+      out(i, j) = ops.plus(x(i, j), ops.negate(y(i, j)));
+}
+
+/**
+ * c = a * b by Strassen-Winograd: 7 half-size products and 15 additions
+ * per level instead of 8 products, down to crossover, below which gemm()
+ * takes over. The additions are scheduled as in Boyer, Dumas, Pernet and
+ * Zhou, "Memory efficient scheduling of Strassen-Winograd's matrix
+ * multiplication algorithm" (2009), so that each level needs only two
+ * temporaries besides c. Odd rows, columns and inner indices are peeled
+ * off and done with gemm().
+ *
+ * It needs plus, negate and times, and nothing of the ring beyond
+ * associativity, so noncommutative rings are fine. It does reassociate
+ * sums, which floating point can't take; DenseMatrix only uses it for
+ * exact rings (see StrassenRing).
+ *
+ * This is the recursion, whose workspace must already hold
+ * strassenWorkspaceSize() elements past used; the overload without one
+ * borrows a workspace for the calling thread.
+ */
+template <typename Ops, typename A, typename B, typename C>
+static void strassen(const Ops& ops, int m, int n, int k, const A& a, const B& b,
+                     const C& c, int crossover,
+                     StrassenWorkspace<typename Ops::element>* workspace, size_t used) {
+  typedef typename Ops::element T;
+  typedef RawView<T> Raw;
+  crossover = std::max(crossover, 2);
+  if (m <= crossover || n <= crossover || k <= crossover) {
+    gemm(ops, m, n, k, a, b, c);
+    return;
+  }
+  int hm = m / 2, hn = n / 2, hk = k / 2;
+  size_t x_size = static_cast<size_t>(hm) * std::max(hk, hn);
+  size_t y_size = static_cast<size_t>(hk) * hn;
+  T* scratch = workspace->at(used);
+  used += x_size + y_size;
+  // X holds m/2 x k/2 sums of a's blocks, then the product P1; Y holds
+  // k/2 x n/2 sums of b's blocks.
+  Raw xs(scratch, hk), xp(scratch, hn), y(scratch + x_size, hn);
+  A a11 = a, a12 = a.block(0, hk), a21 = a.block(hm, 0), a22 = a.block(hm, hk);
+  B b11 = b, b12 = b.block(0, hn), b21 = b.block(hk, 0), b22 = b.block(hk, hn);
+  C c11 = c, c12 = c.block(0, hn), c21 = c.block(hm, 0), c22 = c.block(hm, hn);
+
+  subtractBlocks(ops, hm, hk, a11, a21, xs);                     // S3
+  subtractBlocks(ops, hk, hn, b22, b12, y);                      // T3
+  strassen(ops, hm, hn, hk, xs, y, c21, crossover, workspace, used);  // P7
+  addBlocks(ops, hm, hk, a21, a22, xs);                          // S1
+  subtractBlocks(ops, hk, hn, b12, b11, y);                      // T1
+  strassen(ops, hm, hn, hk, xs, y, c22, crossover, workspace, used);  // P5
+  subtractBlocks(ops, hk, hn, b22, y, y);                        // T2
+  subtractBlocks(ops, hm, hk, xs, a11, xs);                      // S2
+  strassen(ops, hm, hn, hk, xs, y, c12, crossover, workspace, used);  // P6
+  subtractBlocks(ops, hm, hk, a12, xs, xs);                      // S4
+  strassen(ops, hm, hn, hk, xs, b22, c11, crossover, workspace, used);  // P3
+  strassen(ops, hm, hn, hk, a11, b11, xp, crossover, workspace, used);  // P1
+  addBlocks(ops, hm, hn, xp, c12, c12);                          // U2 = P1 + P6
+  addBlocks(ops, hm, hn, c12, c21, c21);                         // U3 = U2 + P7
+  addBlocks(ops, hm, hn, c12, c22, c12);                         // U4 = U2 + P5
+  addBlocks(ops, hm, hn, c21, c22, c22);                         // U7 = U3 + P5
+  addBlocks(ops, hm, hn, c12, c11, c12);                         // U5 = U4 + P3
+  subtractBlocks(ops, hk, hn, y, b21, y);                        // T4
+  strassen(ops, hm, hn, hk, a22, y, c11, crossover, workspace, used);  // P4
+  subtractBlocks(ops, hm, hn, c21, c11, c21);                    // U6 = U3 - P4
+  strassen(ops, hm, hn, hk, a12, b21, c11, crossover, workspace, used);  // P2
+  addBlocks(ops, hm, hn, xp, c11, c11);                          // U1 = P1 + P2
+
+  // The odd inner index, then the odd column and row.
+  if (k % 2) {
+    gemm(ops, 2 * hm, 2 * hn, 1, a.block(0, k - 1), b.block(k - 1, 0), c, true);
+  }
+  if (n % 2) {
+    gemm(ops, m, 1, k, a, b.block(0, n - 1), c.block(0, n - 1));
+  }
+  if (m % 2) {
+    gemm(ops, 1, 2 * hn, k, a.block(m - 1, 0), b, c.block(m - 1, 0));
+  }
+}
+
+// The scratch space strassen() needs: two temporaries per level.
+static inline size_t strassenWorkspaceSize(int m, int n, int k, int crossover) {
+  crossover = std::max(crossover, 2);
+  size_t ret = 0;
+  for (; m > crossover && n > crossover && k > crossover; m /= 2, n /= 2, k /= 2) {
+    ret += static_cast<size_t>(m / 2) * std::max(k / 2, n / 2) +
+        static_cast<size_t>(k / 2) * (n / 2);
+  }
+  return ret;
+}
+
+template <typename Ops, typename A, typename B, typename C>
+static void strassen(const Ops& ops, int m, int n, int k, const A& a, const B& b,
+                     const C& c, int crossover) {
+  typedef StrassenWorkspace<typename Ops::element> Workspace;
+  std::unique_ptr<Workspace> workspace = Workspace::acquire();
+  workspace->reserve(strassenWorkspaceSize(m, n, k, crossover), ops.zero());
+  strassen(ops, m, n, k, a, b, c, crossover, workspace.get(), 0);
+  Workspace::release(std::move(workspace));
+}
+
+// Whether DenseMatrix products over Ops may use strassen(): the ops have
+// negate, and the elements aren't floating point.
+template <typename Ops, typename = void>
+struct StrassenRing : std::false_type {};
+template <typename Ops>
+struct StrassenRing<Ops, decltype(void(std::declval<const Ops&>().negate(
+    std::declval<const typename Ops::element&>())))> :
+    std::integral_constant<bool,
+        !std::is_floating_point<typename Ops::element>::value> {};
+
+// The largest size that still goes straight to gemm(), measured on one
+// core. The word kernel is fast enough that a level of recursion only
+// breaks even from 1000 to about 1600 mod 1000003, and gains at 2048
+// (0.81s instead of 1.08s), so only products past 1024 recurse. Products of
+// general elements gain from 128 on, and recursing down to halves of 64
+// beats stopping at 128 (BasicOps<long long> at 512: 0.15s, 0.18s, and
+// 0.21s for gemm(); at 1024: 0.67s, 0.72s and 1.6s).
+static const int kStrassenWordCrossover = 1024;
+static const int kStrassenCrossover = 64;
+
+template <typename Ops>
+static int strassenCrossover(const Ops& ops, std::true_type) {
+  return ops.modulus() >> 32 == 0 ? kStrassenWordCrossover : kStrassenCrossover;
+}
+
+template <typename Ops>
+static int strassenCrossover(const Ops&, std::false_type) {
+  return kStrassenCrossover;
+}
+
+template <typename Ops>
+static int strassenCrossover(const Ops& ops) {
+  return strassenCrossover(ops, DelayedReduction<Ops>());
+}
+
+/**
+ * c = a * b (or c += a * b, if accumulate), by strassen() for big products
+ * over exact rings and by gemm() otherwise. This is what DenseMatrix's
+ * operator* and the elimination in elimination.h use.
+ */
+template <typename Ops, typename A, typename B, typename C>
+static void matrixProduct(const Ops& ops, int m, int n, int k, const A& a, const B& b,
+                          const C& c, bool accumulate, std::true_type) {
+  int crossover = strassenCrossover(ops);
+  if (m <= crossover || n <= crossover || k <= crossover) {
+    gemm(ops, m, n, k, a, b, c, accumulate);
+  } else if (!accumulate) {
+    strassen(ops, m, n, k, a, b, c, crossover);
+  } else {
+    // The product goes at the front of the workspace, and the recursion's
+    // temporaries after it.
+    typedef typename Ops::element T;
+    typedef StrassenWorkspace<T> Workspace;
+    size_t size = static_cast<size_t>(m) * n;
+    std::unique_ptr<Workspace> workspace = Workspace::acquire();
+    workspace->reserve(size + strassenWorkspaceSize(m, n, k, crossover), ops.zero());
+    T* product = workspace->at(0);
+    strassen(ops, m, n, k, a, b, RawView<T>(product, n), crossover, workspace.get(), size);
+    for (int i = 0; i < m; i++)
+      for (int j = 0; j < n; j++)
+        c(i, j) = ops.plus(c(i, j), product[static_cast<size_t>(i) * n + j]);
+    Workspace::release(std::move(workspace));
+  }
+}
+
+template <typename Ops, typename A, typename B, typename C>
+static void matrixProduct(const Ops& ops, int m, int n, int k, const A& a, const B& b,
+                          const C& c, bool accumulate, std::false_type) {
+  gemm(ops, m, n, k, a, b, c, accumulate);
+}
+
+template <typename Ops, typename A, typename B, typename C>
+static void matrixProduct(const Ops& ops, int m, int n, int k, const A& a, const B& b,
+                          const C& c, bool accumulate = false) {
+  matrixProduct(ops, m, n, k, a, b, c, accumulate, StrassenRing<Ops>());
+}
@@ -22,21 +22,133 @@
  * THE SOFTWARE.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
 #include <utility>
+#include <vector>
+
+#include <unistd.h>
 
 #include "elements.h"
 #include "basic.h"
+#include "bareiss.h"
+#include "cached.h"
+#include "crt.h"
+#include "instrumented.h"
 #include "matrix.h"
+#include "logtable.h"
 #include "modn.h"
+#include "montgomery.h"
 #include "monomial.h"
 #include "polynomial.h"
 #include "rational.h"
+#include "reduce.h"
+#include "rns.h"
 #include "trace.h"
 #include "word.h"
 
 using namespace std;
 
+// Counts heap allocations, to check that arithmetic on elements moves
+// results around rather than copying them. (noinline keeps GCC from
+// matching up the malloc/free inside with new/delete at the call sites.)
+// Atomic since pool threads allocate too.
+static std::atomic<size_t> allocations(0);
+
+__attribute__((noinline)) void* operator new(size_t size) {
+  allocations++;
+  void* ret = malloc(size);
+  if (!ret) throw std::bad_alloc();
+  return ret;
+}
+
+__attribute__((noinline)) void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+// A width x height matrix of pseudo-random entries below bound.
+template <typename Ops>
+static DenseMatrix<Ops> randomMatrix(const Ops& ops, int width, int height,
+                                     uint64_t bound, uint64_t seed) {
+  typedef typename Ops::ring ring;
+  DenseMatrix<Ops> ret(width, height, ring(ops.zero(), ops));
+  for (size_t i = 0; i < ret.elements_.size(); i++) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    ret.elements_[i] = ring(static_cast<typename Ops::element>((seed >> 32) % bound), ops);
+  }
+  return ret;
+}
+
+// Whether gemm(), which at these sizes packs panels and runs the kernels
+// (WordGemm's for ops with DelayedReduction, GenericGemm's otherwise),
+// agrees with the plain triple loop in gemmDirect.
+template <typename Ops>
+static bool gemmAgrees(const Ops& ops, int m, int n, int k, uint64_t bound) {
+  typedef typename Ops::ring ring;
+  DenseMatrix<Ops> a = randomMatrix(ops, k, m, bound, 1);
+  DenseMatrix<Ops> b = randomMatrix(ops, n, k, bound, 2);
+  DenseMatrix<Ops> c(n, m, ring(ops.zero(), ops)), d = c;
+  gemm(ops, m, n, k, EltView<const ring>(a.elements_.data(), k),
+       EltView<const ring>(b.elements_.data(), n), EltView<ring>(c.elements_.data(), n));
+  gemmDirect(ops, m, n, k, EltView<const ring>(a.elements_.data(), k),
+             EltView<const ring>(b.elements_.data(), n),
+             EltView<ring>(d.elements_.data(), n), false);
+  return c == d;
+}
+
+// Whether strassen() (via matrixProduct, at sizes past the crossover) gives
+// gemm()'s m x n product, and its sum with what c held before when
+// accumulating.
+// Checks the bulk ops against the scalar ones, on elements made from
+// values that may be negative or at least the modulus.
+template <typename Ops>
+static bool bulkAgrees(const Ops& ops, const std::vector<long long>& values) {
+  typedef typename Ops::element T;
+  std::vector<T> a, b, acc;
+  for (size_t i = 0; i < values.size(); i++) {
+    a.push_back(T(values[i]));
+    b.push_back(T(values[values.size() - 1 - i]));
+  }
+  acc = a;
+  std::vector<T> sums, products, scaled, fused = acc;
+  ops.plusAll(a, b, &sums);
+  ops.timesAll(a, b, &products);
+  ops.scaleAll(b[0], a, &scaled);
+  ops.timesPlusAll(a, b, &fused);
+  T dot = ops.zero();
+  for (size_t i = 0; i < a.size(); i++) {
+    if (sums[i] != ops.plus(a[i], b[i]) || products[i] != ops.times(a[i], b[i]) ||
+        scaled[i] != ops.times(b[0], a[i]) ||
+        fused[i] != ops.plus(acc[i], ops.times(a[i], b[i]))) {
+      return false;
+    }
+    dot = ops.plus(dot, ops.times(a[i], b[i]));
+  }
+  return ops.dot(a, b) == dot;
+}
+
+template <typename Ops>
+static bool strassenAgrees(const Ops& ops, int m, int n, int k, uint64_t bound) {
+  typedef typename Ops::ring ring;
+  DenseMatrix<Ops> a = randomMatrix(ops, k, m, bound, 7);
+  DenseMatrix<Ops> b = randomMatrix(ops, n, k, bound, 8);
+  DenseMatrix<Ops> c = randomMatrix(ops, n, m, bound, 9), d = c;
+  EltView<const ring> a_view(a.elements_.data(), k), b_view(b.elements_.data(), n);
+  bool ret = true;
+  for (bool accumulate : {false, true}) {
+    matrixProduct(ops, m, n, k, a_view, b_view, EltView<ring>(c.elements_.data(), n),
+                  accumulate);
+    gemm(ops, m, n, k, a_view, b_view, EltView<ring>(d.elements_.data(), n), accumulate);
+    ret = ret && c == d;
+  }
+  return ret;
+}
+
 int main(int argc, char** argv) {
 
   typedef IntegerModNOps<5>::ring Mod5Ring;
@@ -54,6 +166,15 @@ int main(int argc, char** argv) {
   std::cout << id - 3 << std::endl;
   std::cout << -(id - 3) << std::endl;
 
+  // Stateless ops are not stored in their elements.
+  std::cout << "sizeof(Mod5Ring) = " << sizeof(Mod5Ring)
+            << ", sizeof(ModRing) = " << sizeof(ModRing) << std::endl;
+
+  // Evaluated in one go, with the products fused into the sums.
+  IntegerModOps<> mod13(13);
+  ModRing a(3, mod13), b(5, mod13), c(7, mod13), d(11, mod13), e(2, mod13);
+  ModRing fused = a * b + c * d - e;
+  std::cout << "3*5 + 7*11 - 2 = " << fused << " (mod13)" << std::endl;
 
   typedef IntegerModNOps<11>::group Mod5Group;
   Mod5Group elt = 1;
@@ -61,6 +182,94 @@ int main(int argc, char** argv) {
     std::cout << elt << " * " << 1 / elt << " = 1 (mod11)" << std::endl;
   }
 
+  typedef IntegerModNOps<11>::element Mod11;
+  std::vector<Mod11> xs {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  std::vector<Mod11> ys {10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+  std::vector<Mod11> zs;
+  IntegerModNOps<11>::instance.timesAll(xs, ys, &zs);
+  for (size_t i = 0; i < zs.size(); i++) {
+    std::cout << xs[i] << " * " << ys[i] << " = " << zs[i] << " (mod11)" << std::endl;
+  }
+  std::cout << "xs . ys = " << IntegerModNOps<11>::instance.dot(xs, ys)
+            << " (mod11)" << std::endl;
+  IntegerModOps<> mod7(7);
+  std::vector<int> us {1, 2, 3, 4, 5, 6, 0};
+  std::vector<int> vs {3, 3, 3, 3, 3, 3, 6};
+  std::vector<int> ws;
+  mod7.plusAll(us, vs, &ws);
+  std::cout << "us + vs =";
+  for (size_t i = 0; i < ws.size(); i++) {
+    std::cout << " " << ws[i];
+  }
+  std::cout << " (mod7)" << std::endl;
+  // Unreduced inputs give what the scalar ops would.
+  std::vector<int> raw {10, -3, 100000}, threes {3, 3, 3};
+  mod7.timesAll(raw, threes, &ws);
+  std::cout << "raw * threes = " << ws[0] << " " << ws[1] << " " << ws[2] << " = "
+            << mod7.times(10, 3) << " " << mod7.times(-3, 3) << " "
+            << mod7.times(100000, 3) << ", raw . threes = " << mod7.dot(raw, threes)
+            << " (mod7)" << std::endl;
+  // And with the modulus given at compile time, over each ModNStrategy
+  // that has bulk ops, with plain integers that need reducing.
+  std::vector<long long> unreduced {10, -3, 100000, -123456789012LL,
+                                    98765432109LL, 6000000000LL, 4294967311LL};
+  std::cout << "bulk ops agree with scalar ops: mod 7 (int) "
+            << bulkAgrees(IntegerModNOps<7, int>::instance, unreduced)
+            << ", Montgomery " << bulkAgrees(IntegerModNOps<4294967311ULL>::instance, unreduced)
+            << " (long long) "
+            << bulkAgrees(IntegerModNOps<4294967311ULL, long long>::instance, unreduced)
+            << ", wide " << bulkAgrees(IntegerModNOps<6000000000ULL>::instance, unreduced)
+            << " (long long) "
+            << bulkAgrees(IntegerModNOps<6000000000ULL, long long>::instance, unreduced)
+            << std::endl;
+
+  typedef IntegerModNOps<11>::field Mod11Field;
+  std::vector<Mod11Field> row {3, 0, 5, 10};
+  std::vector<bool> invertible = invAll(&row);
+  for (size_t i = 0; i < row.size(); i++) {
+    if (invertible[i]) {
+      std::cout << "1 / " << Mod11Field(1) / row[i] << " = " << row[i] << " (mod11)" << std::endl;
+    } else {
+      std::cout << "element " << i << " is not invertible (mod11)" << std::endl;
+    }
+  }
+
+  DiscreteLogModOps<> logs101(101);
+  typedef DiscreteLogModOps<>::field LogField;
+  LogField three(3, logs101);
+  std::cout << "generator of (Z/101)* = " << logs101.table().generator() << std::endl;
+  std::cout << three << "^100 = " << (three ^ 100) << ", " << three << "^-1 = "
+            << (three ^ -1) << ", " << three << " * 34 = " << three * 34
+            << " (mod101)" << std::endl;
+  std::vector<int> log_row {0, 3, 100}, log_inverses;
+  std::vector<bool> log_invertible;
+  logs101.invAll(log_row, &log_inverses, &log_invertible);
+  std::cout << "inverses of 0, 3, 100: " << log_invertible[0] << " "
+            << log_inverses[1] << " " << log_inverses[2] << " (mod101)" << std::endl;
+  // A saved table maps back with the same logs and powers.
+  char log_path[] = "/tmp/logtableXXXXXX";
+  int log_fd = mkstemp(log_path);
+  if (log_fd < 0) {
+    std::cout << "cannot create " << log_path << std::endl;
+    return 1;
+  }
+  close(log_fd);
+  std::shared_ptr<const DiscreteLogTable> built = DiscreteLogTable::forPrime(10007);
+  built->save(log_path);
+  std::shared_ptr<const DiscreteLogTable> mapped = DiscreteLogTable::map(log_path);
+  unlink(log_path);
+  bool same_tables = mapped->p() == built->p() && mapped->generator() == built->generator();
+  for (uint32_t a = 0; a < built->p(); a++) {
+    same_tables = same_tables && mapped->log(a) == built->log(a);
+  }
+  for (uint32_t k = 0; k <= 4 * (built->p() - 1); k++) {
+    same_tables = same_tables && mapped->exp(k) == built->exp(k);
+  }
+  DiscreteLogModOps<> mapped_ops(mapped);
+  std::cout << "mapped table for " << mapped->p() << " matches the built one: "
+            << same_tables << ", 1234 * 5678 = " << mapped_ops.times(1234, 5678)
+            << " (mod10007)" << std::endl;
+
   typedef DenseMatrixNSpace<5, IntegerModNOps<5> > GL5Mod5Space;
 
   typedef GL5Mod5Space::group GL5Mod5;
@@ -84,10 +293,206 @@ int main(int argc, char** argv) {
 
   std::cout << mat << std::endl;
 
+  size_t before = allocations;
   mat = mat * mat;
+  std::cout << "mat = mat * mat: " << allocations - before
+            << " allocation(s)" << std::endl;
 
   std::cout << mat << std::endl;
 
+  // Matrices don't commute, so the product keeps them in order: with two
+  // shears that don't commute, any reordering changes the result.
+  GL5Mod5 shear_up = GL5Mod5Space::instance.id(), shear_down = shear_up;
+  shear_up.element_[0][1] = 1;
+  shear_down.element_[1][0] = 1;
+  std::vector<GL5Mod5> mats;
+  for (int i = 0; i < 100; i++) {
+    mats.push_back(i % 3 == 2 ? mat_id : i % 2 ? shear_down : shear_up);
+  }
+  GL5Mod5 folded = mats[0];
+  for (size_t i = 1; i < mats.size(); i++) folded = folded * mats[i];
+  ThreadPool four_threads(4);
+  std::cout << "product of 100 matrices matches the left fold: "
+            << (product(mats.begin(), mats.end()) == folded) << " "
+            << (product(mats.begin(), mats.end(), four_threads) == folded) << std::endl;
+  std::vector<Mod11Field> units(1000, 3);
+  std::cout << "3^1000 = " << product(units.begin(), units.end())
+            << " (mod11)" << std::endl;
+  // Sums combine partials of equal size, whichever thread finishes first.
+  std::cout << "3 * 1000 = " << sum(units.begin(), units.end(), four_threads)
+            << " (mod11)" << std::endl;
+
+  // Count what a matrix product costs in element operations.
+  typedef InstrumentedOps<IntegerModOps<> > CountedMod13;
+  typedef DenseMatrixNSpace<3, CountedMod13> GL3Mod13Space;
+  CountedMod13 counted(mod13, "mod13");
+  GL3Mod13Space gl3mod13(counted);
+  GL3Mod13Space::ring counted_mat(gl3mod13.id(), gl3mod13);
+  counted_mat.element_[0][1] = CountedMod13::ring(5, counted);
+#if ALGEBRA_INSTRUMENT
+  counted.stats().reset();
+  counted_mat = counted_mat * counted_mat;
+  OpStats::Counts counts = counted.stats().total();
+  std::cout << "3x3 matrix product:";
+  for (int op = 0; op < kOpCount; op++) {
+    if (counts.calls[op]) {
+      std::cout << " " << counts.calls[op] << " " << instrumentedOpName(op);
+    }
+  }
+  std::cout << std::endl;
+  // Two wrappers used in turn on one thread each count their own calls.
+  CountedMod13 other_counted(mod13, "other mod13");
+  for (int i = 0; i < 1000; i++) {
+    counted.times(3, 4);
+    other_counted.times(3, 4);
+    other_counted.plus(3, 4);
+  }
+  std::cout << "alternating wrappers: "
+            << counted.stats().total().calls[kOpTimes] - counts.calls[kOpTimes] << " "
+            << other_counted.stats().total().calls[kOpTimes] << " times, "
+            << other_counted.stats().total().calls[kOpPlus] << " plus" << std::endl;
+#endif
+
+  // Powers of the same matrix repeat the same squarings.
+  typedef CachedOps<GL5Mod5Space> CachedGL5Mod5Space;
+  CachedGL5Mod5Space cached_gl5(GL5Mod5Space::instance, 1 << 20);
+  CachedGL5Mod5Space::ring cached_mat(mat_id.element_, cached_gl5);
+  for (int n = 100; n < 110; n++) {
+    cached_mat ^ n;
+  }
+  CacheStats cache_stats = cached_gl5.stats();
+  std::cout << "10 matrix powers: " << cache_stats.hits << " cache hits, "
+            << cache_stats.misses << " misses" << std::endl;
+
+  // GL(N) elements invert by Gaussian elimination (elimination.h), which
+  // also gives rank, det, solve and nullspace for any matrix over a field.
+  GL5Mod5 mat_inv = mat_id ^ -1;
+  std::cout << "mat_id^-1:" << std::endl << mat_inv << std::endl
+            << "mat_id^-1 * mat_id:" << std::endl << mat_inv * mat_id.element_
+            << std::endl;
+  DenseMatrix<IntegerModNOps<5> > singular = mat_id.element_;
+  for (int i = 0; i < 5; i++) {
+    singular[i][4] = singular[i][0] + singular[i][1] * 2;
+  }
+  std::cout << "rank " << matrixRank(singular) << ", det " << det(singular)
+            << ", nullspace:" << std::endl << nullspace(singular) << std::endl;
+
+  // Over the integers and rationals, elimination has to be exact: either
+  // fraction-free (Bareiss), or mod several primes put back together.
+  typedef BasicOps<long long> LongOps;
+  typedef BasicOps<Rational<long long> > RationalOps;
+  DenseMatrix<LongOps> int_mat = denseMatrix(LongOps::instance, 3, 3,
+      std::vector<long long> {2, -1, 0, -1, 2, -1, 0, -1, 2});
+  std::cout << "det " << bareissDet(int_mat) << " = " << modularDet(int_mat)
+            << std::endl;
+  DenseMatrix<RationalOps> q_mat = denseMatrix(RationalOps::instance, 2, 2,
+      std::vector<Rational<long long> > {Rational<long long>(1, 2), 1,
+                                         Rational<long long>(1, 3), 1});
+  DenseMatrix<RationalOps> q_rhs = denseMatrix(RationalOps::instance, 1, 2,
+      std::vector<Rational<long long> > {1, Rational<long long>(2, 3)});
+  std::cout << "solve:" << std::endl << bareissSolve(q_mat, q_rhs)
+            << "=" << std::endl << modularSolve(q_mat, q_rhs) << std::endl;
+  // Right-hand sides far bigger than det(a), and a determinant that fits
+  // although the rows' lcm's times it don't.
+  DenseMatrix<LongOps> nine = denseMatrix(LongOps::instance, 1, 1, std::vector<long long> {9});
+  DenseMatrix<LongOps> big_rhs = denseMatrix(LongOps::instance, 1, 1,
+                                             std::vector<long long> {2689459});
+  DenseMatrix<LongOps> huge_rhs = denseMatrix(LongOps::instance, 1, 1,
+                                              std::vector<long long> {1LL << 50});
+  std::cout << "2689459 / 9 = " << modularSolve(nine, big_rhs)[0][0] << " = "
+            << bareissSolve(nine, big_rhs)[0][0] << ", 2^50 * 9 / 9 = "
+            << modularSolve(nine, huge_rhs * nine)[0][0] << std::endl;
+  Rational<long long> big_q(1LL << 40, (1LL << 40) - 1), small_q(1, (1LL << 40) - 1);
+  std::cout << "det " << modularDet(denseMatrix(RationalOps::instance, 2, 2,
+      std::vector<Rational<long long> > {big_q, small_q, small_q, big_q})) << std::endl;
+  // A determinant near 2^93, far past long long but 5 mod the product of
+  // the first three primes, throws rather than coming back as 5.
+  DenseMatrix<LongOps> past_primes = denseMatrix(LongOps::instance, 2, 2,
+      std::vector<long long> {1LL << 47, 138076756116610LL, 1, 70368741523457LL});
+  for (int modular = 0; modular < 2; modular++) {
+    try {
+      long long det = modular ? modularDet(past_primes) : bareissDet(past_primes);
+      std::cout << "det " << det;
+    } catch (const char* error) {
+      std::cout << (modular ? "modularDet: " : "bareissDet: ") << error;
+    }
+    std::cout << std::endl;
+  }
+
+  // Products past kGemmDirectLimit go through the packed kernels; near
+  // 2^32 WordGemm can only add one product at a time before reducing.
+  typedef IntegerModNOps<4294967291ULL> ModBig;
+  std::cout << "packed gemm agrees with the triple loop:"
+            << " mod 1000003 " << gemmAgrees(IntegerModNOps<1000003>::instance,
+                                               67, 70, 300, 1000003)
+            << ", mod 2^32 - 5 " << gemmAgrees(ModBig::instance, 64, 65, 66, 4294967291ULL)
+            << ", long long " << gemmAgrees(BasicOps<long long>::instance, 65, 64, 70, 1000)
+            << std::endl;
+
+  // Odd sizes past the crossover peel a row, column or inner index off at
+  // each level of the recursion.
+  std::cout << "strassen agrees with gemm: "
+            << strassenAgrees(BasicOps<long long>::instance, 257, 259, 261, 1000)
+            << std::endl;
+
+  // Products, sums and scalings come out the same however many threads
+  // they are split over.
+  typedef DenseMatrix<IntegerModNOps<1000003> > ModMatrix;
+  typedef DenseMatrix<BasicOps<double> > DoubleMatrix;
+  ModMatrix mod_a = randomMatrix(IntegerModNOps<1000003>::instance, 200, 200, 1000003, 3);
+  ModMatrix mod_b = randomMatrix(IntegerModNOps<1000003>::instance, 200, 200, 1000003, 4);
+  DoubleMatrix double_a = randomMatrix(BasicOps<double>::instance, 200, 200, 1000, 5);
+  DoubleMatrix double_b = randomMatrix(BasicOps<double>::instance, 200, 200, 1000, 6);
+  double_a *= BasicOps<double>::ring(0.1);
+  double_b *= BasicOps<double>::ring(1 / 3.0);
+  ParallelOptions saved_options = ParallelOptions::defaults();
+  ThreadPool matrix_pool(3);
+  std::vector<ModMatrix> mod_results;
+  std::vector<DoubleMatrix> double_results;
+  for (int threads : {1, 7}) {
+    ParallelOptions::defaults().pool = &matrix_pool;
+    ParallelOptions::defaults().threads = threads;
+    ParallelOptions::defaults().grain = 1 << 10;
+    mod_results.push_back(mod_a * mod_b);
+    mod_results.back() += mod_a;
+    double_results.push_back(double_a * double_b);
+    double_results.back() += double_a;
+    double_results.back() *= BasicOps<double>::ring(0.7);
+  }
+  ParallelOptions::defaults() = saved_options;
+  std::cout << "1 thread == 7 threads: mod 1000003 "
+            << (mod_results[0] == mod_results[1]) << ", double "
+            << (double_results[0] == double_results[1]) << std::endl;
+
+  // Past kEliminationBlock, Pluq recurses, and its triangular solves and
+  // updates are matrix products.
+  typedef IntegerModNOps<1000003> BigField;
+  ModMatrix big_a = randomMatrix(BigField::instance, 150, 150, 1000003, 10);
+  ModMatrix big_b = randomMatrix(BigField::instance, 3, 150, 1000003, 11);
+  ModMatrix big_id(150, 150, BigField::ring(0));
+  for (int i = 0; i < 150; i++) big_id[i][i] = BigField::ring(1);
+  // Rank 100: the product of 150 x 100 and 100 x 150 factors, with
+  // columns 40 to 74 copies of 0 to 34, so that the left half's pivots run
+  // out early and the right half's have to be moved in front.
+  ModMatrix low_rank = randomMatrix(BigField::instance, 100, 150, 1000003, 12) *
+      randomMatrix(BigField::instance, 150, 100, 1000003, 13);
+  for (int i = 0; i < 150; i++) {
+    for (int j = 40; j < 75; j++) low_rank[i][j] = low_rank[i][j - 40];
+  }
+  ModMatrix low_b = low_rank * randomMatrix(BigField::instance, 2, 150, 1000003, 14);
+  ModMatrix kernel = nullspace(low_rank);
+  std::cout << "150 x 150 mod 1000003: a * a^-1 == 1 " << (big_a * inverse(big_a) == big_id)
+            << ", a * solve(a, b) == b " << (big_a * solve(big_a, big_b) == big_b)
+            << ", rank " << matrixRank(low_rank) << ", low_rank * solve == b "
+            << (low_rank * solve(low_rank, low_b) == low_b) << ", low_rank * nullspace == 0 "
+            << (low_rank * kernel == ModMatrix(kernel.width_, 150, BigField::ring(0)))
+            << " (" << kernel.width_ << " columns)" << std::endl;
+  // denseMatrix reduces what it's given, like any element.
+  IntegerModOps<> mod5(5);
+  std::cout << "denseMatrix reduces: "
+            << (denseMatrix(mod5, 2, 2, std::vector<int> {7, 0, 0, -1}) ==
+                denseMatrix(mod5, 2, 2, std::vector<int> {2, 0, 0, 4})) << std::endl;
+
   // This doesn't work :( There needs to be a conversion between
   // Mod5Ring and IntRing inside of the matrix
   //mat = GL5(mat_id.element_);
@@ -128,5 +533,151 @@ int main(int argc, char** argv) {
   rat = rat + Rational<>(1, 6);
   std::cout << rat << std::endl;
 
+  // 2^62 - 57 is prime
+  MontgomeryModOps mont(4611686018427387847ULL);
+  typedef MontgomeryModOps::ring MontRing;
+  MontRing big(4611686018427387800LL, mont), small(-3, mont);
+  std::cout << big << " * " << small << " = " << big * small << std::endl;
+  std::cout << big << " + " << small << " = " << big + small << std::endl;
+  std::cout << "1 / " << small << " = "
+            << MontgomeryModOps::group(small, mont).inv() << std::endl;
+
+  // Fermat, with exponents past 64 bits and from a fixed-base table.
+  BigUnsigned order(4611686018427387846ULL);
+  FixedBasePower<MontgomeryModOps> small_powers(mont, small, 64);
+  std::cout << small << "^(p-1)^2 = " << (small ^ order * order)
+            << ", " << small << "^(p-1) = "
+            << mont.get(small_powers.pow(4611686018427387846ULL)) << std::endl;
+  // Signed-digit powers match plain ones at every window, including
+  // exponents of all ones, whose recoding carries past the top bit.
+  BigUnsigned all_ones_64(0xFFFFFFFFFFFFFFFFULL);
+  std::vector<BigUnsigned> signed_exponents {
+      1, 2, 3, 7, 0x7FFF, 0xAAAAAAAAAAAAAAABULL, 0xBFFFFFFFFFFFFFFFULL,
+      all_ones_64, order * order, all_ones_64 * all_ones_64 + all_ones_64 + all_ones_64};
+  bool signed_agree = true;
+  for (size_t i = 0; i < signed_exponents.size(); i++) {
+    uint64_t expected = mont.get(power(mont, small, signed_exponents[i]));
+    for (int window = 2; window <= 7; window++) {
+      signed_agree = signed_agree &&
+          mont.get(powSigned(mont, small, signed_exponents[i], window)) == expected;
+    }
+    signed_agree = signed_agree &&
+        mont.get(powSigned(mont, small, signed_exponents[i])) == expected;
+  }
+  uint64_t top_digits = 0xFFFFFFFFFFFFFFFFULL;
+  std::cout << "powSigned agrees with power: " << signed_agree << ", "
+            << small << "^(2^64 - 1) = " << mont.get(powSigned(mont, small, top_digits, 5))
+            << " = " << mont.get(power(mont, small, top_digits)) << std::endl;
+
+  typedef IntegerModNOps<101>::group Mod101Group;
+  std::vector<Mod101Group> gs {2, 3, 5};
+  std::vector<int> es {5, -2, 7};
+  std::cout << "2^5 * 3^-2 * 5^7 = " << multiPow(gs, es) << " = "
+            << (gs[0] ^ 5) * (gs[1] ^ -2) * (gs[2] ^ 7) << " (mod101)" << std::endl;
+  // Enough bases for Pippenger's buckets.
+  typedef IntegerModNOps<1000003>::group Mod1000003Group;
+  std::vector<Mod1000003Group> many_bases;
+  std::vector<uint64_t> many_exponents;
+  Mod1000003Group many_expected = 1;
+  uint64_t pow_state = 12345;
+  for (int i = 0; i < 200; i++) {
+    pow_state = pow_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    many_bases.push_back(static_cast<int>(pow_state >> 40) % 1000002 + 1);
+    pow_state = pow_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    many_exponents.push_back(pow_state >> 4);
+    many_expected = many_expected * (many_bases[i] ^ BigUnsigned(many_exponents[i]));
+  }
+  std::cout << "product of 200 powers (window " << pippengerWindow(200, 60)
+            << "): " << multiPow(many_bases, many_exponents) << " = " << many_expected
+            << " (mod1000003)" << std::endl;
+  // Matrices don't commute, so their powers are multiplied in order.
+  typedef DenseMatrixNSpace<2, IntegerModNOps<101> > GL2Mod101Space;
+  typedef GL2Mod101Space::group GL2Mod101;
+  GL2Mod101 shear_x = GL2Mod101Space::instance.id(), shear_y = shear_x;
+  shear_x.element_[0][1] = 1;
+  shear_y.element_[1][0] = 1;
+  std::vector<GL2Mod101> shears {shear_x, shear_y};
+  std::vector<int> shear_exponents {3, 5};
+  GL2Mod101 shears_product = multiPow(shears, shear_exponents);
+  std::cout << "x^3 * y^5 (mod101) =" << std::endl << shears_product
+            << "in order: " << (shears_product == (shear_x ^ 3) * (shear_y ^ 5)) << std::endl;
+  std::vector<GL2Mod101> many_shears;
+  std::vector<uint64_t> shear_powers;
+  GL2Mod101 shears_expected = GL2Mod101Space::instance.id();
+  for (int i = 0; i < 200; i++) {
+    many_shears.push_back(i % 2 ? shear_y : shear_x);
+    shear_powers.push_back(many_exponents[i]);
+    shears_expected = shears_expected * (many_shears[i] ^ BigUnsigned(shear_powers[i]));
+  }
+  std::cout << "product of 200 alternating shear powers in order: "
+            << (multiPow(many_shears, shear_powers) == shears_expected) << std::endl;
+
+  typedef DenseMatrixNSpace<3, MontgomeryModOps> GL3MontSpace;
+  GL3MontSpace gl3mont(mont);
+  GL3MontSpace::ring mont_mat(gl3mont.id(), gl3mont);
+  mont_mat.element_[0][1] = big;
+  mont_mat.element_[1][0] = small;
+  std::cout << (mont_mat ^ 3) << std::endl;
+
+  typedef RnsOps<3> Rns3;
+  Rns3 rns {2147483647, 2147483629, 2147483587};
+  Rns3::ring r1(rns.encode(123456789012LL), rns), r2(rns.encode(-5), rns);
+  std::cout << r1 << " * " << r2 << " = " << r1 * r2 << std::endl;
+  std::cout << r1 << " * " << r1 << " * " << r1 << " = "
+            << r1 * r1 * r1 << std::endl;
+  // Bulk products go channel by channel through ResidueBatch, except for
+  // the modulus past 2^31, which it doesn't take.
+  RnsOps<3> rns_mixed {4294967291u, 2147483647, 1000003};
+  std::vector<RnsNumber<3> > rns_xs, rns_ys, rns_sums, rns_products;
+  for (long long i = 0; i < 1000; i++) {
+    rns_xs.push_back(rns_mixed.encode(i * i * i - 500));
+    rns_ys.push_back(rns_mixed.encode(7 * i + 1));
+  }
+  rns_mixed.plusAll(rns_xs, rns_ys, &rns_sums);
+  rns_mixed.timesAll(rns_xs, rns_ys, &rns_products);
+  int rns_mismatches = 0;
+  for (size_t i = 0; i < rns_xs.size(); i++) {
+    rns_mismatches += rns_sums[i] != rns_mixed.plus(rns_xs[i], rns_ys[i]);
+    rns_mismatches += rns_products[i] != rns_mixed.times(rns_xs[i], rns_ys[i]);
+  }
+  std::cout << "RNS plusAll/timesAll: " << rns_mismatches << " mismatches" << std::endl;
+
+  // Two tuples against six moduli; M is past 2^128, so use BigUnsigned.
+  CrtBasis crt({4294967291u, 4294967279u, 4294967231u,
+                4294967197u, 4294967189u, 4294967161u});
+  std::vector<uint32_t> tuples {1, 2, 3, 4, 5, 6,
+                                7, 7, 7, 7, 7, 7};
+  std::vector<BigUnsigned> values;
+  crt.reconstructAll(tuples, &values);
+  std::cout << values[0] << " " << values[1] << std::endl;
+
+  // PerfRegistry's JSON has a region measured here, and with
+  // -DALGEBRA_PERF=1 (make perftest) the library's own regions too.
+  static PerfSite test_site("test region");
+  for (int i = 0; i < 3; i++) {
+    PerfRegion region(test_site);
+  }
+  DenseMatrix<BasicOps<long long> > perf_mat =
+      randomMatrix(BasicOps<long long>::instance, 8, 8, 100, 3);
+  perf_mat = perf_mat * perf_mat;
+  std::ostringstream perf_out;
+  PerfRegistry::instance().writeJson(perf_out);
+  std::string perf_json = perf_out.str();
+  bool perf_ok = perf_json.compare(0, 14, "{\"counters\": [") == 0 &&
+      std::count(perf_json.begin(), perf_json.end(), '{') ==
+          std::count(perf_json.begin(), perf_json.end(), '}') &&
+      std::count(perf_json.begin(), perf_json.end(), '[') ==
+          std::count(perf_json.begin(), perf_json.end(), ']') &&
+      perf_json.find("{\"name\": \"test region\", \"calls\": 3, ") != std::string::npos;
+#if ALGEBRA_PERF
+  const std::string product_region = "{\"name\": \"DenseMatrix::operator*\", \"calls\": ";
+  size_t product_at = perf_json.find(product_region);
+  perf_ok = perf_ok && product_at != std::string::npos &&
+      perf_json.compare(product_at + product_region.size(), 3, "0, ") != 0;
+#endif
+  std::cout << "perf JSON (ALGEBRA_PERF=" << ALGEBRA_PERF << "): "
+            << (perf_ok ? "ok" : perf_json) << std::endl;
+  if (!perf_ok) return 1;
+
   return 0;
 }
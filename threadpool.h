@@ -0,0 +1,307 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Ilia Mirkin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#pragma once
+
+/**
+ * A fixed set of worker threads with work stealing: each worker keeps its
+ * own deque of tasks, pushing and popping at the back (so nested tasks run
+ * depth first, with their data still in cache), and an idle worker steals
+ * from the front of the others' deques, which is where the biggest pieces
+ * of a recursive split sit. Threads that are not workers submit into a
+ * shared inbox.
+ *
+ * Tasks are grouped with a TaskGroup, whose wait() runs pending tasks on
+ * the waiting thread rather than blocking, so tasks can themselves spawn
+ * and wait on more tasks without tying up the pool.
+ */
+class ThreadPool {
+ public:
+  typedef std::function<void()> Task;
+
+  // 0 threads means one per hardware thread.
+  explicit ThreadPool(int threads = 0) : pending_(0), stopping_(false) {
+    if (threads <= 0) threads = std::thread::hardware_concurrency();
+    if (threads <= 0) threads = 1;
+    // One deque per worker, then the inbox.
+    for (int i = 0; i <= threads; i++) {
+      queues_.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (int i = 0; i < threads; i++) {
+      threads_.push_back(std::thread([this, i]() { work(i); }));
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i = 0; i < threads_.size(); i++) {
+      threads_[i].join();
+    }
+  }
+
+  // The pool that the library's parallel algorithms use by default.
+  static ThreadPool& shared() {
+    static ThreadPool pool;
+    return pool;
+  }
+
+  int size() const {
+    return static_cast<int>(threads_.size());
+  }
+
+  void submit(Task task) {
+    Queue& queue = *queues_[self()];
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+    }
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      pending_++;
+    }
+    wake_.notify_one();
+  }
+
+  // Runs one pending task on the calling thread, if there is one.
+  bool runOne() {
+    Task task;
+    if (!take(self(), &task)) return false;
+    task();
+    return true;
+  }
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  ThreadPool(const ThreadPool&) = delete;
+  void operator=(const ThreadPool&) = delete;
+
+  // Which pool the calling thread works for, and as which worker.
+  struct WorkerId {
+    const ThreadPool* pool;
+    size_t index;
+  };
+
+  static WorkerId& current() {
+    static thread_local WorkerId id = {NULL, 0};
+    return id;
+  }
+
+  // The calling thread's deque: its own for a worker, else the inbox.
+  size_t self() const {
+    const WorkerId& id = current();
+    return id.pool == this ? id.index : threads_.size();
+  }
+
+  bool popBack(size_t index, Task* task) {
+    Queue& queue = *queues_[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) return false;
+    *task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+  }
+
+  bool popFront(size_t index, Task* task) {
+    Queue& queue = *queues_[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) return false;
+    *task = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+    return true;
+  }
+
+  // Own deque first, then the inbox, then steal from the other workers.
+  bool take(size_t index, Task* task) {
+    size_t count = queues_.size();
+    bool found = popBack(index, task);
+    for (size_t i = 1; !found && i <= count; i++) {
+      found = popFront((index + i) % count, task);
+    }
+    if (found) pending_--;
+    return found;
+  }
+
+  void work(size_t index) {
+    current().pool = this;
+    current().index = index;
+    while (true) {
+      Task task;
+      if (take(index, &task)) {
+        task();
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      wake_.wait(lock, [this]() { return stopping_ || pending_ > 0; });
+      if (stopping_ && pending_ <= 0) return;
+    }
+  }
+
+  std::vector<std::unique_ptr<Queue> > queues_;
+  std::vector<std::thread> threads_;
+  // Tasks submitted and not yet taken. Taking decrements without the
+  // lock, so this can briefly dip below zero.
+  std::atomic<long> pending_;
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  bool stopping_;
+};
+
+/**
+ * Tasks run on a ThreadPool that can be waited for together. The first
+ * exception thrown by a task is rethrown from wait(); the destructor waits
+ * too, but drops exceptions.
+ */
+class TaskGroup {
+ public:
+  explicit TaskGroup(ThreadPool& pool = ThreadPool::shared()) :
+      pool_(pool), running_(0) {}
+
+  ~TaskGroup() {
+    try {
+      wait();
+    } catch (...) {
+    }
+  }
+
+  template <typename F>
+  void run(F task) {
+    running_++;
+    pool_.submit([this, task]() {
+      try {
+        task();
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_) error_ = std::current_exception();
+      }
+      // Notify under the lock, so that the group cannot be destroyed
+      // between the decrement and the notify.
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--running_ == 0) done_.notify_all();
+    });
+  }
+
+  // Helps run the pool's tasks until all of the group's are done.
+  void wait() {
+    while (running_ > 0) {
+      if (pool_.runOne()) continue;
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_.wait_for(lock, std::chrono::microseconds(100),
+                     [this]() { return running_ == 0; });
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (error_) {
+      std::exception_ptr error = error_;
+      error_ = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+ private:
+  TaskGroup(const TaskGroup&) = delete;
+  void operator=(const TaskGroup&) = delete;
+
+  ThreadPool& pool_;
+  std::atomic<long> running_;
+  std::mutex mutex_;
+  std::condition_variable done_;
+  std::exception_ptr error_;
+};
+
+/**
+ * How a parallel algorithm may split up its work: the pool to run on, the
+ * most pieces to split into (so the most threads at work at once), and the
+ * least work worth a piece of its own, in whatever the algorithm counts
+ * (element operations for the matrix kernels).
+ */
+struct ParallelOptions {
+  ParallelOptions() : pool(NULL), threads(0), grain(1 << 16) {}
+
+  // NULL means ThreadPool::shared().
+  ThreadPool* pool;
+  // 0 means one per worker plus the calling thread; 1 runs serially.
+  int threads;
+  uint64_t grain;
+
+  ThreadPool& threadPool() const {
+    return pool ? *pool : ThreadPool::shared();
+  }
+
+  // How many pieces work units of work should be split into.
+  int pieces(uint64_t work) const {
+    uint64_t ret = threads > 0 ? threads : threadPool().size() + 1;
+    ret = std::min(ret, work / std::max<uint64_t>(grain, 1));
+    return ret > 1 ? static_cast<int>(ret) : 1;
+  }
+
+  // What DenseMatrix's operators use. Change it before starting threads
+  // that use them.
+  static ParallelOptions& defaults() {
+    static ParallelOptions options;
+    return options;
+  }
+};
+
+/**
+ * Calls f(begin, end) over consecutive ranges that cover [0, count), in
+ * parallel, with count * cost units of work split as options allow. The
+ * calling thread takes the last range.
+ */
+template <typename F>
+void parallelFor(size_t count, uint64_t cost, const F& f,
+                 const ParallelOptions& options = ParallelOptions::defaults()) {
+  int pieces = options.pieces(count * cost);
+  if (pieces <= 1) {
+    f(static_cast<size_t>(0), count);
+    return;
+  }
+  size_t size = (count + pieces - 1) / pieces;
+  TaskGroup group(options.threadPool());
+  size_t begin = 0;
+  for (; begin + size < count; begin += size) {
+    group.run([&f, begin, size]() { f(begin, begin + size); });
+  }
+  f(begin, count);
+  group.wait();
+}
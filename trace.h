@@ -34,11 +34,11 @@ template <typename T>
 class Trace {
  public:
   Trace() {}
-  Trace(const Trace& other) : word_(other.word_) {}
+  Trace(const Trace& other) = default;
+  Trace(Trace&& other) = default;
   Trace(std::initializer_list<T> init) : word_(init) {}
-  void operator=(const Trace& other) {
-    word_ = other.word_;
-  }
+  Trace& operator=(const Trace& other) = default;
+  Trace& operator=(Trace&& other) = default;
 
   bool operator==(const Trace& other) const {
     size_t n = word_.elements_.size();
@@ -32,14 +32,14 @@ template <typename T>
 class Word {
  public:
   Word() {}
-  Word(const Word<T>& other) : elements_(other.elements_) {}
+  Word(const Word<T>& other) = default;
+  Word(Word<T>&& other) = default;
   Word(std::initializer_list<T> init) {
     elements_.reserve(init.size());
     std::copy(init.begin(), init.end(), std::back_inserter(elements_));
   }
-  void operator=(const Word<T>& other) {
-    elements_ = other.elements_;
-  }
+  Word& operator=(const Word<T>& other) = default;
+  Word& operator=(Word<T>&& other) = default;
 
   bool operator==(const Word<T>& other) const {
     if (elements_.size() != other.elements_.size()) {